@@ -11,43 +11,276 @@
 
  ************************************************************/
 #include "FIFO.h"
+#include "SpillLog.h"
+
+#include <string.h>
 
 #define DEF_FIFO_DEPTH        60
 
 /*************************************************************
 
-  FIFO Node stuffs
+  Private helpers
 
 **************************************************************/
 
-FIFONode* FIFONode_create()
+/**
+ * Rounds up to the next power of two so that the ring
+ * indices can be wrapped with a simple mask.
+ */
+static uint32_t fifo_round_pow2(uint32_t n)
+{
+  uint32_t cap = 1;
+  while (cap < n) cap <<= 1;
+  return cap;
+}
+
+/**
+ * Bytes needed for 'cap' entries in the given storage mode.
+ * Packed modes get 3 spare bytes so that an entry can always
+ * be read with a single 4 byte window.
+ */
+static uint32_t fifo_storage_size(uint32_t cap, uint8_t entry_bits)
+{
+  if (entry_bits == FIFO_STORAGE_WORD) {
+    return sizeof(fifo_data_t)*cap;
+  }
+  return (cap*entry_bits + 7)/8 + 3;
+}
+
+/**
+ * Allocates the ring storage for the given depth, once,
+ * from fifo_create.
+ */
+static void fifo_alloc(FIFO* fifo, uint32_t fifo_depth)
+{
+  uint32_t size;
+
+  if (fifo_depth == 0) fifo_depth = 1;
+
+  fifo->buf  = NULL;
+  fifo->pbuf = NULL;
+
+  fifo->depth    = fifo_depth;
+  fifo->capacity = fifo_round_pow2(fifo_depth);
+  fifo->mask     = fifo->capacity - 1;
+
+  size = fifo_storage_size(fifo->capacity, fifo->entry_bits);
+  if (fifo->entry_bits == FIFO_STORAGE_WORD) {
+    fifo->buf  = (fifo_data_t*)malloc(size);
+  }
+  else {
+    fifo->pbuf = (uint8_t*)calloc(size, 1);
+  }
+
+  fifo->head     = 0;
+  fifo->tail     = 0;
+  fifo->n_nodes  = 0;
+}
+
+/**
+ * Packed slot accessors. Slot 'idx' is already masked.
+ *
+ * 24 bit entries are 3 byte aligned. 17 bit entries sit at
+ * bit offset idx*17 and span at most 3 bytes.
+ */
+static uint32_t fifo_load_packed(FIFO* fifo, uint32_t idx)
+{
+  uint32_t bit_off, word;
+  uint8_t* p;
+
+  if (fifo->entry_bits == FIFO_STORAGE_PACKED24) {
+    p = fifo->pbuf + idx*3;
+    return (uint32_t)p[0] | ((uint32_t)p[1]<<8) | ((uint32_t)p[2]<<16);
+  }
+
+  bit_off = idx*FIFO_STORAGE_PACKED17;
+  p = fifo->pbuf + (bit_off>>3);
+  word = (uint32_t)p[0] | ((uint32_t)p[1]<<8) | ((uint32_t)p[2]<<16);
+
+  return (word >> (bit_off&7)) & FIFO_PACKED_MASK;
+}
+
+static void fifo_store_packed(FIFO* fifo, uint32_t idx, uint32_t packed)
+{
+  uint32_t bit_off, word, mask;
+  uint8_t* p;
+
+  if (fifo->entry_bits == FIFO_STORAGE_PACKED24) {
+    p = fifo->pbuf + idx*3;
+    p[0] = (uint8_t)(packed);
+    p[1] = (uint8_t)(packed>>8);
+    p[2] = (uint8_t)(packed>>16);
+    return;
+  }
+
+  bit_off = idx*FIFO_STORAGE_PACKED17;
+  p = fifo->pbuf + (bit_off>>3);
+  mask = (uint32_t)FIFO_PACKED_MASK << (bit_off&7);
+
+  word  = (uint32_t)p[0] | ((uint32_t)p[1]<<8) | ((uint32_t)p[2]<<16);
+  word  = (word & ~mask) | ((packed << (bit_off&7)) & mask);
+
+  p[0] = (uint8_t)(word);
+  p[1] = (uint8_t)(word>>8);
+  p[2] = (uint8_t)(word>>16);
+}
+
+/**
+ * Keeps the per channel latest entry table up to date.
+ */
+static inline void fifo_update_latest(FIFO* fifo, fifo_data_t data)
+{
+  uint8_t ch = (uint8_t)((data & FIFO_ENTRY_ADDR_MASK) >> FIFO_ENTRY_ADDR_SHIFT);
+
+  fifo->latest[ch] = data;
+  fifo->latest_valid |= (1UL << ch);
+}
+
+/**
+ * Timestamp bookkeeping.
+ *
+ * Each entry carries the time elapsed since the previously
+ * stored one. base_time is the time the oldest entry's delta
+ * counts from, so: base_time + (sum of stored deltas) == last_time.
+ */
+static inline uint32_t fifo_entry_delta(fifo_data_t data)
+{
+  return (data & FIFO_ENTRY_TS_MASK) >> FIFO_ENTRY_TS_SHIFT;
+}
+
+static fifo_data_t fifo_stamp(FIFO* fifo, fifo_data_t data)
+{
+  uint32_t now, delta;
+
+  if (fifo->Clock) {
+    now = fifo->Clock();
+
+    /* Nothing to be relative to: start over exactly */
+    if (!fifo->n_nodes) {
+      fifo->base_time = now;
+      fifo->last_time = now;
+    }
+
+    /* A saturated delta understates the gap, but keeps the sum right */
+    delta = now - fifo->last_time;
+    if (delta > FIFO_TS_DELTA_MAX) delta = FIFO_TS_DELTA_MAX;
+
+    data = (data & ~FIFO_ENTRY_TS_MASK) | (delta << FIFO_ENTRY_TS_SHIFT);
+  }
+  else {
+    /* No clock: the caller already put the delta in */
+    delta = fifo_entry_delta(data);
+  }
+
+  fifo->last_time += delta;
+  return data;
+}
+
+/**
+ * Moves base_time past the 'n' oldest entries before they go.
+ */
+static void fifo_retire_time(FIFO* fifo, uint32_t n)
+{
+  uint32_t i;
+
+  for (i=0; i<n; i++) {
+    fifo->base_time += fifo_entry_delta(fifo->buf[(fifo->tail + i) & fifo->mask]);
+  }
+}
+
+/**
+ * Drops the 'n' oldest entries to make room.
+ * They go to the spill log, if there is one.
+ */
+static void fifo_drop_oldest(FIFO* fifo, uint32_t n)
+{
+  uint32_t i, pos;
+
+  if (fifo->spill) {
+    for (i=0; i<n; i++) {
+      pos = (fifo->tail + i) & fifo->mask;
+      SpillLog_append(fifo->spill, (fifo->entry_bits == FIFO_STORAGE_WORD) ? \
+        fifo->buf[pos] : FIFO_unpack_entry(fifo_load_packed(fifo, pos)));
+    }
+  }
+
+  if (fifo->timestamped) fifo_retire_time(fifo, n);
+
+  fifo->tail    += n;
+  fifo->n_nodes -= n;
+  fifo->stats.n_drops += n;
+}
+
+/**
+ * Drops the 'n' first entries of a batch that doesn't fit
+ * even in an empty FIFO. They go to the spill log as well.
+ */
+static void fifo_drop_batch(FIFO* fifo, const fifo_data_t* data, uint32_t n)
 {
-  FIFONode* fifoNode = (FIFONode*)malloc(sizeof(FIFONode));
+  uint32_t i;
 
-  fifoNode->data = (fifo_data_t)0;
-  fifoNode->next = NULL;
+  if (fifo->spill) {
+    for (i=0; i<n; i++) SpillLog_append(fifo->spill, data[i]);
+  }
 
-  return fifoNode;
+  fifo->stats.n_drops += n;
 }
 
-FIFONode* FIFONode_create_with_data(fifo_data_t data_value)
+/**
+ * Makes room for the 'n' new entries in 'data' according to
+ * the overflow policy. Returns how many of them can be stored.
+ *
+ * With FIFO_POLICY_DROP_OLDEST, a batch larger than the depth
+ * only keeps its newest 'depth' entries. The stored entries are
+ * dropped first, then the head of the batch, so that the spill
+ * log still gets everything in order.
+ */
+static uint32_t fifo_make_room(FIFO* fifo, const fifo_data_t* data, uint32_t n)
 {
-  FIFONode* fifoNode = FIFONode_create();
-  fifoNode->data = data_value;
-  return fifoNode;
+  uint32_t free_n = fifo->depth - fifo->n_nodes;
+
+  if (n <= free_n) return n;
+
+  if (fifo->policy == FIFO_POLICY_DROP_OLDEST) {
+    if (n > fifo->depth) {
+      fifo_drop_oldest(fifo, fifo->n_nodes);
+      fifo_drop_batch(fifo, data, n - fifo->depth);
+      return fifo->depth;
+    }
+    fifo_drop_oldest(fifo, n - free_n);
+    return n;
+  }
+
+  /* FIFO_POLICY_DROP_NEWEST and FIFO_POLICY_REJECT */
+  fifo->stats.n_drops += (n - free_n);
+  return free_n;
 }
 
-FIFONode* FIFONode_create_with_data_next(
-  fifo_data_t data_value, FIFONode* nextNode)
+/**
+ * Bookkeeping after 'n' entries were stored.
+ */
+static inline void fifo_stored(FIFO* fifo, uint32_t n)
 {
-  FIFONode* fifoNode = FIFONode_create_with_data(data_value);
-  fifoNode->next = nextNode;
-  return fifoNode;
+  fifo->head    += n;
+  fifo->n_nodes += n;
+
+  fifo->stats.n_pushes += n;
+  if (fifo->n_nodes > fifo->stats.high_water) {
+    fifo->stats.high_water = fifo->n_nodes;
+  }
 }
 
-void FIFONode_destroy(FIFONode* fifoNode)
+/**
+ * Bookkeeping after 'n' entries were consumed.
+ */
+static inline void fifo_consumed(FIFO* fifo, uint32_t n)
 {
-  if (fifoNode) free(fifoNode);
+  if (fifo->timestamped) fifo_retire_time(fifo, n);
+
+  fifo->tail    += n;
+  fifo->n_nodes -= n;
+
+  fifo->stats.n_pops += n;
 }
 
 /*************************************************************
@@ -56,105 +289,325 @@ void FIFONode_destroy(FIFONode* fifoNode)
 
 **************************************************************/
 
-void push_fifo(FIFO* fifo, fifo_data_t data)
+int push_fifo(FIFO* fifo, fifo_data_t data)
 {
+  /* The newest value table always sees the sample, even if it gets dropped */
+  fifo_update_latest(fifo, data);
 
-  FIFONode* tmp;
+  /* Dropping the oldest one, or this one, if the fifo is full */
+  if (!fifo_make_room(fifo, &data, 1)) {
+    return (fifo->policy == FIFO_POLICY_REJECT) ? FIFO_FULL : FIFO_SUCCESS;
+  }
 
-  /* Dropping the last one to insert a new one if the fifo is full */
-  if (fifo->n_nodes >= fifo->depth) {
-    FIFONode* del_tmp = fifo->last_node;
-    FIFONode* del_tmp_prev = fifo->first_node;
+  if (fifo->timestamped) data = fifo_stamp(fifo, data);
 
-    while (del_tmp_prev->next != fifo->last_node) del_tmp_prev = del_tmp_prev->next;
+  fifo->buf[fifo->head & fifo->mask] = data;
+  fifo_stored(fifo, 1);
 
-    fifo->last_node = del_tmp_prev;
-    fifo->last_node->next = NULL;
+  return FIFO_SUCCESS;
+}
 
-    FIFONode_destroy(del_tmp);
-    fifo->n_nodes--;
+fifo_data_t pop_fifo(FIFO* fifo)
+{
+  fifo_data_t ret_data;
+
+  if (!fifo->n_nodes) {
+    return 0;
   }
 
-  /* If the fifo is empty */
-  if (!fifo->first_node) {
-    tmp = FIFONode_create_with_data(data);
-    tmp->next = NULL;
-    fifo->first_node = tmp;
-    fifo->last_node = tmp;
-    fifo->n_nodes++;
+  ret_data = fifo->buf[fifo->tail & fifo->mask];
+  fifo_consumed(fifo, 1);
+
+  return ret_data;
+}
+
+int push_fifo_packed(FIFO* fifo, fifo_data_t data)
+{
+  fifo_update_latest(fifo, data);
+
+  if (!fifo_make_room(fifo, &data, 1)) {
+    return (fifo->policy == FIFO_POLICY_REJECT) ? FIFO_FULL : FIFO_SUCCESS;
   }
-  else {
-    tmp = FIFONode_create_with_data_next(data, fifo->first_node);
-    fifo->first_node = tmp;
-    fifo->n_nodes++;
+
+  fifo_store_packed(fifo, fifo->head & fifo->mask, FIFO_pack_entry(data));
+  fifo_stored(fifo, 1);
+
+  return FIFO_SUCCESS;
+}
+
+fifo_data_t pop_fifo_packed(FIFO* fifo)
+{
+  fifo_data_t ret_data;
+
+  if (!fifo->n_nodes) {
+    return 0;
   }
-  return;
+
+  ret_data = FIFO_unpack_entry(fifo_load_packed(fifo, fifo->tail & fifo->mask));
+  fifo_consumed(fifo, 1);
+
+  return ret_data;
 }
 
-fifo_data_t pop_fifo(FIFO* fifo)
+uint32_t FIFO_push_n(FIFO* fifo, const fifo_data_t* data, uint32_t n)
+{
+  uint32_t i, accepted, idx, chunk;
+
+  /* Packed and timestamped entries go one by one */
+  if (fifo->entry_bits != FIFO_STORAGE_WORD || fifo->timestamped) {
+    accepted = fifo->stats.n_pushes;
+    for (i=0; i<n; i++) fifo->Push(fifo, data[i]);
+    return fifo->stats.n_pushes - accepted;
+  }
+
+  for (i=0; i<n; i++) fifo_update_latest(fifo, data[i]);
+
+  accepted = fifo_make_room(fifo, data, n);
+
+  /* Drop-oldest keeps the tail end of the batch, the others its head */
+  if (fifo->policy == FIFO_POLICY_DROP_OLDEST) {
+    data += (n - accepted);
+  }
+  n = accepted;
+
+  /* Up to the end of the ring, then the rest from the start */
+  idx   = fifo->head & fifo->mask;
+  chunk = fifo->capacity - idx;
+  if (chunk > n) chunk = n;
+
+  memcpy(&(fifo->buf[idx]), data, sizeof(fifo_data_t)*chunk);
+  if (n > chunk) {
+    memcpy(fifo->buf, data + chunk, sizeof(fifo_data_t)*(n - chunk));
+  }
+
+  fifo_stored(fifo, n);
+
+  return accepted;
+}
+
+uint32_t FIFO_pop_n(FIFO* fifo, fifo_data_t* data, uint32_t n)
 {
-  if (!fifo->first_node) {
+  uint32_t i, idx, chunk;
+
+  if (n > fifo->n_nodes) n = fifo->n_nodes;
+
+  if (fifo->entry_bits != FIFO_STORAGE_WORD) {
+    for (i=0; i<n; i++) data[i] = fifo->Pop(fifo);
+    return n;
+  }
+
+  idx   = fifo->tail & fifo->mask;
+  chunk = fifo->capacity - idx;
+  if (chunk > n) chunk = n;
+
+  memcpy(data, &(fifo->buf[idx]), sizeof(fifo_data_t)*chunk);
+  if (n > chunk) {
+    memcpy(data + chunk, fifo->buf, sizeof(fifo_data_t)*(n - chunk));
+  }
+
+  fifo_consumed(fifo, n);
+
+  return n;
+}
+
+uint32_t FIFO_peek_span(FIFO* fifo, const fifo_data_t** span)
+{
+  uint32_t idx, n;
+
+  if (fifo->entry_bits != FIFO_STORAGE_WORD || !fifo->n_nodes) {
+    (*span) = NULL;
     return 0;
   }
 
-  fifo_data_t ret_data;
+  idx = fifo->tail & fifo->mask;
+  n   = fifo->capacity - idx;
+  if (n > fifo->n_nodes) n = fifo->n_nodes;
 
-  FIFONode* tmp = fifo->last_node;
-  ret_data = tmp->data;
+  (*span) = &(fifo->buf[idx]);
+  return n;
+}
+
+void FIFO_release(FIFO* fifo, uint32_t n)
+{
+  if (n > fifo->n_nodes) n = fifo->n_nodes;
 
-  /* Single node case */
-  if (fifo->first_node == fifo->last_node) {
-    fifo->first_node = NULL;
-    fifo->last_node = NULL;
-    FIFONode_destroy(tmp);
-    fifo->n_nodes = 0;
-    return ret_data;
+  fifo_consumed(fifo, n);
+}
+
+void FIFO_cursor_begin(FIFO* fifo, FIFOCursor* cursor)
+{
+  cursor->pos  = fifo->tail;
+  cursor->time = fifo->base_time;
+}
+
+bool FIFO_cursor_next(FIFO* fifo, FIFOCursor* cursor, fifo_data_t* data)
+{
+  /* Entries under the cursor got dropped by the overflow policy */
+  if ((int32_t)(cursor->pos - fifo->tail) < 0) {
+    cursor->pos  = fifo->tail;
+    cursor->time = fifo->base_time;
   }
 
-  FIFONode* tmp_prev = fifo->first_node;
-  while(tmp_prev->next != fifo->last_node) tmp_prev = tmp_prev->next;
-  fifo->last_node = tmp_prev;
-  fifo->last_node->next = NULL;
-  
-  fifo->n_nodes--;
-  FIFONode_destroy(tmp);
+  if (cursor->pos == fifo->head) return false;
 
-  return ret_data;
+  if (fifo->entry_bits == FIFO_STORAGE_WORD) {
+    (*data) = fifo->buf[cursor->pos & fifo->mask];
+    cursor->time += fifo_entry_delta(*data);
+  }
+  else {
+    (*data) = FIFO_unpack_entry(fifo_load_packed(fifo, cursor->pos & fifo->mask));
+  }
+  cursor->pos++;
+
+  return true;
 }
 
-FIFO* FIFO_create_skel(void)
+void FIFO_cursor_commit(FIFO* fifo, FIFOCursor* cursor)
+{
+  if ((int32_t)(cursor->pos - fifo->tail) > 0) {
+    FIFO_release(fifo, cursor->pos - fifo->tail);
+  }
+}
+
+bool FIFO_enable_timestamps(FIFO* fifo, uint32_t (*clock)(void))
+{
+  /* The packed forms have no room for the delta */
+  if (fifo->entry_bits != FIFO_STORAGE_WORD) return false;
+
+  fifo->timestamped = true;
+  fifo->Clock       = clock;
+  FIFO_set_base_time(fifo, clock ? clock() : 0);
+
+  return true;
+}
+
+void FIFO_set_base_time(FIFO* fifo, uint32_t time)
+{
+  if (fifo->n_nodes) return;
+
+  fifo->base_time = time;
+  fifo->last_time = time;
+}
+
+/* base_time + (sum of stored deltas) == last_time still holds */
+void FIFO_anchor_newest(FIFO* fifo, uint32_t time)
+{
+  fifo->base_time += time - fifo->last_time;
+  fifo->last_time  = time;
+}
+
+fifo_data_t FIFO_pop_timed(FIFO* fifo, uint32_t* time)
+{
+  if (!fifo->n_nodes) return 0;
+
+  (*time) = fifo->base_time;
+  if (fifo->timestamped) {
+    (*time) += fifo_entry_delta(fifo->buf[fifo->tail & fifo->mask]);
+  }
+
+  return fifo->Pop(fifo);
+}
+
+void FIFO_attach_spill(FIFO* fifo, struct __spill_log__* spill)
+{
+  fifo->spill = spill;
+}
+
+void FIFO_set_policy(FIFO* fifo, uint8_t policy)
+{
+  fifo->policy = policy;
+}
+
+void FIFO_get_stats(FIFO* fifo, FIFOStats* stats)
+{
+  (*stats) = fifo->stats;
+}
+
+void FIFO_reset_stats(FIFO* fifo)
+{
+  fifo->stats.n_pushes   = 0;
+  fifo->stats.n_pops     = 0;
+  fifo->stats.n_drops    = 0;
+  fifo->stats.high_water = fifo->n_nodes;
+}
+
+bool FIFO_latest(FIFO* fifo, uint8_t ch_addr, fifo_data_t* data)
+{
+  if (ch_addr >= FIFO_N_CHANNELS) return false;
+  if (!((fifo->latest_valid >> ch_addr) & 0x1)) return false;
+
+  (*data) = fifo->latest[ch_addr];
+  return true;
+}
+
+uint32_t FIFO_storage_bytes(FIFO* fifo)
+{
+  return fifo_storage_size(fifo->capacity, fifo->entry_bits);
+}
+
+uint32_t FIFO_footprint(FIFO* fifo)
+{
+  return (uint32_t)sizeof(FIFO) + FIFO_storage_bytes(fifo);
+}
+
+/**
+ * Common part of the constructors: everything set up
+ * and the storage allocated for 'fifo_depth' entries.
+ */
+static FIFO* fifo_create(uint32_t fifo_depth, uint8_t entry_bits)
 {
   FIFO* fifo = (FIFO*)malloc(sizeof(FIFO));
 
-  fifo->n_nodes = 0;
-  fifo->depth = DEF_FIFO_DEPTH;
-  fifo->first_node = NULL;
-  fifo->last_node = NULL;
+  fifo->entry_bits = entry_bits;
+  fifo_alloc(fifo, fifo_depth);
+
+  fifo->latest_valid = 0;
+
+  fifo->policy = FIFO_POLICY_DROP_OLDEST;
+  fifo->spill  = NULL;
 
-  fifo->Push =   &(push_fifo);
-  fifo->Pop  =   &(pop_fifo);
+  fifo->timestamped = false;
+  fifo->base_time   = 0;
+  fifo->last_time   = 0;
+  fifo->Clock       = NULL;
+  FIFO_reset_stats(fifo);
+
+  if (entry_bits == FIFO_STORAGE_WORD) {
+    fifo->Push = &(push_fifo);
+    fifo->Pop  = &(pop_fifo);
+  }
+  else {
+    fifo->Push = &(push_fifo_packed);
+    fifo->Pop  = &(pop_fifo_packed);
+  }
 
   return fifo;
 }
 
+FIFO* FIFO_create_skel(void)
+{
+  return fifo_create(DEF_FIFO_DEPTH, FIFO_STORAGE_WORD);
+}
+
 FIFO* FIFO_create(uint32_t fifo_depth)
 {
-  FIFO* fifo = FIFO_create_skel();
-  fifo->depth = fifo_depth;
+  return fifo_create(fifo_depth, FIFO_STORAGE_WORD);
+}
+
+FIFO* FIFO_create_packed(uint32_t fifo_depth, uint8_t entry_bits)
+{
+  if (entry_bits != FIFO_STORAGE_PACKED17 && entry_bits != FIFO_STORAGE_PACKED24) {
+    entry_bits = FIFO_STORAGE_PACKED17;
+  }
 
-  return fifo;
+  return fifo_create(fifo_depth, entry_bits);
 }
 
 void FIFO_destroy(FIFO* fifo)
 {
   if (fifo) {
-    FIFONode* tmp = fifo->first_node;
-    FIFONode* tmp_del;
-    while (tmp->next) {
-      tmp_del = tmp;
-      tmp = tmp->next;
-      FIFONode_destroy(tmp_del);
-    }
+    if (fifo->buf) free(fifo->buf);
+    if (fifo->pbuf) free(fifo->pbuf);
+    free(fifo);
   }
 }
-
@@ -29,44 +29,136 @@
 typedef uint32_t fifo_data_t;
 
 /**
- The FIFO Node - the main data storage nodes.
+ Storage modes: the number of bits kept per entry.
+
+ A SWIM entry only carries 5 address bits and 12 ADC bits
+ (see FIFO_DATA_MASK in SWIMProtocol.h), so the packed modes
+ squeeze it into a 17 bit bitstream or into 3 bytes.
  */
-typedef struct __fifo_node__ {
+#define FIFO_STORAGE_WORD            32
+#define FIFO_STORAGE_PACKED24        24
+#define FIFO_STORAGE_PACKED17        17
 
-  fifo_data_t data;
+/**
+ Entry layout, mirrors the FIFO masks of SWIMProtocol.h
+ */
+#define FIFO_ENTRY_ADC_MASK          0xFFF
+#define FIFO_ENTRY_ADDR_MASK         0xF8000
+#define FIFO_ENTRY_ADDR_SHIFT        15
+#define FIFO_PACKED_ADDR_SHIFT       12
+#define FIFO_PACKED_MASK             0x1FFFF
 
-  struct __fifo_node__* next;
+/**
+ Timestamped entries keep the time since the previous entry in
+ the otherwise unused top 12 bits (word storage only).
+ */
+#define FIFO_ENTRY_TS_SHIFT          20
+#define FIFO_ENTRY_TS_MASK           0xFFF00000
+#define FIFO_TS_DELTA_MAX            0xFFF
 
-} FIFONode;
+/**
+ Overflow policies: what Push does once 'depth' is reached.
+ */
+#define FIFO_POLICY_DROP_OLDEST      0     /* Make room by dropping the oldest entry */
+#define FIFO_POLICY_DROP_NEWEST      1     /* Silently drop the new entry */
+#define FIFO_POLICY_REJECT           2     /* Drop the new entry and return FIFO_FULL */
 
-#ifdef __cplusplus
-extern "C" {
-#endif
+/* Status codes */
+#define FIFO_SUCCESS                 0
+#define FIFO_FULL                    -1
 
-FIFONode* FIFONode_create();
-FIFONode* FIFONode_create_with_data(fifo_data_t data_value);
-FIFONode* FIFONode_create_with_data_next(
-  fifo_data_t data_value, FIFONode* nextNode);
+/**
+ Number of channels addressable by the 5 address bits.
+ */
+#define FIFO_N_CHANNELS              32
 
-void FIFONode_destroy(FIFONode* fifoNode);
+/**
+ Pack/unpack accessors between fifo_data_t and the 17 bit form.
+ */
+static inline uint32_t FIFO_pack_entry(fifo_data_t data)
+{
+  return (data & FIFO_ENTRY_ADC_MASK) | \
+    (((data & FIFO_ENTRY_ADDR_MASK) >> FIFO_ENTRY_ADDR_SHIFT) << FIFO_PACKED_ADDR_SHIFT);
+}
 
-#ifdef __cplusplus
-} /* Matching } for the extern C */
-#endif
+static inline fifo_data_t FIFO_unpack_entry(uint32_t packed)
+{
+  return (packed & FIFO_ENTRY_ADC_MASK) | \
+    ((packed >> FIFO_PACKED_ADDR_SHIFT) << FIFO_ENTRY_ADDR_SHIFT);
+}
+
+/* Spill log for dropped entries, see SpillLog.h */
+struct __spill_log__;
+
+/**
+ Occupancy counters. Each one is a single 32 bit word written
+ only by the FIFO owner, so they can be read without locking.
+ n_drops counts every entry lost to the overflow policy.
+ */
+typedef struct __snh_fifo_stats__ {
+
+  uint32_t n_pushes;               /* Entries stored */
+  uint32_t n_pops;                 /* Entries consumed */
+  uint32_t n_drops;                /* Entries lost on overflow */
+  uint32_t high_water;             /* Highest n_nodes seen */
+
+} FIFOStats;
+
+/**
+ A read cursor. Walks the stored entries from the oldest one
+ without consuming them.
+ */
+typedef struct __snh_fifo_cursor__ {
+
+  uint32_t pos;                    /* Read counter of the next entry */
+  uint32_t time;                   /* Time of the last entry read (timestamped FIFO) */
+
+} FIFOCursor;
 
 /**
  The FIFO - the FIFO class itself.
+
+ A fixed capacity ring buffer. The storage is allocated once
+ in FIFO_create and rounded up to a power of two so that the
+ indices can be wrapped with a mask. head and tail are free
+ running counters; (head - tail) is the number of entries.
+
+ When the FIFO reaches 'depth', the overflow policy decides
+ what gets lost. By default the oldest entry is dropped to
+ make room for the new one.
  */
 
 typedef struct __snh_fifo__ {
 
-  uint32_t n_nodes;
-  uint32_t depth;
+  uint32_t n_nodes;                /* Number of stored entries */
+  uint32_t depth;                  /* Maximum number of entries */
+
+  uint32_t capacity;               /* Storage size, power of two >= depth */
+  uint32_t mask;                   /* capacity - 1 */
+  uint32_t head;                   /* Write counter */
+  uint32_t tail;                   /* Read counter */
+
+  uint8_t  entry_bits;             /* FIFO_STORAGE_* */
+  uint8_t  policy;                 /* FIFO_POLICY_* */
+
+  FIFOStats stats;
+
+  struct __spill_log__* spill;     /* Catches entries dropped by DROP_OLDEST */
 
-  FIFONode* first_node;
-  FIFONode* last_node;
+  /* Timestamped entries */
+  bool     timestamped;
+  uint32_t base_time;              /* Time the oldest entry's delta counts from */
+  uint32_t last_time;              /* Time of the newest entry */
+  uint32_t (*Clock)(void);         /* Time source, NULL if the deltas come with the data */
 
-  void (*Push)(struct __snh_fifo__*, fifo_data_t data);
+  fifo_data_t* buf;                /* Word storage */
+  uint8_t*     pbuf;               /* Packed storage */
+
+  /* Newest entry of each channel, updated on every Push */
+  fifo_data_t  latest[FIFO_N_CHANNELS];
+  uint32_t     latest_valid;       /* Bit per channel */
+
+  int (*Push)(struct __snh_fifo__*, fifo_data_t data);
   fifo_data_t (*Pop)(struct __snh_fifo__*);
 
 } FIFO;
@@ -76,12 +168,104 @@ typedef struct __snh_fifo__ {
 extern "C" {
 #endif
 
-void push_fifo(FIFO* fifo, fifo_data_t data);
+int push_fifo(FIFO* fifo, fifo_data_t data);
 fifo_data_t pop_fifo(FIFO* fifo); 
 
+int push_fifo_packed(FIFO* fifo, fifo_data_t data);
+fifo_data_t pop_fifo_packed(FIFO* fifo);
+
+/**
+ Batch access.
+
+ FIFO_push_n pushes 'n' entries under the overflow policy and
+ returns how many of them were stored.
+ FIFO_pop_n pops up to 'n' entries into 'data' and returns how
+ many were popped.
+ Word storage copies with at most two memcpy calls; packed
+ storage falls back to the per entry path.
+ */
+uint32_t FIFO_push_n(FIFO* fifo, const fifo_data_t* data, uint32_t n);
+uint32_t FIFO_pop_n(FIFO* fifo, fifo_data_t* data, uint32_t n);
+
+/**
+ Zero-copy read access (word storage only).
+
+ FIFO_peek_span points 'span' at the oldest entries and returns
+ how many of them are contiguous in memory. Nothing is consumed
+ until FIFO_release drops the 'n' oldest entries.
+ */
+uint32_t FIFO_peek_span(FIFO* fifo, const fifo_data_t** span);
+void FIFO_release(FIFO* fifo, uint32_t n);
+
+/**
+ Non-destructive reads.
+
+ FIFO_cursor_begin places the cursor at the oldest entry.
+ FIFO_cursor_next reads the entry under the cursor and moves on;
+ false once every stored entry was read. If the overflow policy
+ dropped entries in the meantime, the cursor skips ahead to the
+ oldest one still stored.
+ FIFO_cursor_commit consumes everything the cursor went past,
+ e.g. once the delivery of those entries is confirmed.
+ */
+void FIFO_cursor_begin(FIFO* fifo, FIFOCursor* cursor);
+bool FIFO_cursor_next(FIFO* fifo, FIFOCursor* cursor, fifo_data_t* data);
+void FIFO_cursor_commit(FIFO* fifo, FIFOCursor* cursor);
+
+/**
+ Newest entry pushed for the channel 'ch_addr', without touching
+ the queue. Returns false if nothing was pushed for it yet.
+ */
+bool FIFO_latest(FIFO* fifo, uint8_t ch_addr, fifo_data_t* data);
+
+/**
+ Overflow policy and occupancy counters.
+ */
+void FIFO_set_policy(FIFO* fifo, uint8_t policy);
+void FIFO_get_stats(FIFO* fifo, FIFOStats* stats);
+void FIFO_reset_stats(FIFO* fifo);
+
+/**
+ Timestamped entries.
+
+ FIFO_enable_timestamps turns it on (word storage only, empty
+ FIFO). With a clock, every Push stamps the entry with the time
+ since the previous one. With a NULL clock, the pushed entries
+ already carry their delta (e.g. as received over the link)
+ and FIFO_set_base_time (empty FIFO) or FIFO_anchor_newest
+ (any time, the stored entries move along) anchor them.
+ FIFO_pop_timed pops and gives back the absolute time.
+ The cursor keeps the absolute time of the last read entry.
+ */
+bool FIFO_enable_timestamps(FIFO* fifo, uint32_t (*clock)(void));
+void FIFO_set_base_time(FIFO* fifo, uint32_t time);
+void FIFO_anchor_newest(FIFO* fifo, uint32_t time);
+fifo_data_t FIFO_pop_timed(FIFO* fifo, uint32_t* time);
+
+/**
+ Attaches a spill log (or NULL to detach). Entries dropped by
+ FIFO_POLICY_DROP_OLDEST get appended to it instead of being lost.
+ The Push only fills pages in RAM: the sketch calls
+ SpillLog_service() from its loop to write them out.
+ */
+void FIFO_attach_spill(FIFO* fifo, struct __spill_log__* spill);
+
+/**
+ Memory footprint report: bytes taken by the entry storage,
+ and by the whole FIFO including the struct itself.
+ */
+uint32_t FIFO_storage_bytes(FIFO* fifo);
+uint32_t FIFO_footprint(FIFO* fifo);
+
 FIFO* FIFO_create_skel(void);
 FIFO* FIFO_create(uint32_t fifo_depth);
 
+/**
+ Packed FIFO. entry_bits is FIFO_STORAGE_PACKED17 or
+ FIFO_STORAGE_PACKED24. Only the address and ADC bits are kept.
+ */
+FIFO* FIFO_create_packed(uint32_t fifo_depth, uint8_t entry_bits);
+
 void FIFO_destroy(FIFO* fifo);
 
 #ifdef __cplusplus
@@ -48,6 +48,46 @@
 
 #define PULSES_FOR_GAP              35         /* 35 for 900 us */
 
+/**
+ * Frame sync: the long header above, or a preamble.
+ *
+ * The preamble is high, low, high, low, double high, low, in
+ * units of PULSES_FOR_PREAMBLE_UNIT. Lows that short never show
+ * up in the data (PULSES_FOR_EMPTY), and the receiver finds the
+ * pattern by its shape, whatever the clock skew.
+ * The VSOP38338 needs bursts and gaps of 10 cycles at least.
+ * 7 units of 10 --> 70 pulses (1.82 ms at 38 kHz) instead of
+ * 81 (2.11 ms) for the header: 11 pulses, 0.29 ms, shorter.
+ * That's 14% of the sync, but only about 0.5% of a 17 bit
+ * packet with its copies (2100 to 2700 pulses). Not much of an
+ * airtime saving: what it buys is the sync by shape.
+ */
+#define SYNC_HEADER                 0
+#define SYNC_PREAMBLE               1
+
+#ifndef PULSES_FOR_PREAMBLE_UNIT
+#define PULSES_FOR_PREAMBLE_UNIT    10
+#endif
+#if PULSES_FOR_PREAMBLE_UNIT < 10
+#error "PULSES_FOR_PREAMBLE_UNIT: the VSOP38338 misses bursts under 10 cycles"
+#endif
+#define PREAMBLE_RUNS               6
+#define PREAMBLE_PATTERN            { 1, 1, 1, 1, 2, 1 }
+#define PREAMBLE_UNITS              7
+#define PULSES_FOR_PREAMBLE         (PREAMBLE_UNITS*PULSES_FOR_PREAMBLE_UNIT)
+
+/**
+ * Duty-cycled listening: the receiver is only awake for a short
+ * window every listen period. Commands to it are led by a wake-up
+ * train of zeros, as long as a period and a window, so one of
+ * them lands in a window. A zero never passes for a header, nor
+ * fits the preamble shape.
+ * The window catches two of them.
+ */
+#define PULSES_FOR_WAKEUP_ONE       PULSES_FOR_ZERO
+#define PULSES_FOR_WAKEUP_EMPTY     PULSES_FOR_EMPTY
+#define PULSES_FOR_LISTEN_WINDOW    (2*(PULSES_FOR_WAKEUP_ONE+PULSES_FOR_WAKEUP_EMPTY))
+
 /**
  * Some other IR Transmission parameters
  */
@@ -0,0 +1,287 @@
+/************************************************************
+
+  IR Software Demodulator for SWIM Project
+
+  Carrier detection on raw photodiode samples.
+
+  Implementation file.
+
+ ************************************************************/
+#include "IRDemod.h"
+
+#include <string.h>
+#include <math.h>
+
+#define IRDEMOD_TWO_PI           6.283185307179586
+
+/**
+ * Carrier power of the window ending with this block.
+ *
+ * The block is one pass of dot products, no dependency between
+ * the samples. Its correlation is kept, and the window adds up
+ * the last 'hops' of them, each rotated by its phase in the
+ * window. The DC of the photodiode (ambient light) is taken out
+ * after the fact: mean * sum(cos), mean * sum(sin).
+ */
+static uint64_t block_power(IRDemod* demod, const uint16_t* x)
+{
+  int32_t i_acc = 0, q_acc = 0, sum = 0;
+  int64_t i_val = 0, q_val = 0, s_val = 0;
+  uint16_t n;
+  uint8_t  k, b;
+
+  for (n=0; n<demod->block; n++) {
+    i_acc += (int32_t)x[n] * demod->cos_tab[n];
+    q_acc += (int32_t)x[n] * demod->sin_tab[n];
+    sum   += x[n];
+  }
+
+  if (demod->hops == 1) {
+    i_val = i_acc;
+    q_val = q_acc;
+    s_val = sum;
+  }
+  else {
+    b = demod->blk_pos;
+    demod->blk_i[b] = i_acc;
+    demod->blk_q[b] = q_acc;
+    demod->blk_s[b] = sum;
+    demod->blk_pos  = (b + 1 == demod->hops) ? 0 : b + 1;
+
+    /* Oldest block first: it starts the window, no rotation */
+    b = demod->blk_pos;
+    for (k=0; k<demod->hops; k++) {
+      i_val += (int64_t)demod->blk_i[b] * demod->rot_cos[k] - (int64_t)demod->blk_q[b] * demod->rot_sin[k];
+      q_val += (int64_t)demod->blk_i[b] * demod->rot_sin[k] + (int64_t)demod->blk_q[b] * demod->rot_cos[k];
+      s_val += demod->blk_s[b];
+      b = (b + 1 == demod->hops) ? 0 : b + 1;
+    }
+    i_val >>= IRDEMOD_TABLE_SHIFT;
+    q_val >>= IRDEMOD_TABLE_SHIFT;
+  }
+
+  i_val -= (s_val * demod->cos_sum) / demod->window;
+  q_val -= (s_val * demod->sin_sum) / demod->window;
+
+  return (uint64_t)(i_val*i_val) + (uint64_t)(q_val*q_val);
+}
+
+/**
+ * Gives the run, or what's new of it, to the sink.
+ * 'end' --> the run is over, start a new one.
+ */
+static int emit_run(IRDemod* demod, bool end)
+{
+  uint32_t duration = \
+    (uint32_t)((demod->run_samples * 1000000ULL) / demod->sample_rate) - demod->run_sent;
+
+  if (end) {
+    demod->run_samples = 0;
+    demod->run_sent    = 0;
+  }
+  else {
+    demod->run_sent += duration;
+  }
+
+  if (!duration) return IRRECV_NEED_MORE;
+
+  demod->n_runs++;
+  if (!demod->sink) return IRRECV_NEED_MORE;
+
+  return demod->sink(demod->sink_ctx, demod->level, duration);
+}
+
+/**
+ * One block: its level, with hysteresis, and the runs.
+ * Lows are given out block by block, so the sink knows time
+ * goes on even when the next pulse doesn't come (the glitch
+ * filter ends the last pulse of a packet on its low).
+ */
+static void step_block(IRDemod* demod, const uint16_t* x)
+{
+  uint8_t level = demod->level;
+
+  demod->power = block_power(demod, x);
+  demod->n_blocks++;
+
+  /* The window isn't full yet */
+  if (demod->n_blocks < demod->hops) {
+    demod->run_samples += demod->block;
+    return;
+  }
+
+  if (!level && demod->power >= demod->on_power) level = 1;
+  else if (level && demod->power < demod->off_power) level = 0;
+
+  if (level != demod->level) {
+    demod->status = emit_run(demod, true);
+    demod->level  = level;
+    if (demod->status != IRRECV_NEED_MORE) {
+      demod->run_samples = demod->block;
+      return;
+    }
+  }
+  demod->run_samples += demod->block;
+
+  if (!level) demod->status = emit_run(demod, false);
+}
+
+uint32_t IRDemod_process(IRDemod* demod, const uint16_t* samples, uint32_t n_samples)
+{
+  uint32_t used = 0, n;
+
+  demod->status = IRRECV_NEED_MORE;
+
+  while (used < n_samples) {
+
+    if (demod->fill || n_samples - used < demod->block) {
+      /* Partial block, through the stage */
+      n = demod->block - demod->fill;
+      if (n > n_samples - used) n = n_samples - used;
+
+      memcpy(&(demod->stage[demod->fill]), &(samples[used]), n*sizeof(uint16_t));
+      demod->fill += n;
+      used += n;
+
+      if (demod->fill < demod->block) break;
+
+      demod->fill = 0;
+      step_block(demod, demod->stage);
+    }
+    else {
+      step_block(demod, &(samples[used]));
+      used += demod->block;
+    }
+
+    if (demod->status != IRRECV_NEED_MORE) break;
+  }
+
+  return used;
+}
+
+int IRDemod_flush(IRDemod* demod)
+{
+  demod->status = IRRECV_NEED_MORE;
+
+  if (demod->run_samples) {
+    demod->status = emit_run(demod, true);
+  }
+
+  return demod->status;
+}
+
+void IRDemod_set_thresholds(IRDemod* demod, uint32_t on_amp, uint32_t off_amp)
+{
+  /* A sine of amplitude A gives |I+jQ| = A * window/2 * 2^TABLE_SHIFT */
+  uint64_t scale = (uint64_t)demod->window << (IRDEMOD_TABLE_SHIFT - 1);
+
+  demod->on_power  = (on_amp * scale) * (on_amp * scale);
+  demod->off_power = (off_amp * scale) * (off_amp * scale);
+}
+
+void IRDemod_set_sink(IRDemod* demod, IRRunSink sink, void* ctx)
+{
+  demod->sink     = sink;
+  demod->sink_ctx = ctx;
+}
+
+int irrecv_run_sink(void* ctx, uint8_t level, uint32_t duration)
+{
+  return IRRecv_feed_run((IRRecv*)ctx, level, duration);
+}
+
+
+/****************************************************
+ *
+ * Constructors and Destructors for IRDemod
+ *
+ ****************************************************/
+IRDemod* IRDemod_create(uint32_t sample_rate, uint32_t carrier)
+{
+  /* Samples for IRDEMOD_BLOCK_PERIODS carrier periods, rounded */
+  uint32_t window = \
+    (uint32_t)(((uint64_t)IRDEMOD_BLOCK_PERIODS * sample_rate + carrier/2) / carrier);
+
+  if (window > IRDEMOD_MAX_WINDOW) window = IRDEMOD_MAX_WINDOW;
+
+  return IRDemod_create_with_window(sample_rate, carrier, (uint16_t)window, 1);
+}
+
+IRDemod* IRDemod_create_with_window(uint32_t sample_rate, uint32_t carrier, uint16_t window, uint8_t hops)
+{
+  IRDemod* demod = (IRDemod*)malloc(sizeof(IRDemod));
+  double   phase;
+  int32_t  cos_blk = 0, sin_blk = 0;
+  uint16_t block;
+
+  memset(demod, 0, sizeof(IRDemod));
+
+  demod->sample_rate = sample_rate;
+  demod->carrier     = carrier;
+
+  if (hops < 1) hops = 1;
+  if (hops > IRDEMOD_MAX_HOPS) hops = IRDEMOD_MAX_HOPS;
+  if (window > IRDEMOD_MAX_WINDOW) window = IRDEMOD_MAX_WINDOW;
+
+  block = (window + hops/2) / hops;
+  if (block < 4) block = 4;
+  while (block*hops > IRDEMOD_MAX_WINDOW) block--;
+
+  demod->block  = block;
+  demod->hops   = hops;
+  demod->window = block*hops;
+
+  demod->cos_tab = (int16_t*)malloc(sizeof(int16_t)*block);
+  demod->sin_tab = (int16_t*)malloc(sizeof(int16_t)*block);
+  demod->stage   = (uint16_t*)malloc(sizeof(uint16_t)*block);
+
+  for (uint16_t n=0; n<block; n++) {
+    phase = IRDEMOD_TWO_PI * (double)carrier * n / (double)sample_rate;
+    demod->cos_tab[n] = (int16_t)lround(cos(phase) * (1<<IRDEMOD_TABLE_SHIFT));
+    demod->sin_tab[n] = (int16_t)lround(sin(phase) * (1<<IRDEMOD_TABLE_SHIFT));
+    cos_blk += demod->cos_tab[n];
+    sin_blk += demod->sin_tab[n];
+  }
+
+  /* Window sums as block_power puts the blocks together */
+  if (hops == 1) {
+    demod->cos_sum = cos_blk;
+    demod->sin_sum = sin_blk;
+  }
+  else {
+    for (uint8_t k=0; k<hops; k++) {
+      phase = IRDEMOD_TWO_PI * (double)carrier * k * block / (double)sample_rate;
+      demod->rot_cos[k] = (int16_t)lround(cos(phase) * (1<<IRDEMOD_TABLE_SHIFT));
+      demod->rot_sin[k] = (int16_t)lround(sin(phase) * (1<<IRDEMOD_TABLE_SHIFT));
+      demod->cos_sum += \
+        (int32_t)(((int64_t)cos_blk * demod->rot_cos[k] - (int64_t)sin_blk * demod->rot_sin[k]) >> IRDEMOD_TABLE_SHIFT);
+      demod->sin_sum += \
+        (int32_t)(((int64_t)cos_blk * demod->rot_sin[k] + (int64_t)sin_blk * demod->rot_cos[k]) >> IRDEMOD_TABLE_SHIFT);
+    }
+  }
+
+  IRDemod_set_thresholds(demod, IRDEMOD_DEF_ON_AMP, IRDEMOD_DEF_OFF_AMP);
+
+  demod->status = IRRECV_NEED_MORE;
+
+  return demod;
+}
+
+IRDemod* IRDemod_create_for_irrecv(uint32_t sample_rate, IRRecv* irRecv)
+{
+  IRDemod* demod = IRDemod_create(sample_rate, irRecv->irComm->mod_freq);
+
+  IRDemod_set_sink(demod, &(irrecv_run_sink), irRecv);
+
+  return demod;
+}
+
+void IRDemod_destroy(IRDemod* demod)
+{
+  if (demod) {
+    free(demod->cos_tab);
+    free(demod->sin_tab);
+    free(demod->stage);
+    free(demod);
+  }
+}
@@ -0,0 +1,162 @@
+/************************************************************
+
+  IR Software Demodulator for SWIM Project
+
+  Alternative to the VSOP38338: a bare photodiode sampled by
+  an ADC, and the carrier detected in software. Not tied to
+  38 kHz and to the AGC settling of the VSOP, so the carrier
+  can go up and the symbols can get shorter.
+
+  The samples are cut into blocks of about IRDEMOD_BLOCK_PERIODS
+  carrier periods. Each block is correlated against the carrier,
+  I = sum(x*cos), Q = sum(x*sin) with Q12 tables (a single-bin
+  DFT, what Goertzel computes, but as plain dot products that
+  the compiler can vectorize). I^2+Q^2 against an on and an off
+  threshold (hysteresis) gives the level of the block.
+
+  A longer window tells carriers that are close together apart
+  (FDM, see IRFDM.h), but coarsens the runs. So the window can
+  be slid by blocks of 1/hops of it: each block is correlated
+  once, and the window is the last 'hops' blocks, phase-rotated
+  to line up.
+
+  The levels are given out as runs, (level, duration in us),
+  to a sink: e.g. IRRecv_feed_run of a decoder. Noise can still
+  turn a lone block on, so the decoder should have its glitch
+  filter on (IRRecv_enable_filter).
+
+  Header file.
+
+ ************************************************************/
+#ifndef __IRDEMOD_H__
+#define __IRDEMOD_H__
+
+/**
+ *
+ * Some basic includes
+ *
+ */
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "IRRecv.h"
+
+/* Block length, in carrier periods: the time resolution of the runs */
+#ifndef IRDEMOD_BLOCK_PERIODS
+#define IRDEMOD_BLOCK_PERIODS    2
+#endif
+
+#define IRDEMOD_MAX_WINDOW       128     /* Samples, keeps the power in 64 bits */
+#define IRDEMOD_MAX_HOPS         8
+#define IRDEMOD_TABLE_SHIFT      12      /* Q12 carrier tables */
+#define IRDEMOD_ADC_BITS         12
+
+/* Default thresholds, carrier amplitude in ADC counts */
+#define IRDEMOD_DEF_ON_AMP       48
+#define IRDEMOD_DEF_OFF_AMP      24
+
+/**
+ * Where the runs go.
+ * --> What the sink returns is kept in demod->status, and a
+ *     status other than IRRECV_NEED_MORE stops the processing.
+ */
+typedef int (*IRRunSink)(void* ctx, uint8_t level, uint32_t duration);
+
+/**
+ *
+ * The main struct for IRDemod
+ *
+ */
+typedef struct __ir_demod__ {
+
+  uint32_t sample_rate;    // Hz
+  uint32_t carrier;        // Hz
+  uint16_t block;          // Samples per block, one level each
+  uint8_t  hops;           // Blocks per window
+  uint16_t window;         // Samples correlated, hops*block
+
+  int16_t* cos_tab;        // One block
+  int16_t* sin_tab;
+  int16_t  rot_cos[IRDEMOD_MAX_HOPS];  // Phase of each block in the window
+  int16_t  rot_sin[IRDEMOD_MAX_HOPS];
+  int32_t  cos_sum;        // Over the window, for taking out the DC
+  int32_t  sin_sum;
+
+  /* Correlations of the last 'hops' blocks */
+  int32_t  blk_i[IRDEMOD_MAX_HOPS];
+  int32_t  blk_q[IRDEMOD_MAX_HOPS];
+  int32_t  blk_s[IRDEMOD_MAX_HOPS];
+  uint8_t  blk_pos;        // Oldest one
+
+  uint64_t on_power;       // I^2+Q^2 to turn on
+  uint64_t off_power;      // ... and to turn off again
+  uint64_t power;          // Of the last block
+
+  /* Partial block between calls */
+  uint16_t* stage;
+  uint16_t  fill;
+
+  /* Run being measured */
+  uint8_t  level;
+  uint64_t run_samples;
+  uint32_t run_sent;       // us of it already given out (lows)
+
+  IRRunSink sink;
+  void*     sink_ctx;
+  int       status;
+
+  uint32_t n_blocks;
+  uint32_t n_runs;         // Given out, lows in pieces
+
+} IRDemod;
+
+/**
+ *
+ * Method definitions for IRDemod
+ *
+ */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Demodulates the samples (right aligned, IRDEMOD_ADC_BITS).
+ * --> Number of samples used. Less than n_samples if the sink
+ *     returned something else than IRRECV_NEED_MORE (e.g. the
+ *     packet is ready): call again with the rest.
+ */
+uint32_t IRDemod_process(IRDemod* demod, const uint16_t* samples, uint32_t n_samples);
+
+/* Ends the current run, e.g. when the samples stop */
+int IRDemod_flush(IRDemod* demod);
+
+/* Thresholds as carrier amplitudes in ADC counts, on > off */
+void IRDemod_set_thresholds(IRDemod* demod, uint32_t on_amp, uint32_t off_amp);
+
+void IRDemod_set_sink(IRDemod* demod, IRRunSink sink, void* ctx);
+
+/* Sink for an IRRecv decoder: ctx is the IRRecv* */
+int irrecv_run_sink(void* ctx, uint8_t level, uint32_t duration);
+
+/**
+ *
+ * Constructors and Destructors for IRDemod
+ *
+ */
+/**
+ * IRDemod_create             --> IRDEMOD_BLOCK_PERIODS blocks, no sliding
+ * IRDemod_create_with_window --> 'window' samples, slid by window/hops
+ * IRDemod_create_for_irrecv  --> default one, feeding the decoder
+ */
+IRDemod* IRDemod_create(uint32_t sample_rate, uint32_t carrier);
+IRDemod* IRDemod_create_with_window(uint32_t sample_rate, uint32_t carrier, uint16_t window, uint8_t hops);
+IRDemod* IRDemod_create_for_irrecv(uint32_t sample_rate, IRRecv* irRecv);
+
+void IRDemod_destroy(IRDemod* demod);
+
+#ifdef __cplusplus
+} /* Matching } for the extern C */
+#endif
+
+
+#endif /* Include Guard */
@@ -0,0 +1,269 @@
+/************************************************************
+
+  IR Diversity Receiver for SWIM Project
+
+  Combines the packets decoded by several IRRecv branches
+  from the same transmission.
+
+  Implementation file.
+
+ ************************************************************/
+#include "IRDiversity.h"
+
+#include <string.h>
+
+/* Detect Arduino */
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+//#include "WProgram.h"
+#endif
+
+/**
+ * A branch is done with the packet: got it, or lost it
+ */
+static void note_branch_irdiversity(IRDiversity* div, uint8_t b, int status)
+{
+  if (status == IRRECV_NEED_MORE) return;
+
+  div->status[b] = status;
+
+  if (status == IRRECV_PKT_READY) {
+    if (!div->n_ready) div->first_ready = micros();
+    div->n_ready++;
+  }
+}
+
+/**
+ * Is it time to combine?
+ * All branches done, or the first one is ready and the window
+ * for the rest ran out. By default, the window is one copy.
+ */
+static int settle_irdiversity(IRDiversity* div)
+{
+  uint8_t  b, n_done = 0;
+  uint32_t window = div->window_us;
+
+  for (b=0; b<div->n_branches; b++) {
+    if (div->status[b] != IRRECV_NEED_MORE) n_done++;
+  }
+
+  if (!div->n_ready) {
+    if (n_done < div->n_branches) return IRRECV_NEED_MORE;
+
+    /* Everybody lost it */
+    IRDiversity_begin_packet(div, div->bits);
+    return ERROR_RECV;
+  }
+
+  if (n_done >= div->n_branches) return IRDiversity_combine(div);
+
+  if (!window) {
+    window = IRRecv_packet_airtime(div->branch[0], div->bits) / div->branch[0]->repeat;
+  }
+  if (micros() - div->first_ready >= window) return IRDiversity_combine(div);
+
+  return IRRECV_NEED_MORE;
+}
+
+/**
+ * The ready branch with the best link quality: fewest
+ * disagreeing bits between its copies, then the smallest
+ * pulse deviation. There has to be one ready.
+ */
+static uint8_t best_branch_irdiversity(IRDiversity* div)
+{
+  const LinkQuality* lq;
+  const LinkQuality* best_lq = NULL;
+  uint8_t b, best = 0;
+
+  for (b=0; b<div->n_branches; b++) {
+    if (div->status[b] != IRRECV_PKT_READY) continue;
+    lq = IRRecv_link_quality(div->branch[b]);
+
+    if (!best_lq ||
+        lq->disagree_bits < best_lq->disagree_bits ||
+        (lq->disagree_bits == best_lq->disagree_bits && lq->dev_mean < best_lq->dev_mean)) {
+      best_lq = lq;
+      best = b;
+    }
+  }
+
+  return best;
+}
+
+int IRDiversity_combine(IRDiversity* div)
+{
+  IRRecv*  recv;
+  uint8_t  b, pos, best;
+  int32_t  sum;
+  uint64_t first = 0;
+  bool     have_first = false;
+
+  if (!div->n_ready) return IRRECV_NEED_MORE;
+
+  /* Did the branches agree in the first place? */
+  for (b=0; b<div->n_branches; b++) {
+    if (div->status[b] != IRRECV_PKT_READY) continue;
+    if (!have_first) {
+      first = div->branch[b]->packet;
+      have_first = true;
+    }
+    else if (div->branch[b]->packet != first) {
+      div->n_conflicts++;
+      break;
+    }
+  }
+
+  /* The best link of the lot: SELECT takes it, VOTE breaks ties with it */
+  best = best_branch_irdiversity(div);
+
+  if (div->mode == IRDIV_COMBINE_SELECT) {
+
+    div->chosen = (int8_t)best;
+    recv = div->branch[best];
+    div->packet = recv->packet;
+    memcpy(div->bit_conf, recv->bit_conf, sizeof(div->bit_conf));
+  }
+  else {
+
+    /* Each branch votes its bits, weighted by its own confidence */
+    div->chosen = -1;
+    div->packet = 0;
+    for (pos=0; pos<div->bits; pos++) {
+      sum = 0;
+      for (b=0; b<div->n_branches; b++) {
+        if (div->status[b] != IRRECV_PKT_READY) continue;
+        recv = div->branch[b];
+        sum += ((recv->packet>>pos) & 0x1) ?
+          (int32_t)recv->bit_conf[pos] : -(int32_t)recv->bit_conf[pos];
+      }
+
+      /* A dead heat goes the way of the best link */
+      if (sum > 0 || (!sum && ((div->branch[best]->packet>>pos) & 0x1))) {
+        div->packet |= ((uint64_t)1<<pos);
+      }
+      if (sum < 0) sum = -sum;
+
+      div->bit_conf[pos] = (sum > IRRECV_CONF_MAX) ? IRRECV_CONF_MAX : (uint8_t)sum;
+    }
+  }
+
+  div->n_packets++;
+  if (div->n_ready > 1) div->n_combined++;
+
+  /* Branches still in the middle of it would deliver it again */
+  IRDiversity_begin_packet(div, div->bits);
+
+  return IRRECV_PKT_READY;
+}
+
+int IRDiversity_add_branch(IRDiversity* div, IRRecv* irRecv)
+{
+  if (div->n_branches >= IRDIV_MAX_BRANCHES) return -1;
+
+  div->branch[div->n_branches] = irRecv;
+  div->status[div->n_branches] = IRRECV_NEED_MORE;
+
+  return div->n_branches++;
+}
+
+void IRDiversity_begin_packet(IRDiversity* div, uint8_t bits)
+{
+  div->bits    = bits;
+  div->n_ready = 0;
+
+  for (uint8_t b=0; b<div->n_branches; b++) {
+    div->status[b] = IRRECV_NEED_MORE;
+    IRRecv_begin_packet(div->branch[b], bits);
+  }
+}
+
+int IRDiversity_feed(IRDiversity* div, uint8_t branch, uint32_t low, uint32_t high)
+{
+  if (branch >= div->n_branches) return ERROR_RECV;
+
+  if (div->status[branch] == IRRECV_NEED_MORE) {
+    note_branch_irdiversity(div, branch, IRRecv_feed(div->branch[branch], low, high));
+  }
+
+  return settle_irdiversity(div);
+}
+
+int IRDiversity_poll(IRDiversity* div)
+{
+  for (uint8_t b=0; b<div->n_branches; b++) {
+    if (div->status[b] == IRRECV_NEED_MORE) {
+      note_branch_irdiversity(div, b, IRRecv_poll(div->branch[b]));
+    }
+  }
+
+  return settle_irdiversity(div);
+}
+
+int IRDiversity_weakest_bit(IRDiversity* div, uint8_t* conf)
+{
+  int weakest = -1;
+  uint8_t pos;
+
+  if (!div->n_packets) return -1;
+
+  for (pos=0; pos<div->bits; pos++) {
+    if (weakest < 0 || div->bit_conf[pos] < div->bit_conf[weakest]) {
+      weakest = pos;
+    }
+  }
+
+  if (conf && weakest >= 0) (*conf) = div->bit_conf[weakest];
+
+  return weakest;
+}
+
+
+/****************************************************
+ *
+ * Constructors and Destructors for IRDiversity
+ *
+ ****************************************************/
+IRDiversity* IRDiversity_create_skel(void)
+{
+  IRDiversity* div = (IRDiversity*)malloc(sizeof(IRDiversity));
+
+  memset(div, 0, sizeof(IRDiversity));
+
+  div->owned     = false;
+  div->mode      = IRDIV_COMBINE_VOTE;
+  div->window_us = 0;
+  div->chosen    = -1;
+
+  return div;
+}
+
+IRDiversity* IRDiversity_create(const uint8_t* ir_pins, uint8_t n_pins, uint32_t mod_freq)
+{
+  IRDiversity* div = IRDiversity_create_skel();
+  IRRecv* irRecv;
+
+  div->owned = true;
+
+  for (uint8_t i=0; i<n_pins && i<IRDIV_MAX_BRANCHES; i++) {
+    irRecv = IRRecv_create_with_freq(ir_pins[i], mod_freq);
+    irRecv->Init(irRecv);
+    IRRecv_enable_capture(irRecv, 0);
+    IRDiversity_add_branch(div, irRecv);
+  }
+
+  return div;
+}
+
+void IRDiversity_destroy(IRDiversity* div)
+{
+  if (div) {
+    if (div->owned) {
+      for (uint8_t b=0; b<div->n_branches; b++) {
+        IRRecv_destroy(div->branch[b]);
+      }
+    }
+    free(div);
+  }
+}
@@ -0,0 +1,132 @@
+/************************************************************
+
+  IR Diversity Receiver for SWIM Project
+
+  The surface station can have more than one VSOP38338 looking
+  at the water, at different angles. Each one gets its own
+  IRRecv decoder (a branch), and the packets they decode from
+  the same transmission are combined before the parity check:
+
+    IRDIV_COMBINE_VOTE   --> soft vote over the branches, each
+                             bit weighted by its confidence in
+                             that branch (bit_conf), a tie
+                             going the way of the best link
+    IRDIV_COMBINE_SELECT --> the branch with the best link
+                             quality: fewest disagreeing bits
+                             between its copies, then the
+                             smallest pulse deviation
+
+  A branch that lost the packet just doesn't take part.
+  No extra airtime: the branches listen to the same copies.
+
+  Header file.
+
+ ************************************************************/
+#ifndef __IRDIVERSITY_H__
+#define __IRDIVERSITY_H__
+
+/**
+ *
+ * Some basic includes
+ *
+ */
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "IRRecv.h"
+
+#define IRDIV_MAX_BRANCHES     IRRECV_MAX_CAPTURE
+
+#define IRDIV_COMBINE_VOTE     0
+#define IRDIV_COMBINE_SELECT   1
+
+/**
+ *
+ * The main struct for IRDiversity
+ *
+ */
+typedef struct __ir_diversity__ {
+
+  IRRecv*  branch[IRDIV_MAX_BRANCHES];
+  uint8_t  n_branches;
+  bool     owned;          // Branches created (and destroyed) here
+
+  uint8_t  mode;           // IRDIV_COMBINE_*
+  uint8_t  bits;
+
+  /**
+   * Once a branch has the packet, how long the others get to
+   * finish theirs (us). 0 for the airtime of one copy.
+   */
+  uint32_t window_us;
+
+  /* Per packet */
+  int      status[IRDIV_MAX_BRANCHES];  // IRRECV_NEED_MORE, _PKT_READY or error
+  uint32_t first_ready;                 // When the first branch got it (us)
+  uint8_t  n_ready;
+
+  /* The combined packet */
+  uint64_t packet;
+  uint8_t  bit_conf[IRRECV_MAX_BITS];
+  int8_t   chosen;         // Branch picked by SELECT, -1 for VOTE
+
+  uint32_t n_packets;      // Packets delivered
+  uint32_t n_combined;     // ... from more than one branch
+  uint32_t n_conflicts;    // ... where the branches didn't agree
+
+} IRDiversity;
+
+/**
+ *
+ * Method definitions for IRDiversity
+ *
+ */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Adds a decoder as a branch.
+ * --> Returns the branch index, or -1 if there's no room.
+ */
+int IRDiversity_add_branch(IRDiversity* div, IRRecv* irRecv);
+
+/* Arms every branch for a packet of 'bits' (parity included) */
+void IRDiversity_begin_packet(IRDiversity* div, uint8_t bits);
+
+/**
+ * Host (or any other) pulse source: one pulse to one branch.
+ * IRDiversity_poll: from the captured edges of all branches.
+ *
+ * --> IRRECV_NEED_MORE, IRRECV_PKT_READY with the combined
+ *     packet in div->packet, or ERROR_RECV if every branch
+ *     lost it.
+ */
+int IRDiversity_feed(IRDiversity* div, uint8_t branch, uint32_t low, uint32_t high);
+int IRDiversity_poll(IRDiversity* div);
+
+/* Combine whatever the branches have now, without waiting */
+int IRDiversity_combine(IRDiversity* div);
+
+/* Least confident bit of the combined packet, as IRRecv_weakest_bit */
+int IRDiversity_weakest_bit(IRDiversity* div, uint8_t* conf);
+
+/**
+ *
+ * Constructors and Destructors for IRDiversity
+ *
+ * IRDiversity_create_skel --> no branches, add them yourself
+ * IRDiversity_create      --> a capturing IRRecv for each pin
+ *
+ */
+IRDiversity* IRDiversity_create_skel(void);
+IRDiversity* IRDiversity_create(const uint8_t* ir_pins, uint8_t n_pins, uint32_t mod_freq);
+
+void IRDiversity_destroy(IRDiversity* div);
+
+#ifdef __cplusplus
+} /* Matching } for the extern C */
+#endif
+
+
+#endif /* Include Guard */
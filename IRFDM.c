@@ -0,0 +1,412 @@
+/************************************************************
+
+  IR Frequency-Division Multiplexing for SWIM Project
+
+  Several carriers on one optical path: a transmitter group
+  and a receiver filter bank.
+
+  Implementation file.
+
+ ************************************************************/
+#include "IRFDM.h"
+
+#include <string.h>
+#include <math.h>
+
+/* Detect Arduino */
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+//#include "WProgram.h"
+#endif
+
+/****************************************************
+ *
+ * Transmitter
+ *
+ ****************************************************/
+/**
+ * Moves on to the next segment of the schedule
+ * --> false when the packet is over
+ */
+static bool load_segment_irfdm(IRTrans* irTrans, IRFDMChannel* ch)
+{
+  uint16_t seg;
+
+  if (ch->seg >= ch->sched->n_segs) return false;
+
+  seg = ch->sched->seg[ch->seg++];
+  ch->seg_level = IRSCHED_LEVEL(seg);
+  ch->seg_us    = IRSCHED_CYCLES(seg) * irTrans->irComm->period;
+
+  return true;
+}
+
+int IRFDMTrans_add_channel(IRFDMTrans* fdm, IRTrans* irTrans)
+{
+  IRFDMChannel* ch;
+
+  if (fdm->n_channels >= IRFDM_MAX_CHANNELS) return -1;
+
+  ch = &(fdm->state[fdm->n_channels]);
+  memset(ch, 0, sizeof(IRFDMChannel));
+  ch->sched = IRSchedule_create(0);
+
+  fdm->chan[fdm->n_channels] = irTrans;
+
+  return fdm->n_channels++;
+}
+
+void IRFDMTrans_send(IRFDMTrans* fdm, uint8_t packet_bits, const uint64_t* packets)
+{
+  IRTrans*      irTrans;
+  IRFDMChannel* ch;
+  uint32_t      now, elapsed;
+  uint8_t       c, level, n_busy = 0;
+
+  for (c=0; c<fdm->n_channels; c++) {
+    irTrans = fdm->chan[c];
+    ch = &(fdm->state[c]);
+
+    ch->busy = false;
+    if (!IRTrans_schedule_matches(irTrans, ch->sched, packet_bits, packets[c])) {
+      if (IRTrans_compile(irTrans, ch->sched, packet_bits, packets[c]) != 0) continue;
+    }
+    else {
+      ch->sched->n_reused++;
+    }
+  }
+
+  now = micros();
+
+  for (c=0; c<fdm->n_channels; c++) {
+    ch = &(fdm->state[c]);
+    if (!ch->sched->valid) continue;
+
+    ch->seg   = 0;
+    ch->start = now;
+    ch->cycle = now;
+    ch->level = 0;
+    ch->busy  = load_segment_irfdm(fdm->chan[c], ch);
+
+    if (ch->busy) n_busy++;
+  }
+
+  while (n_busy) {
+    now = micros();
+
+    for (c=0; c<fdm->n_channels; c++) {
+      ch = &(fdm->state[c]);
+      if (!ch->busy) continue;
+
+      irTrans = fdm->chan[c];
+      elapsed = now - ch->start;
+
+      if (elapsed >= ch->seg_us) {
+        /* Next segment, timed from where this one should have ended */
+        ch->start += ch->seg_us;
+        ch->cycle  = ch->start;
+
+        if (!load_segment_irfdm(irTrans, ch)) {
+          ch->busy = false;
+          n_busy--;
+          if (ch->level) irTrans->WriteIRPin(irTrans, 0);
+          ch->level = 0;
+          continue;
+        }
+      }
+
+      level = 0;
+      if (ch->seg_level) {
+        while (now - ch->cycle >= irTrans->irComm->period) {
+          ch->cycle += irTrans->irComm->period;
+        }
+        level = (now - ch->cycle <= irTrans->high_period);
+      }
+
+      if (level != ch->level) {
+        irTrans->WriteIRPin(irTrans, level);
+        ch->level = level;
+      }
+    }
+  }
+}
+
+/****************************************************
+ *
+ * Receiver
+ *
+ ****************************************************/
+int IRFDMRecv_add_channel(IRFDMRecv* fdm, IRDemod* demod, IRRecv* irRecv)
+{
+  if (fdm->n_channels >= IRFDM_MAX_CHANNELS) return -1;
+
+  IRDemod_set_sink(demod, &(irrecv_run_sink), irRecv);
+
+  fdm->demod[fdm->n_channels] = demod;
+  fdm->recv[fdm->n_channels]  = irRecv;
+
+  return fdm->n_channels++;
+}
+
+void IRFDMRecv_begin_packet(IRFDMRecv* fdm, uint8_t bits)
+{
+  fdm->ready = 0;
+
+  for (uint8_t c=0; c<fdm->n_channels; c++) {
+    IRRecv_begin_packet(fdm->recv[c], bits);
+  }
+}
+
+uint8_t IRFDMRecv_process(IRFDMRecv* fdm, const uint16_t* samples, uint32_t n_samples)
+{
+  uint32_t used;
+  uint8_t  c;
+  int      status;
+
+  /* Channel by channel: the buffer stays in cache */
+  for (c=0; c<fdm->n_channels; c++) {
+    used = 0;
+
+    while (used < n_samples) {
+      used += IRDemod_process(fdm->demod[c], &(samples[used]), n_samples - used);
+      status = fdm->demod[c]->status;
+
+      if (status == IRRECV_PKT_READY) {
+        if (fdm->ready & (1<<c)) fdm->n_overrun[c]++;
+        fdm->packet[c] = fdm->recv[c]->packet;
+        fdm->ready |= (1<<c);
+        fdm->n_packets[c]++;
+      }
+      else if (status != IRRECV_NEED_MORE) {
+        /* The decoder re-armed itself */
+        fdm->n_lost[c]++;
+      }
+    }
+  }
+
+  return fdm->ready;
+}
+
+bool IRFDMRecv_take(IRFDMRecv* fdm, uint8_t channel, uint64_t* packet)
+{
+  if (channel >= fdm->n_channels || !(fdm->ready & (1<<channel))) return false;
+
+  (*packet) = fdm->packet[channel];
+  fdm->ready &= ~(1<<channel);
+
+  return true;
+}
+
+
+/**
+ * How much of a carrier 'offset' Hz away gets through a window
+ * of 'window' samples (rectangular: a Dirichlet kernel), 0..1
+ */
+static double leak_irfdm(uint32_t sample_rate, uint32_t window, uint32_t offset)
+{
+  double x = 3.141592653589793 * (double)offset / (double)sample_rate;
+
+  return fabs(sin(x * window) / (window * sin(x)));
+}
+
+/**
+ * The carrier an IRTrans really puts out for 'carrier': one
+ * over the period rounded to the us, as calc_period does.
+ */
+static uint32_t on_air_irfdm(uint32_t carrier)
+{
+  uint32_t period = (1000000UL + carrier/2) / carrier;
+
+  if (period < 1) period = 1;
+  return (1000000UL + period/2) / period;
+}
+
+/**
+ * Harmonic 'h' of the square wave an IRTrans drives at 'carrier',
+ * against its fundamental. High for high_period + 1 us of the
+ * period, high_period being 4/5 of it (calc_period_irtrans), the
+ * period rounded as calc_period does: at that duty, the 2nd
+ * harmonic is about 0.8 of the fundamental.
+ */
+static double harmonic_irfdm(uint32_t carrier, uint8_t h)
+{
+  uint32_t period = (1000000UL + carrier/2) / carrier;
+  double   duty = (double)(period*4/5 + 1) / (double)period;
+  double   pi = 3.141592653589793;
+
+  if (duty >= 1.0) return 0;
+  return fabs(sin(h*pi*duty)) / (h*sin(pi*duty));
+}
+
+/**
+ * Distance from carrier 'f' to harmonic 'h' of carrier 'g', as
+ * sampled: past half the sample rate, the harmonic folds back.
+ * 0 if it lands on 'f'.
+ */
+static uint32_t offset_irfdm(uint32_t sample_rate, uint32_t f, uint32_t g, uint8_t h)
+{
+  g = (uint32_t)(((uint64_t)g * h) % sample_rate);
+  if (g > sample_rate/2) g = sample_rate - g;
+
+  return (f > g) ? f - g : g - f;
+}
+
+/**
+ * Window for one carrier of the bank: at least one over the
+ * spacing to its closest neighbour, and up to 1.5 times that,
+ * the length that lets the least of the other carriers through.
+ * Not longer: the neighbours switching on and off leak in
+ * wherever the nulls are, and the runs blur with the window
+ * (the longer ones lose about as many packets as they save).
+ * The LEDs are driven with square waves, so the neighbours
+ * are their harmonics too, up to IRFDM_HARMONICS, each
+ * weighted as its share of the square wave, and what leaks
+ * through of all of them adds up. The carriers are the ones
+ * on air, the windows the ones IRDemod ends up with (whole
+ * blocks of IRFDM_HOPS).
+ */
+static uint16_t window_irfdm(uint32_t sample_rate, const uint32_t* carriers, uint8_t n_channels, uint8_t c)
+{
+  uint32_t spacing = 0, diff, window, blocks, shortest, longest, best = 0;
+  double   leak, best_leak = 0;
+  uint8_t  d, h;
+
+  for (d=0; d<n_channels; d++) {
+    if (carriers[d] == carriers[c]) continue;
+    for (h=1; h<=IRFDM_HARMONICS; h++) {
+      diff = offset_irfdm(sample_rate, carriers[c], carriers[d], h);
+      if (diff && (!spacing || diff < spacing)) spacing = diff;
+    }
+  }
+  if (!spacing) return 0;
+
+  shortest = (sample_rate + spacing - 1) / spacing;
+  if (shortest > IRDEMOD_MAX_WINDOW) shortest = IRDEMOD_MAX_WINDOW;
+  longest = shortest*3/2;
+  if (longest > IRDEMOD_MAX_WINDOW) longest = IRDEMOD_MAX_WINDOW;
+
+  for (window=shortest; window<=longest; window++) {
+    blocks = ((window + IRFDM_HOPS/2) / IRFDM_HOPS) * IRFDM_HOPS;
+    if (blocks > IRDEMOD_MAX_WINDOW) blocks -= IRFDM_HOPS;
+
+    leak = 0;
+    for (d=0; d<n_channels; d++) {
+      if (carriers[d] == carriers[c]) continue;
+      for (h=1; h<=IRFDM_HARMONICS; h++) {
+        diff = offset_irfdm(sample_rate, carriers[c], carriers[d], h);
+        leak += harmonic_irfdm(carriers[d], h) * (diff ? leak_irfdm(sample_rate, blocks, diff) : 1.0);
+      }
+    }
+    if (!best || leak < best_leak) {
+      best_leak = leak;
+      best = window;
+    }
+  }
+
+  return (uint16_t)best;
+}
+
+/****************************************************
+ *
+ * Constructors and Destructors for IRFDM
+ *
+ ****************************************************/
+IRFDMTrans* IRFDMTrans_create_skel(void)
+{
+  IRFDMTrans* fdm = (IRFDMTrans*)malloc(sizeof(IRFDMTrans));
+
+  memset(fdm, 0, sizeof(IRFDMTrans));
+  fdm->owned = false;
+
+  return fdm;
+}
+
+IRFDMTrans* IRFDMTrans_create(const uint8_t* ir_pins, const uint32_t* carriers, uint8_t n_channels)
+{
+  IRFDMTrans* fdm = IRFDMTrans_create_skel();
+  IRTrans* irTrans;
+
+  fdm->owned = true;
+
+  for (uint8_t c=0; c<n_channels && c<IRFDM_MAX_CHANNELS; c++) {
+    irTrans = IRTrans_create_with_freq(ir_pins[c], carriers[c]);
+    irTrans->Init(irTrans);
+    IRFDMTrans_add_channel(fdm, irTrans);
+  }
+
+  return fdm;
+}
+
+void IRFDMTrans_destroy(IRFDMTrans* fdm)
+{
+  if (fdm) {
+    for (uint8_t c=0; c<fdm->n_channels; c++) {
+      IRSchedule_destroy(fdm->state[c].sched);
+      if (fdm->owned) IRTrans_destroy(fdm->chan[c]);
+    }
+    free(fdm);
+  }
+}
+
+IRFDMRecv* IRFDMRecv_create_skel(void)
+{
+  IRFDMRecv* fdm = (IRFDMRecv*)malloc(sizeof(IRFDMRecv));
+
+  memset(fdm, 0, sizeof(IRFDMRecv));
+  fdm->owned = false;
+
+  return fdm;
+}
+
+IRFDMRecv* IRFDMRecv_create(uint32_t sample_rate, const uint32_t* carriers, uint8_t n_channels)
+{
+  IRFDMRecv* fdm = IRFDMRecv_create_skel();
+  IRRecv*    irRecv;
+  IRDemod*   demod;
+  uint32_t   on_air[IRFDM_MAX_CHANNELS];
+  uint16_t   window;
+  uint8_t    c;
+
+  fdm->owned = true;
+
+  if (n_channels > IRFDM_MAX_CHANNELS) n_channels = IRFDM_MAX_CHANNELS;
+
+  /* Tuned to what the transmitters really put out */
+  for (c=0; c<n_channels; c++) on_air[c] = on_air_irfdm(carriers[c]);
+
+  for (c=0; c<n_channels; c++) {
+    irRecv = IRRecv_create_with_freq(DEF_IR_PIN, carriers[c]);
+    IRRecv_enable_filter(irRecv, 0, 0);
+
+    /* The demodulated edges are only good to a hop: the copies are weighed by it */
+    irRecv->soft_decision = true;
+
+    window = window_irfdm(sample_rate, on_air, n_channels, c);
+
+    if (window) {
+      demod = IRDemod_create_with_window(sample_rate, on_air[c], window, IRFDM_HOPS);
+      IRDemod_set_thresholds(demod, IRFDM_DEF_ON_AMP, IRFDM_DEF_OFF_AMP);
+    }
+    else {
+      demod = IRDemod_create(sample_rate, on_air[c]);
+    }
+
+    IRFDMRecv_add_channel(fdm, demod, irRecv);
+  }
+
+  return fdm;
+}
+
+void IRFDMRecv_destroy(IRFDMRecv* fdm)
+{
+  if (fdm) {
+    if (fdm->owned) {
+      for (uint8_t c=0; c<fdm->n_channels; c++) {
+        IRDemod_destroy(fdm->demod[c]);
+        IRRecv_destroy(fdm->recv[c]);
+      }
+    }
+    free(fdm);
+  }
+}
@@ -0,0 +1,200 @@
+/************************************************************
+
+  IR Frequency-Division Multiplexing for SWIM Project
+
+  One optical path, several links: each channel has its own
+  carrier (e.g. 30, 38 and 56 kHz) and its own LED, and they
+  all send at the same time.
+
+    IRFDMTrans --> drives the IRTrans of every channel together,
+                   from one loop: each pin follows its own carrier
+                   and its own packet.
+    IRFDMRecv  --> one sampled photodiode, a bank of IRDemod
+                   (one per carrier) feeding an IRRecv each.
+
+  Each demodulator of the bank correlates over a window of one
+  to 1.5 over the spacing to its closest neighbour, the length
+  that puts the other carriers closest to the nulls of its
+  filter. The window is slid by 1/IRFDM_HOPS of it, so the
+  runs stay fine enough for the decoder: an LED switching on
+  or off leaks into the other channels wherever the nulls are,
+  and how far that moves the edges of the runs grows with the
+  window and with the block.
+
+  The transmitter times the carriers in whole us, from the
+  rounded IRComm period, so what goes on air is 1/period:
+    30 kHz --> 33 us, 30.3 kHz     38 kHz --> 26 us, 38.5 kHz
+    56 kHz --> 18 us, 55.6 kHz
+  about 1% off the nominal carrier, and the bank is tuned to
+  these. The pin is high while (now - cycle start) <= high_period,
+  i.e. for high_period + 1 us of each period: 27/33, 21/26 and
+  15/18 above, not quite the 4/5 IRTrans asks for. Pick the
+  carriers so that they are still apart after the rounding.
+
+  The LEDs are square waves, and at that duty the harmonics are
+  strong: the 2nd of 30.3 kHz is 60.6 kHz, 5 kHz from 55.6 kHz.
+  The windows are picked against the harmonics of the other
+  carriers too (IRFDM_HARMONICS), folded back past half the
+  sample rate as the ADC sees them. What leaks through grows with
+  the LED swing, so the thresholds should follow it: the
+  defaults suit a swing of about 400 ADC counts, set them on
+  each demod[] for more (on swing/4, off swing/10).
+
+  Header file.
+
+ ************************************************************/
+#ifndef __IRFDM_H__
+#define __IRFDM_H__
+
+/**
+ *
+ * Some basic includes
+ *
+ */
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "IRTransmit.h"
+#include "IRRecv.h"
+#include "IRDemod.h"
+
+#define IRFDM_MAX_CHANNELS     4
+
+/* Blocks per demodulator window */
+#ifndef IRFDM_HOPS
+#define IRFDM_HOPS             8
+#endif
+
+/* Harmonics of the other carriers the bank keeps out of each window */
+#ifndef IRFDM_HARMONICS
+#define IRFDM_HARMONICS        3
+#endif
+
+/**
+ * Thresholds of the bank, carrier amplitude in ADC counts.
+ * Higher than IRDemod's own: the other carriers don't sit
+ * exactly on a null, and leak through a bit.
+ */
+#define IRFDM_DEF_ON_AMP       96
+#define IRFDM_DEF_OFF_AMP      48
+
+/**
+ * Where one transmit channel is in its packet, compiled into
+ * its own schedule as send_packet would send it.
+ */
+typedef struct __ir_fdm_channel__ {
+  IRSchedule* sched;
+  uint16_t seg;          // Next segment
+
+  uint8_t  seg_level;    // Current segment
+  uint32_t seg_us;
+  uint32_t start;        // When it started
+  uint32_t cycle;        // When the current carrier cycle started
+  uint8_t  level;        // Pin level written last
+  bool     busy;
+} IRFDMChannel;
+
+/**
+ *
+ * The transmitter side
+ *
+ */
+typedef struct __ir_fdm_trans__ {
+
+  IRTrans*     chan[IRFDM_MAX_CHANNELS];
+  IRFDMChannel state[IRFDM_MAX_CHANNELS];
+  uint8_t      n_channels;
+  bool         owned;    // Channels created (and destroyed) here
+
+} IRFDMTrans;
+
+/**
+ *
+ * The receiver side
+ *
+ */
+typedef struct __ir_fdm_recv__ {
+
+  IRDemod* demod[IRFDM_MAX_CHANNELS];
+  IRRecv*  recv[IRFDM_MAX_CHANNELS];
+  uint8_t  n_channels;
+  bool     owned;
+
+  /* Delivered packets, until taken */
+  uint64_t packet[IRFDM_MAX_CHANNELS];
+  uint8_t  ready;        // Bit c: channel c has one
+
+  uint32_t n_packets[IRFDM_MAX_CHANNELS];
+  uint32_t n_lost[IRFDM_MAX_CHANNELS];
+  uint32_t n_overrun[IRFDM_MAX_CHANNELS];  // Replaced before being taken
+
+} IRFDMRecv;
+
+/**
+ *
+ * Method definitions for IRFDM
+ *
+ */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Adds a channel.
+ * --> Returns the channel index, or -1 if there's no room.
+ */
+int IRFDMTrans_add_channel(IRFDMTrans* fdm, IRTrans* irTrans);
+
+/**
+ * Sends packets[c] on channel c, all channels at once, each
+ * one framed as send_packet does. Blocks until the longest
+ * one is out.
+ */
+void IRFDMTrans_send(IRFDMTrans* fdm, uint8_t packet_bits, const uint64_t* packets);
+
+/**
+ * Adds a channel: the demodulator feeds the decoder.
+ * --> Returns the channel index, or -1 if there's no room.
+ */
+int IRFDMRecv_add_channel(IRFDMRecv* fdm, IRDemod* demod, IRRecv* irRecv);
+
+/* Arms every decoder for a packet of 'bits' (parity included) */
+void IRFDMRecv_begin_packet(IRFDMRecv* fdm, uint8_t bits);
+
+/**
+ * Runs the samples through every channel.
+ * --> Bit mask of the channels with a packet ready.
+ */
+uint8_t IRFDMRecv_process(IRFDMRecv* fdm, const uint16_t* samples, uint32_t n_samples);
+
+/**
+ * Takes the packet of a channel.
+ * --> true if there was one, it's in *packet
+ */
+bool IRFDMRecv_take(IRFDMRecv* fdm, uint8_t channel, uint64_t* packet);
+
+/**
+ *
+ * Constructors and Destructors for IRFDM
+ *
+ * _create_skel --> no channels, add them yourself
+ * _create      --> a channel for each carrier (the receivers
+ *                  with soft_decision on)
+ *
+ */
+IRFDMTrans* IRFDMTrans_create_skel(void);
+IRFDMTrans* IRFDMTrans_create(const uint8_t* ir_pins, const uint32_t* carriers, uint8_t n_channels);
+
+void IRFDMTrans_destroy(IRFDMTrans* fdm);
+
+IRFDMRecv* IRFDMRecv_create_skel(void);
+IRFDMRecv* IRFDMRecv_create(uint32_t sample_rate, const uint32_t* carriers, uint8_t n_channels);
+
+void IRFDMRecv_destroy(IRFDMRecv* fdm);
+
+#ifdef __cplusplus
+} /* Matching } for the extern C */
+#endif
+
+
+#endif /* Include Guard */
@@ -0,0 +1,129 @@
+/************************************************************
+
+  IR Glitch Filter for SWIM Project
+
+  Cleans up the raw runs of the VSOP38338 output before
+  they reach the symbol decoder.
+
+  Implementation file.
+
+ ************************************************************/
+#include "IRFilter.h"
+
+/**
+ * Feeds a run into the filter.
+ *
+ * Runs of the same level one after another are fine, they
+ * are just longer runs.
+ */
+bool IRFilter_push_run(IRFilter* filter, uint8_t level, uint32_t duration, IRPulse* out)
+{
+  if (level) {
+
+    if (filter->in_pulse) {
+      /* Back up after a short low: it was a dropout */
+      if (filter->gap) filter->n_merged++;
+      filter->high += filter->gap + duration;
+      filter->gap   = 0;
+      return false;
+    }
+
+    if (duration < filter->min_pulse_us) {
+      /* Glitch, part of the low */
+      filter->low += duration;
+      filter->n_glitches++;
+      return false;
+    }
+
+    filter->in_pulse = true;
+    filter->high     = duration;
+    filter->gap      = 0;
+    return false;
+  }
+
+  if (!filter->in_pulse) {
+    filter->low += duration;
+    return false;
+  }
+
+  filter->gap += duration;
+  if (filter->gap < filter->merge_gap_us) {
+    /* Might still be a dropout */
+    return false;
+  }
+
+  /* A real low: the pulse is over */
+  out->high = filter->high;
+  out->low  = filter->low;
+
+  filter->in_pulse = false;
+  filter->low      = filter->gap;
+  filter->high     = 0;
+  filter->gap      = 0;
+
+  return true;
+}
+
+bool IRFilter_flush(IRFilter* filter, IRPulse* out)
+{
+  if (!filter->in_pulse) return false;
+
+  out->high = filter->high;
+  out->low  = filter->low;
+
+  filter->in_pulse = false;
+  filter->low      = filter->gap;
+  filter->high     = 0;
+  filter->gap      = 0;
+
+  return true;
+}
+
+bool IRFilter_pending(IRFilter* filter)
+{
+  return filter->in_pulse;
+}
+
+void IRFilter_reset(IRFilter* filter)
+{
+  filter->in_pulse = false;
+  filter->high     = 0;
+  filter->gap      = 0;
+  filter->low      = 0;
+}
+
+
+/****************************************************
+ *
+ * Constructors and Destructors for IRFilter
+ *
+ ****************************************************/
+IRFilter* IRFilter_create(uint32_t min_pulse_us, uint32_t merge_gap_us)
+{
+  IRFilter* filter = (IRFilter*)malloc(sizeof(IRFilter));
+
+  filter->min_pulse_us = min_pulse_us;
+  filter->merge_gap_us = merge_gap_us;
+
+  filter->n_glitches = 0;
+  filter->n_merged   = 0;
+
+  filter->PushRun = &(IRFilter_push_run);
+  filter->Flush   = &(IRFilter_flush);
+
+  IRFilter_reset(filter);
+
+  return filter;
+}
+
+IRFilter* IRFilter_create_with_period(uint32_t period_us)
+{
+  return IRFilter_create(
+    period_us * IRFILTER_DEF_MIN_PULSE_PERIODS,
+    period_us * IRFILTER_DEF_MERGE_GAP_PERIODS);
+}
+
+void IRFilter_destroy(IRFilter* filter)
+{
+  if (filter) free(filter);
+}
@@ -0,0 +1,125 @@
+/************************************************************
+
+  IR Glitch Filter for SWIM Project
+
+  Sits between the pin (or the captured edges) and the
+  symbol decoder of IRRecv. The VSOP38338 output follows
+  anything that looks like a carrier burst, so sunlight
+  flicker and bubbles turn up as micro-pulses, and a real
+  pulse can be split by a short dropout.
+
+  The filter takes the raw runs, (level, duration), and
+  gives out the cleaned up pulses:
+
+    - A pulse has to be min_pulse_us long to start.
+      Shorter ones are glitches, counted into the low.
+    - A pulse ends only with a low of merge_gap_us.
+      Shorter lows are dropouts, merged into the pulse.
+
+  The two thresholds are the hysteresis: easy to stay in
+  a state, hard to get into the other one.
+
+  Plain C, no pin access: can be fed recorded or synthetic
+  runs on the host.
+
+  Header file.
+
+ ************************************************************/
+#ifndef __IRFILTER_H__
+#define __IRFILTER_H__
+
+/**
+ *
+ * Some basic includes
+ *
+ */
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifndef __cplusplus
+#include "cbool.h"
+#endif
+
+/**
+ * Defaults, in carrier periods. The shortest symbol is a zero
+ * (PULSES_FOR_ZERO) and the shortest low is PULSES_FOR_EMPTY,
+ * so both are well clear of these.
+ */
+#define IRFILTER_DEF_MIN_PULSE_PERIODS   4
+#define IRFILTER_DEF_MERGE_GAP_PERIODS   4
+
+/**
+ * A cleaned up pulse
+ */
+typedef struct __ir_pulse__ {
+  uint32_t high;   // Pulse length in us, merged dropouts included
+  uint32_t low;    // Low before the pulse in us, glitches included
+} IRPulse;
+
+/**
+ *
+ * The main struct for IRFilter
+ *
+ */
+typedef struct __ir_filter__ {
+
+  uint32_t min_pulse_us;
+  uint32_t merge_gap_us;
+
+  /* Run being assembled */
+  bool     in_pulse;
+  uint32_t high;         // Pulse so far
+  uint32_t gap;          // Short low that may still be a dropout
+  uint32_t low;          // Low before the pulse
+
+  uint32_t n_glitches;   // Pulses dropped for being too short
+  uint32_t n_merged;     // Dropouts merged into a pulse
+
+  bool (*PushRun)(struct __ir_filter__*, uint8_t, uint32_t, IRPulse*);
+  bool (*Flush)(struct __ir_filter__*, IRPulse*);
+
+} IRFilter;
+
+/**
+ *
+ * Method definitions for IRFilter
+ *
+ */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Feed one run: level (1 for signal) and its length in us.
+ * --> true if a pulse was completed, it's in *out
+ */
+bool IRFilter_push_run(IRFilter* filter, uint8_t level, uint32_t duration, IRPulse* out);
+
+/**
+ * No more runs are coming for now (timeout). Gives out the
+ * pending pulse, if any.
+ * --> true if a pulse was completed, it's in *out
+ */
+bool IRFilter_flush(IRFilter* filter, IRPulse* out);
+
+/* A pulse is waiting for its ending low */
+bool IRFilter_pending(IRFilter* filter);
+
+void IRFilter_reset(IRFilter* filter);
+
+/**
+ *
+ * Constructors and Destructors for IRFilter
+ *
+ */
+IRFilter* IRFilter_create(uint32_t min_pulse_us, uint32_t merge_gap_us);
+IRFilter* IRFilter_create_with_period(uint32_t period_us);
+
+void IRFilter_destroy(IRFilter* filter);
+
+#ifdef __cplusplus
+} /* Matching } for the extern C */
+#endif
+
+
+#endif /* Include Guard */
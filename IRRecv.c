@@ -14,6 +14,8 @@
  ************************************************************/
 #include "IRRecv.h"
 
+#include <string.h>
+
 /* Detect Arduino */
 #if defined(ARDUINO) && ARDUINO >= 100
 #include "Arduino.h"
@@ -24,16 +26,126 @@
 /**
  * The incoming signal doesn't really have the same
  * timing we defined. It can be a bit shorter or longer.
- * We are giving 20 % margin 
+ * The recovered clock may go down to 60 % of the nominal
+ * one, or up to 140 %.
  */
 #define SIGNAL_TIME_MODIFIER           6/10
 
+#define IRRECV_EST_MIN(nominal)  ((nominal)*SIGNAL_TIME_MODIFIER)
+#define IRRECV_EST_MAX(nominal)  (2*(nominal) - IRRECV_EST_MIN(nominal))
+
+/**
+ * Decision boundaries, halfway between the neighbouring symbols,
+ * scaled from the header length.
+ *   one/zero   --> (ONE+ZERO)/2
+ *   one/gap    --> (ONE+GAP)/2
+ *   gap/header --> (GAP+HEADER_ONE)/2
+ */
+#define IRRECV_SCALE_HEADER(header, a, b) \
+  ((uint32_t)(((uint64_t)(header) * ((a)+(b))) / (2*PULSES_FOR_HEADER_ONE)))
+
+/**
+ * Preamble sync: the runs may be off the (scaled) pattern by
+ * 1/IRRECV_SYNC_TOLERANCE of the preamble length, all together.
+ */
+#define IRRECV_SYNC_TOLERANCE          4
+
+/**
+ * What to do while waiting for the next captured edge.
+ * Cortex-M: sleep until an interrupt (the edge, or the tick) comes.
+ */
+#if defined(__arm__)
+#define IRRECV_WAIT_FOR_EDGE()         __asm__ volatile ("wfi")
+#else
+#define IRRECV_WAIT_FOR_EDGE()
+#endif
+
+/**
+ * The edge capture interrupts. attachInterrupt() can't pass an
+ * argument, so each capturing receiver gets its own trampoline.
+ */
+static IRRecv* capture_target[IRRECV_MAX_CAPTURE];
+
+static void capture_isr(IRRecv* irRecv)
+{
+  if (irRecv) {
+    IRRecv_feed_edge(irRecv, micros(), (uint8_t)irRecv->ReadIRPin(irRecv));
+  }
+}
+
+static void capture_isr_0(void) { capture_isr(capture_target[0]); }
+static void capture_isr_1(void) { capture_isr(capture_target[1]); }
+static void capture_isr_2(void) { capture_isr(capture_target[2]); }
+static void capture_isr_3(void) { capture_isr(capture_target[3]); }
+
+static void (* const capture_isr_table[IRRECV_MAX_CAPTURE])(void) = {
+  &(capture_isr_0),
+  &(capture_isr_1),
+  &(capture_isr_2),
+  &(capture_isr_3)
+};
+
 /**
  *
  * A private methods to read incoming IR
  * signal..
  *
  */
+/**
+ * How long the pin stays at 'level', up to 'limit' us
+ */
+static uint32_t run_length(IRRecv* irRecv, int level, uint32_t limit)
+{
+  uint32_t start = micros();
+
+  while (irRecv->ReadIRPin(irRecv) == level) {
+    if (micros() - start >= limit) break;
+  }
+
+  return micros() - start;
+}
+
+/**
+ * Polling front-end through the glitch filter.
+ *
+ * The pin is measured a run at a time. Once a pulse is pending,
+ * the low is only measured up to merge_gap_us: by then the pulse
+ * is over, the rest of the low is picked up by the next call.
+ */
+static uint32_t pulse_width_filtered(IRRecv* irRecv)
+{
+  IRPulse  pulse;
+  uint32_t start, run, limit;
+  int      level;
+
+  start = micros();
+
+  while (true) {
+
+    level = irRecv->ReadIRPin(irRecv);
+    limit = (level == 0 && IRFilter_pending(irRecv->filter)) ? 
+      irRecv->filter->merge_gap_us : PULSE_TIMEOUT;
+
+    run = run_length(irRecv, level, limit);
+
+    if (run >= PULSE_TIMEOUT) {
+      /* Stuck at one level, same as pulse_width */
+      IRFilter_reset(irRecv->filter);
+      return PULSE_TIMEOUT;
+    }
+
+    if (IRFilter_push_run(irRecv->filter, (uint8_t)level, run, &pulse)) {
+      irRecv->last_low = pulse.low;
+      return pulse.high;
+    }
+
+    /* Nothing but glitches */
+    if (!IRFilter_pending(irRecv->filter) && micros() - start > PULSE_TIMEOUT) {
+      return PULSE_TIMEOUT;
+    }
+  }
+}
+
 /***************************************
  *
  * Reads pulse width in um...
@@ -48,12 +160,17 @@ uint32_t pulse_width(IRRecv* irRecv) {
 
   uint32_t start;
 
+  if (irRecv->filter) {
+    return pulse_width_filtered(irRecv);
+  }
+
   start = micros();
   while (irRecv->ReadIRPin(irRecv) == 0) {
     if (micros() - start > PULSE_TIMEOUT) {
       return PULSE_TIMEOUT;
     }
   }
+  irRecv->last_low = micros() - start;
 
   start = micros();
   while (irRecv->ReadIRPin(irRecv) == 1) {
@@ -65,30 +182,160 @@ uint32_t pulse_width(IRRecv* irRecv) {
   return micros() - start;
 }
 
+/**
+ * Pairs the captured edges into pulses.
+ * --> true and the pulse width in *duration once a signal (1)
+ *     run ends, false when the captured edges ran out first.
+ */
+static bool next_captured_pulse(IRRecv* irRecv, uint32_t* duration)
+{
+  fifo_data_t edge;
+  IRPulse  pulse;
+  uint32_t run, now;
+  uint8_t  level, prev_level;
+
+  while (irRecv->edges->Pop(irRecv->edges, &edge) == SPSC_SUCCESS) {
+
+    level      = (uint8_t)(edge & 0x1);
+    prev_level = irRecv->last_level;
+
+    /* Repeated levels (missed edges) just extend the run */
+    if (level == prev_level) continue;
+
+    run = (edge & ~0x1UL) - irRecv->last_edge;
+
+    irRecv->last_edge  = (edge & ~0x1UL);
+    irRecv->last_level = level;
+
+    if (irRecv->filter) {
+      if (IRFilter_push_run(irRecv->filter, prev_level, run, &pulse)) {
+        irRecv->last_low = pulse.low;
+        (*duration) = pulse.high;
+        return true;
+      }
+      continue;
+    }
+
+    if (prev_level == 1) {
+      (*duration) = run;
+      return true;
+    }
+    irRecv->last_low = run;
+  }
+
+  /**
+   * A filtered pulse is over once the low lasted merge_gap_us,
+   * no need to wait for the next edge. The low so far goes to
+   * the filter, the rest of it comes with the next edge.
+   * (An edge captured meanwhile may be older than 'now': skip)
+   */
+  if (irRecv->filter && IRFilter_pending(irRecv->filter) && irRecv->last_level == 0) {
+    now = micros() & ~0x1UL;
+    run = now - irRecv->last_edge;
+
+    if (run >= irRecv->filter->merge_gap_us && !SPSCFIFO_count(irRecv->edges)) {
+      irRecv->last_edge = now;
+      if (IRFilter_push_run(irRecv->filter, 0, run, &pulse)) {
+        irRecv->last_low = pulse.low;
+        (*duration) = pulse.high;
+        return true;
+      }
+    }
+  }
+
+  return false;
+}
+
+/***************************************
+ *
+ * Reads pulse width in us from the
+ * captured edges.
+ * 
+ * --> Sleeps between edges instead of
+ *     spinning on the pin.
+ * 
+ ***************************************/
+uint32_t pulse_width_capture(IRRecv* irRecv) {
+
+  uint32_t start, duration;
+
+  start = micros();
+
+  while (!next_captured_pulse(irRecv, &duration)) {
+    if (micros() - start > PULSE_TIMEOUT) {
+      return PULSE_TIMEOUT;
+    }
+    IRRECV_WAIT_FOR_EDGE();
+  }
+
+  return duration;
+}
+
 /**
  * Voting algorithm for the repeated buffers (uint64_t data)
+ *
+ * Word parallel: every bit position is voted at once.
+ * A bit is 1 if at least half of the copies say 1 (ties go to 1).
+ *
+ * n_data == 3 --> (a&b)|(a&c)|(b&c)
+ * otherwise   --> bit-sliced counter. count[k] holds the k-th bit
+ *                 of the per-position number of ones, then the
+ *                 counts are compared against ceil(n_data/2), 
+ *                 again slice by slice.
  */
+#define VOTE_COUNT_PLANES   8     /* uint8_t n_data --> up to 255 copies */
+
 uint64_t vote(uint64_t* data_set, uint8_t n_data, uint8_t bits)
 {
   if (!data_set) return 0;
   if (n_data <= 1) return data_set[0];
 
-  int i, di;
-  uint64_t data = 0;
-  uint32_t n_ones, n_zeros;
+  int di, k;
+  uint64_t data, carry, sum, gt, eq;
+  uint64_t count[VOTE_COUNT_PLANES] = {0};
+  uint8_t  threshold, n_planes;
 
-  for(i=bits-1; i>=0; i--) {
-    n_ones = 0;
-    n_zeros = 0;
+  uint64_t mask = (bits >= 64) ? ~(uint64_t)0 : (((uint64_t)1<<bits) - 1);
 
-    for (di=0; di<n_data; ++di) {
-      ((data_set[di]>>i) & 0x1) ? n_ones++ : n_zeros++ ;
+  if (n_data == 2) {
+    return (data_set[0] | data_set[1]) & mask;
+  }
+
+  if (n_data == 3) {
+    return ( (data_set[0] & data_set[1]) | 
+             (data_set[0] & data_set[2]) | 
+             (data_set[1] & data_set[2]) ) & mask;
+  }
+
+  n_planes = 0;
+  while (n_planes < VOTE_COUNT_PLANES && (n_data >> n_planes)) n_planes++;
+
+  /* Add the copies into the counter, ripple carry through the planes */
+  for (di=0; di<n_data; ++di) {
+    carry = data_set[di];
+    for (k=0; k<n_planes && carry; ++k) {
+      sum      = count[k] ^ carry;
+      carry    = count[k] & carry;
+      count[k] = sum;
     }
+  }
 
-    if (n_ones >= n_zeros) data += (1<<i);
+  /* count >= threshold, from the most significant plane down */
+  threshold = (uint8_t)((n_data + 1) / 2);
+  gt = 0;
+  eq = ~(uint64_t)0;
+  for (k=n_planes-1; k>=0; --k) {
+    if ((threshold >> k) & 0x1) {
+      eq &= count[k];
+    }
+    else {
+      gt |= eq & count[k];
+      eq &= ~count[k];
+    }
   }
+  data = gt | eq;
 
-  return data;
+  return data & mask;
 }
 
 /**
@@ -113,6 +360,112 @@ void calc_period_irrecv(IRRecv* irRecv)
     irRecv->irComm->period * PULSES_FOR_GAP;
   irRecv->period_header_one = \
     irRecv->irComm->period * PULSES_FOR_HEADER_ONE;
+
+  IRRecv_reset_calibration(irRecv);
+}
+
+/**
+ * Derive the decision boundaries of the packet from its header.
+ *
+ * The current packet uses its own header, so a skewed transmitter
+ * clock is followed right away. The header detection uses the
+ * running estimate, (3*old + new)/4, to follow slow drifts.
+ */
+void IRRecv_calibrate(IRRecv* irRecv, uint32_t header)
+{
+  uint32_t lo = IRRECV_EST_MIN(irRecv->period_header_one);
+  uint32_t hi = IRRECV_EST_MAX(irRecv->period_header_one);
+
+  if (header < lo) header = lo;
+  if (header > hi) header = hi;
+
+  irRecv->header_pkt = header;
+
+  irRecv->bit_threshold = \
+    IRRECV_SCALE_HEADER(header, PULSES_FOR_ONE, PULSES_FOR_ZERO);
+  irRecv->gap_threshold = \
+    IRRECV_SCALE_HEADER(header, PULSES_FOR_ONE, PULSES_FOR_GAP);
+
+  irRecv->header_est = (3*irRecv->header_est + header) / 4;
+  irRecv->header_threshold = \
+    IRRECV_SCALE_HEADER(irRecv->header_est, PULSES_FOR_GAP, PULSES_FOR_HEADER_ONE);
+}
+
+uint32_t IRRecv_packet_airtime(IRRecv* irRecv, uint8_t bits)
+{
+  uint64_t periods = \
+    ((irRecv->sync_mode == SYNC_PREAMBLE) ? 
+      PULSES_FOR_PREAMBLE : PULSES_FOR_HEADER_ONE + PULSES_FOR_HEADER_EMPTY) + \
+    (uint64_t)irRecv->repeat * bits * (PULSES_FOR_ONE + PULSES_FOR_EMPTY) + \
+    (uint64_t)(irRecv->repeat - 1) * (PULSES_FOR_GAP + PULSES_FOR_EMPTY);
+
+  return (uint32_t)((periods * irRecv->header_est) / PULSES_FOR_HEADER_ONE);
+}
+
+void IRRecv_set_sync_mode(IRRecv* irRecv, uint8_t sync_mode)
+{
+  irRecv->sync_mode = sync_mode;
+  irRecv->sync_fill = 0;
+}
+
+/**
+ * Preamble correlator.
+ *
+ * Keeps the latest runs: the low before each pulse and the pulse.
+ * Once the latest high, low, high, low, high look like the pattern
+ * scaled to their total length, that length gives the clock:
+ * returned as the header it stands for.
+ * (The first low is the idle line, the trailing one isn't here yet)
+ */
+static bool preamble_sync_irrecv(IRRecv* irRecv, uint32_t low, uint32_t high, uint32_t* header)
+{
+  static const uint8_t pattern[PREAMBLE_RUNS] = PREAMBLE_PATTERN;
+  uint32_t* runs = irRecv->sync_runs;
+  uint64_t  total = 0, err = 0, x, t;
+  uint32_t  units = 0;
+  int i;
+
+  memmove(&runs[0], &runs[2], (PREAMBLE_RUNS-2)*sizeof(uint32_t));
+  runs[PREAMBLE_RUNS-2] = low;
+  runs[PREAMBLE_RUNS-1] = high;
+  if (irRecv->sync_fill < PREAMBLE_RUNS) irRecv->sync_fill += 2;
+  if (irRecv->sync_fill < PREAMBLE_RUNS) return false;
+
+  for (i=1; i<PREAMBLE_RUNS; i++) {
+    total += runs[i];
+    units += pattern[i-1];
+  }
+  if (!total) return false;
+
+  /* |run*units - pattern*total|, summed, against total*units */
+  for (i=1; i<PREAMBLE_RUNS; i++) {
+    x = (uint64_t)runs[i] * units;
+    t = (uint64_t)pattern[i-1] * total;
+    err += (x > t) ? x - t : t - x;
+  }
+  if (err * IRRECV_SYNC_TOLERANCE > total * units) return false;
+
+  /* The clock has to be within reach, like the header */
+  (*header) = (uint32_t)((total * PULSES_FOR_HEADER_ONE) / 
+    ((uint64_t)units * PULSES_FOR_PREAMBLE_UNIT));
+  if ((*header) < IRRECV_EST_MIN(irRecv->header_est) || 
+      (*header) > IRRECV_EST_MAX(irRecv->header_est)) return false;
+
+  irRecv->sync_fill = 0;
+  return true;
+}
+
+void IRRecv_reset_calibration(IRRecv* irRecv)
+{
+  irRecv->header_est = irRecv->period_header_one;
+  irRecv->header_pkt = irRecv->header_est;
+
+  irRecv->bit_threshold = IRRECV_SCALE_HEADER(
+    irRecv->header_est, PULSES_FOR_ONE, PULSES_FOR_ZERO);
+  irRecv->gap_threshold = IRRECV_SCALE_HEADER(
+    irRecv->header_est, PULSES_FOR_ONE, PULSES_FOR_GAP);
+  irRecv->header_threshold = IRRECV_SCALE_HEADER(
+    irRecv->header_est, PULSES_FOR_GAP, PULSES_FOR_HEADER_ONE);
 }
 
 /**
@@ -137,6 +490,80 @@ void init_irrecv(IRRecv* irRecv)
  * Read in IR Pin wrapper - Hardware code that actually sets up GPIO
  * Update this part as we add up more devices.
  */
+int IRRecv_feed_edge(IRRecv* irRecv, uint32_t timestamp, uint8_t level)
+{
+  fifo_data_t edge = (timestamp & ~0x1UL) | (level & 0x1);
+
+  return (irRecv->edges->Push(irRecv->edges, edge) == SPSC_SUCCESS) ? 0 : -1;
+}
+
+void IRRecv_enable_filter(IRRecv* irRecv, uint32_t min_pulse_us, uint32_t merge_gap_us)
+{
+  IRRecv_disable_filter(irRecv);
+
+  if (min_pulse_us || merge_gap_us) {
+    irRecv->filter = IRFilter_create(min_pulse_us, merge_gap_us);
+  }
+  else {
+    irRecv->filter = IRFilter_create_with_period(irRecv->irComm->period);
+  }
+}
+
+void IRRecv_disable_filter(IRRecv* irRecv)
+{
+  if (irRecv->filter) {
+    IRFilter_destroy(irRecv->filter);
+    irRecv->filter = NULL;
+  }
+}
+
+int IRRecv_enable_capture(IRRecv* irRecv, uint32_t depth)
+{
+  int slot;
+
+  if (irRecv->edges) return 0;
+
+  for (slot=0; slot<IRRECV_MAX_CAPTURE; slot++) {
+    if (!capture_target[slot]) break;
+  }
+  if (slot >= IRRECV_MAX_CAPTURE) return -1;
+
+  irRecv->edges      = SPSCFIFO_create(depth ? depth : IRRECV_EDGE_DEPTH);
+  irRecv->last_edge  = micros();
+  irRecv->last_level = (uint8_t)irRecv->ReadIRPin(irRecv);
+  irRecv->PulseWidth = &(pulse_width_capture);
+
+  capture_target[slot] = irRecv;
+
+  #if defined(ARDUINO)
+  attachInterrupt(digitalPinToInterrupt(irRecv->irComm->IR_Pin),
+    capture_isr_table[slot], CHANGE);
+  #else
+  (void)capture_isr_table;
+  #endif
+
+  return 0;
+}
+
+void IRRecv_disable_capture(IRRecv* irRecv)
+{
+  int slot;
+
+  if (!irRecv->edges) return;
+
+  #if defined(ARDUINO)
+  detachInterrupt(digitalPinToInterrupt(irRecv->irComm->IR_Pin));
+  #endif
+
+  for (slot=0; slot<IRRECV_MAX_CAPTURE; slot++) {
+    if (capture_target[slot] == irRecv) capture_target[slot] = NULL;
+  }
+
+  SPSCFIFO_destroy(irRecv->edges);
+  irRecv->edges      = NULL;
+  irRecv->PulseWidth = &(pulse_width);
+}
+
 int read_ir_pin_irrecv(IRRecv* irRecv)
 {
   /* Arduino case: gotta implement more 'elegant' way to handle multi-platform */
@@ -169,12 +596,12 @@ int recv_irrecv(IRRecv* irRecv)
     }
 
     while(signal_arrived) {
-      duration = pulse_width(irRecv);
+      duration = irRecv->PulseWidth(irRecv);
       if ( duration >= PULSE_TIMEOUT ) {
         return ERROR_RECV;
       }
       else {
-        return ( duration >= irRecv->period_one ? 1 : 0 );
+        return ( duration >= irRecv->bit_threshold ? 1 : 0 );
       }
     }
   }
@@ -207,126 +634,578 @@ uint32_t read_data_irrecv(IRRecv* irRecv, uint8_t bits)
 }
 
 /**
- * Receive the SWIM packet.
- *
- * Basically, we need to detect long 1-0 start bit and 
- * the repeats. Then loads into the buf.
+ * Can the packet be delivered after 'n_read' copies?
  *
+ * The copies read so far have to agree, and the unread ones must
+ * not be able to turn any bit over:
+ *   plain majority --> each bit already has n_read votes. A 1 stays
+ *                      if n_read >= ceil(repeat/2), and a 0 stays if
+ *                      the other copies can't reach ceil(repeat/2)
+ *                      (ties go to 1).
+ *   soft_decision  --> each bit's summed confidence has to outweigh
+ *                      the unread copies at IRRECV_CONF_MAX each
+ *                      (strictly for a 0, ties go to 1). A nominal
+ *                      pulse weighs ~88, so with 3 copies the soft
+ *                      vote always waits for the last one.
  */
-int recv_packet_irrecv(IRRecv* irRecv, uint64_t* buf, uint8_t bits)
+static bool early_accept_irrecv(IRRecv* irRecv, uint8_t n_read)
 {
-  uint32_t duration, start;
-  RecvState state = IDLE;
-  uint8_t data_index, buf_index, data;
-  int err_code;
+  uint8_t threshold = (irRecv->repeat + 1) / 2;
+  uint8_t need = threshold;
+  int32_t unread, sum;
+  uint8_t pos, di;
+
+  for (di=1; di<n_read; di++) {
+    if (irRecv->tmp_buf[di] != irRecv->tmp_buf[0]) return false;
+  }
+
+  if (irRecv->soft_decision) {
+    unread = (int32_t)(irRecv->repeat - n_read) * IRRECV_CONF_MAX;
+
+    for (pos=0; pos<irRecv->bits; pos++) {
+      sum = 0;
+      for (di=0; di<n_read; di++) sum += irRecv->conf[di*IRRECV_MAX_BITS + pos];
+
+      if (((irRecv->tmp_buf[0]>>pos) & 0x1) ? (sum < unread) : (sum <= unread)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  if (irRecv->repeat - threshold + 1 > need) {
+    need = irRecv->repeat - threshold + 1;
+  }
+  return (n_read >= need);
+}
+
+/**
+ * Confidence of a bit, its distance from the one/zero boundary
+ * in 1/16 of a period. The boundary sits at (ONE+ZERO)/2 periods.
+ */
+static uint8_t bit_confidence_irrecv(IRRecv* irRecv, uint32_t duration)
+{
+  uint32_t dist, conf;
+
+  dist = (duration >= irRecv->bit_threshold) ? 
+    duration - irRecv->bit_threshold : irRecv->bit_threshold - duration;
+
+  conf = (uint32_t)(((uint64_t)dist * 8 * (PULSES_FOR_ONE+PULSES_FOR_ZERO)) / 
+    (irRecv->bit_threshold ? irRecv->bit_threshold : 1));
+
+  return (conf > IRRECV_CONF_MAX) ? IRRECV_CONF_MAX : (uint8_t)conf;
+}
+
+/**
+ * Soft vote over the first n_data copies.
+ * Each copy votes +conf for a 1 and -conf for a 0 (ties go to 1).
+ * Fills bit_conf with the size of the sums.
+ */
+static uint64_t soft_vote_irrecv(IRRecv* irRecv, uint8_t n_data)
+{
+  uint64_t data = 0;
+  int32_t  sum;
+  uint8_t  pos, di, conf;
+
+  for (pos=0; pos<irRecv->bits; pos++) {
+    sum = 0;
+    for (di=0; di<n_data; di++) {
+      conf = irRecv->conf[di*IRRECV_MAX_BITS + pos];
+      sum += ((irRecv->tmp_buf[di]>>pos) & 0x1) ? conf : -(int32_t)conf;
+    }
+
+    if (sum >= 0) data |= ((uint64_t)1<<pos);
+    else sum = -sum;
+
+    irRecv->bit_conf[pos] = (sum > IRRECV_CONF_MAX) ? IRRECV_CONF_MAX : (uint8_t)sum;
+  }
+
+  return data;
+}
+
+/**
+ * Count into a histogram bin, halving the whole histogram
+ * before the bin would overflow
+ */
+static void link_hist_add(LinkHistogram* hist, uint16_t* bin)
+{
+  uint16_t* all = (uint16_t*)hist;
+
+  if (*bin == UINT16_MAX) {
+    for (size_t i=0; i<sizeof(LinkHistogram)/sizeof(uint16_t); i++) {
+      all[i] >>= 1;
+    }
+  }
+  (*bin)++;
+}
+
+/**
+ * How far a data pulse was from the ideal one/zero length,
+ * in 1/16 of a period
+ */
+static void track_deviation_irrecv(IRRecv* irRecv, uint32_t duration, uint8_t data)
+{
+  uint32_t ideal, dev;
+
+  ideal = (irRecv->header_pkt * (data ? PULSES_FOR_ONE : PULSES_FOR_ZERO)) / 
+    PULSES_FOR_HEADER_ONE;
+  dev = (duration > ideal) ? duration - ideal : ideal - duration;
+  dev = (uint32_t)(((uint64_t)dev * 16 * PULSES_FOR_HEADER_ONE) / 
+    (irRecv->header_pkt ? irRecv->header_pkt : 1));
+  if (dev > UINT16_MAX) dev = UINT16_MAX;
+
+  irRecv->dev_sum += dev;
+  if (dev > irRecv->dev_max) irRecv->dev_max = (uint16_t)dev;
+  irRecv->n_pulses++;
+}
+
+static uint8_t popcount64(uint64_t x)
+{
+  uint8_t n = 0;
+  while (x) { x &= x - 1; n++; }
+  return n;
+}
+
+/**
+ * Link quality record of the packet just voted
+ */
+static void record_link_irrecv(IRRecv* irRecv, uint8_t n_data)
+{
+  uint64_t any = 0, all = ~(uint64_t)0;
+  uint8_t  bin;
+
+  for (uint8_t di=0; di<n_data; di++) {
+    any |= irRecv->tmp_buf[di];
+    all &= irRecv->tmp_buf[di];
+  }
+
+  irRecv->link.n_copies      = n_data;
+  irRecv->link.disagree_bits = popcount64(any & ~all);
+  irRecv->link.parity        = LINK_PARITY_UNKNOWN;
+  irRecv->link.dev_mean      = irRecv->n_pulses ? 
+    (uint16_t)(irRecv->dev_sum / irRecv->n_pulses) : 0;
+  irRecv->link.dev_max       = irRecv->dev_max;
+
+  bin = irRecv->link.disagree_bits;
+  if (bin >= LINK_HIST_BINS) bin = LINK_HIST_BINS-1;
+  link_hist_add(&(irRecv->link_hist), &(irRecv->link_hist.disagree[bin]));
+
+  bin = 0;
+  while (bin < LINK_HIST_BINS-1 && (irRecv->link.dev_mean >> bin)) bin++;
+  link_hist_add(&(irRecv->link_hist), &(irRecv->link_hist.deviation[bin]));
+}
+
+/**
+ * A packet broke off in the middle
+ */
+static int lose_packet_irrecv(IRRecv* irRecv, int err_code)
+{
+  irRecv->state = ERROR;
+  link_hist_add(&(irRecv->link_hist), &(irRecv->link_hist.lost));
+
+  return err_code;
+}
+
+/**
+ * Finalizing the received signal from the first n_data copies
+ */
+static int deliver_packet_irrecv(IRRecv* irRecv, uint8_t n_data)
+{
+  uint64_t soft = soft_vote_irrecv(irRecv, n_data);
+
+  irRecv->packet = irRecv->soft_decision ? 
+    soft : vote(irRecv->tmp_buf, n_data, irRecv->bits);
+  irRecv->state  = FINISH;
+  irRecv->n_packets++;
+
+  record_link_irrecv(irRecv, n_data);
+
+  return IRRECV_PKT_READY;
+}
+
+void IRRecv_report_parity(IRRecv* irRecv, bool passed)
+{
+  if (irRecv->link.parity != LINK_PARITY_UNKNOWN) return;
+
+  irRecv->link.parity = passed ? LINK_PARITY_PASS : LINK_PARITY_FAIL;
+  link_hist_add(&(irRecv->link_hist), passed ? 
+    &(irRecv->link_hist.parity_pass) : &(irRecv->link_hist.parity_fail));
+}
+
+const LinkQuality* IRRecv_link_quality(IRRecv* irRecv)
+{
+  return &(irRecv->link);
+}
+
+void IRRecv_link_histogram(IRRecv* irRecv, LinkHistogram* hist)
+{
+  memcpy(hist, &(irRecv->link_hist), sizeof(LinkHistogram));
+}
+
+void IRRecv_reset_link_stats(IRRecv* irRecv)
+{
+  memset(&(irRecv->link), 0, sizeof(LinkQuality));
+  memset(&(irRecv->link_hist), 0, sizeof(LinkHistogram));
+  irRecv->link.parity = LINK_PARITY_UNKNOWN;
+}
+
+int IRRecv_weakest_bit(IRRecv* irRecv, uint8_t* conf)
+{
+  int weakest = -1;
+  uint8_t pos;
+
+  if (!irRecv->n_packets) return -1;
+
+  for (pos=0; pos<irRecv->bits; pos++) {
+    if (weakest < 0 || irRecv->bit_conf[pos] < irRecv->bit_conf[weakest]) {
+      weakest = pos;
+    }
+  }
+
+  if (conf && weakest >= 0) (*conf) = irRecv->bit_conf[weakest];
+
+  return weakest;
+}
+
+/**
+ * Arm the incremental decoder for a new packet
+ */
+void IRRecv_begin_packet(IRRecv* irRecv, uint8_t bits)
+{
+  irRecv->state      = IDLE;
+  irRecv->bits       = bits;
+  irRecv->buf_index  = 0;
+  irRecv->data_index = 0;
+  irRecv->sync_fill  = 0;
 
-  (*buf) = 0;
   for(int i=0; i<irRecv->repeat; i++) {
     irRecv->tmp_buf[i] = 0U;
   }
+}
 
-  while (true) {
+/**
+ * Feed one pulse to the decoder.
+ *
+ * The SWIM packet is a long header pulse (or the preamble), then
+ * the copies of the packet separated by the gap pulses. No gap
+ * after the last copy.
+ *
+ * header | copy 0 | gap | copy 1 | gap | ... | copy repeat-1
+ *
+ */
+int IRRecv_feed(IRRecv* irRecv, uint32_t low, uint32_t high)
+{
+  irRecv->last_low = low;
+  return IRRecv_feed_pulse(irRecv, high);
+}
 
-    /* Waiting for the start signal */
-    start = millis();
-    while(state == IDLE) {
+int IRRecv_feed_run(IRRecv* irRecv, uint8_t level, uint32_t duration)
+{
+  IRPulse  pulse;
+  uint32_t low;
 
-      if (irRecv->ReadIRPin(irRecv) == 1) {
-        state = PKT_ARRIVED;
-        break;
-      }
+  if (irRecv->filter) {
+    if (IRFilter_push_run(irRecv->filter, level, duration, &pulse)) {
+      return IRRecv_feed(irRecv, pulse.low, pulse.high);
+    }
+    return IRRECV_NEED_MORE;
+  }
 
-      if (millis() - start > PACKET_TIMEOUT*irRecv->irComm->period) {
-        state = ERROR_IDLE_TIMEOUT;
-        break;
-      }
+  if (!level) {
+    irRecv->run_low += duration;
+    return IRRECV_NEED_MORE;
+  }
+
+  low = irRecv->run_low;
+  irRecv->run_low = 0;
 
-    } /* while(state == IDLE) */
-    
-    /* Once the packet is arrived */
-    while(state == PKT_ARRIVED) {
+  return IRRecv_feed(irRecv, low, duration);
+}
+
+int IRRecv_feed_pulse(IRRecv* irRecv, uint32_t duration)
+{
+  uint8_t  data, pos;
+  uint32_t header = 0;
+  bool     synced;
+
+  switch (irRecv->state) {
 
-      duration = pulse_width(irRecv);
+    /* Previous packet is done (or lost), start over */
+    case FINISH:
+    case ERROR:
+      IRRecv_begin_packet(irRecv, irRecv->bits);
+      /* fall through */
 
+    /* Waiting for the header */
+    case IDLE:
+    case PKT_ARRIVED:
+      irRecv->state = PKT_ARRIVED;
+
+      /* Nothing arrived yet, keep waiting */
       if (duration >= PULSE_TIMEOUT) {
-        err_code = ERROR_RECV;
-        state = IDLE;
-        break;
+        irRecv->sync_fill = 0;
+        return IRRECV_NEED_MORE;
+      }
+
+      if (irRecv->sync_mode == SYNC_PREAMBLE) {
+        synced = preamble_sync_irrecv(irRecv, irRecv->last_low, duration, &header);
       }
       else {
-        if (duration >= irRecv->period_header_one) {
-          state = PKT_READ;
-          buf_index  = 0;
-          data_index = 0;
-        }
+        header = duration;
+        synced = (duration >= irRecv->header_threshold &&
+                  duration <= IRRECV_EST_MAX(irRecv->header_est));
       }
-      break;
-    } /* while(state == PKT_ARRIVED) */
-
-    /* Actually reading the packets, 1/0 data */
-    while(state == PKT_READ) {
 
-      duration = pulse_width(irRecv);
+      if (synced) {
+        IRRecv_calibrate(irRecv, header);
+        irRecv->state      = PKT_READ;
+        irRecv->buf_index  = 0;
+        irRecv->data_index = 0;
+        irRecv->dev_sum    = 0;
+        irRecv->dev_max    = 0;
+        irRecv->n_pulses   = 0;
+      }
+      return IRRECV_NEED_MORE;
 
+    /* Actually reading the packets, 1/0 data */
+    case PKT_READ:
       if (duration >= PULSE_TIMEOUT) {
-        err_code = ERROR_PKT_READ;
-        state = ERROR;
-        break;
+        return lose_packet_irrecv(irRecv, ERROR_PKT_READ);
       }
-      
-      data = (duration >= irRecv->period_one) ?  1 : 0;
+
+      pos  = irRecv->bits-1-irRecv->data_index;
+      data = (duration >= irRecv->bit_threshold) ?  1 : 0;
       if (data) {
         /* Collect data to tmp_buf */
-        irRecv->tmp_buf[buf_index] += (1<<(bits-1-data_index));
-      }
-      data_index++;
-      
-      if (data_index >= bits) {
-        state = PKT_GAP;
-        data_index = 0;
-        break;
+        irRecv->tmp_buf[irRecv->buf_index] |= ((uint64_t)1 << pos);
       }
-    } /* while(state == PKT_READ) */
+      irRecv->conf[irRecv->buf_index*IRRECV_MAX_BITS + pos] = \
+        bit_confidence_irrecv(irRecv, duration);
+      track_deviation_irrecv(irRecv, duration, data);
+      irRecv->data_index++;
 
-    /* Handling the gap */
-    while(state == PKT_GAP) {
+      if (irRecv->data_index >= irRecv->bits) {
+        irRecv->data_index = 0;
+        irRecv->buf_index++;
 
-      duration = pulse_width(irRecv);
+        if (irRecv->buf_index < irRecv->repeat && irRecv->early_accept &&
+            early_accept_irrecv(irRecv, irRecv->buf_index)) {
+          /* The rest of the copies are skipped as non-header pulses */
+          irRecv->n_early_accept++;
+          return deliver_packet_irrecv(irRecv, irRecv->buf_index);
+        }
 
+        if (irRecv->buf_index >= irRecv->repeat) {
+          return deliver_packet_irrecv(irRecv, irRecv->repeat);
+        }
+        irRecv->state = PKT_GAP;
+      }
+      return IRRECV_NEED_MORE;
+
+    /* Handling the gap */
+    case PKT_GAP:
       if (duration >= PULSE_TIMEOUT) {
-        err_code = ERROR_GAP_READ;
-        state = ERROR;
-        break;
+        return lose_packet_irrecv(irRecv, ERROR_GAP_READ);
       }
 
-      if (duration >= irRecv->period_gap) {
+      if (duration >= irRecv->gap_threshold) {
+        irRecv->state = PKT_READ;
+      }
+      return IRRECV_NEED_MORE;
 
-        buf_index++;
-      
-        if (buf_index >= irRecv->repeat - 1) {
-          err_code = 0;
-          state = FINISH;
-        }
-        else {
-          state = PKT_READ;
-        }
+    default:
+      irRecv->state = ERROR;
+      return ERROR_RECV;
+  }
+}
+
+/**
+ * Feed the decoder with whatever was captured so far.
+ * Never waits for the edges.
+ */
+int IRRecv_poll(IRRecv* irRecv)
+{
+  uint32_t duration;
+  int status;
+
+  if (!irRecv->edges) return ERROR_RECV;
+
+  while (next_captured_pulse(irRecv, &duration)) {
+    status = IRRecv_feed_pulse(irRecv, duration);
+    if (status != IRRECV_NEED_MORE) return status;
+  }
+
+  /* The signal stopped in the middle of a packet */
+  if ((irRecv->state == PKT_READ || irRecv->state == PKT_GAP) &&
+      (micros() - irRecv->last_edge > PULSE_TIMEOUT)) {
+    return IRRecv_feed_pulse(irRecv, PULSE_TIMEOUT);
+  }
+
+  return IRRECV_NEED_MORE;
+}
+
+/**
+ * Did the wait for a header run out? idle_timeout_us if it's set
+ * (READ_ALL sets its deadlines there), else the old PACKET_TIMEOUT.
+ */
+static bool idle_expired_irrecv(IRRecv* irRecv, uint32_t start_ms, uint32_t start_us)
+{
+  if (irRecv->idle_timeout_us) {
+    return (micros() - start_us > irRecv->idle_timeout_us);
+  }
+  return (millis() - start_ms > PACKET_TIMEOUT*irRecv->irComm->period);
+}
+
+/**
+ * Receive the SWIM packet.
+ *
+ * Blocking version: measures the pulses and feeds the decoder
+ * until the packet is ready, lost, or no header arrives within
+ * the idle timeout (see idle_expired_irrecv).
+ *
+ */
+int recv_packet_irrecv(IRRecv* irRecv, uint64_t* buf, uint8_t bits)
+{
+  uint32_t start_ms, start_us;
+  int status;
+
+  (*buf) = 0;
+  IRRecv_begin_packet(irRecv, bits);
+
+  start_ms = millis();
+  start_us = micros();
+
+  /* Waiting for the start signal */
+  /* (The capture front-end does its own waiting, between edges) */
+  while (!irRecv->edges && irRecv->ReadIRPin(irRecv) == 0) {
+    if (idle_expired_irrecv(irRecv, start_ms, start_us)) {
+      return ERROR_IDLE_TIMEOUT;
+    }
+  }
+
+  do {
+    status = IRRecv_feed_pulse(irRecv, irRecv->PulseWidth(irRecv));
+
+    if (status == IRRECV_NEED_MORE && irRecv->state == PKT_ARRIVED &&
+        idle_expired_irrecv(irRecv, start_ms, start_us)) {
+      return ERROR_IDLE_TIMEOUT;
+    }
+  } while (status == IRRECV_NEED_MORE);
+
+  if (status == IRRECV_PKT_READY) {
+    (*buf) = irRecv->packet;
+  }
+
+  return status;
+}
+
+/**
+ * Duty-cycled listening
+ *
+ */
+void IRRecv_set_listen(IRRecv* irRecv, uint32_t period_us, uint32_t window_us)
+{
+  if (!window_us) window_us = PULSES_FOR_LISTEN_WINDOW * irRecv->irComm->period;
+
+  irRecv->listen_period_us = period_us;
+  irRecv->listen_window_us = window_us;
+  memset(&(irRecv->listen), 0, sizeof(ListenStats));
+}
+
+void sleep_irrecv(IRRecv* irRecv, uint32_t duration)
+{
+  uint32_t start = micros();
+
+  (void)irRecv;
+
+  while (micros() - start < duration) {
+    IRRECV_WAIT_FOR_EDGE();
+  }
+}
+
+/**
+ * Anything on the line? A pulse going on, or edges captured
+ */
+static bool carrier_present_irrecv(IRRecv* irRecv)
+{
+  if (irRecv->edges) return (SPSCFIFO_count(irRecv->edges) > 0);
+
+  return (irRecv->ReadIRPin(irRecv) == 1);
+}
+
+int IRRecv_listen(IRRecv* irRecv, uint64_t* buf, uint8_t bits)
+{
+  ListenStats* stats = &(irRecv->listen);
+  uint32_t start, elapsed, sleep_us, saved_timeout;
+  bool     woke;
+  int      status;
+
+  if (!irRecv->listen_period_us) {
+    return irRecv->RecvPacket(irRecv, buf, bits);
+  }
+
+  sleep_us = (irRecv->listen_period_us > irRecv->listen_window_us) ? 
+    irRecv->listen_period_us - irRecv->listen_window_us : 0;
+
+  for (;;) {
+    /* Listen window */
+    stats->n_windows++;
+    start = micros();
+    woke  = false;
+    do {
+      if (carrier_present_irrecv(irRecv)) {
+        woke = true;
         break;
       }
-    } /* while(state == PKT_GAP) */
+    } while (micros() - start < irRecv->listen_window_us);
+
+    if (!woke) {
+      stats->awake_us += micros() - start;
+      irRecv->Sleep(irRecv, sleep_us);
+      stats->asleep_us += sleep_us;
+      continue;
+    }
+
+    /* Woken up: the rest of the train, then the packet */
+    stats->n_wakeups++;
+    saved_timeout = irRecv->idle_timeout_us;
+    irRecv->idle_timeout_us = irRecv->listen_period_us + irRecv->listen_window_us + \
+      IRRecv_packet_airtime(irRecv, bits);
+
+    status = irRecv->RecvPacket(irRecv, buf, bits);
+
+    irRecv->idle_timeout_us = saved_timeout;
+    elapsed = micros() - start;
+    stats->awake_us += elapsed;
+
+    if (status == ERROR_IDLE_TIMEOUT) {
+      /* Noise, no train: back to sleep */
+      stats->n_false_wakeups++;
+      continue;
+    }
+
+    if (status == IRRECV_PKT_READY) {
+      stats->n_commands++;
+      stats->last_latency_us = elapsed;
+      if (elapsed > stats->max_latency_us) stats->max_latency_us = elapsed;
+    }
 
-    /* Finalizing the received signal */
-    if (state == FINISH) {
-      (*buf) = vote(irRecv->tmp_buf, irRecv->repeat, bits);
-      //(*buf) = irRecv->tmp_buf[0];
-      return IRRECV_SUCCESS;
-    } /* if (state == FINISH) */
+    return status;
+  }
+}
+
+uint32_t IRRecv_listen_energy_uj(IRRecv* irRecv, uint32_t active_ua, uint32_t sleep_ua, uint32_t mv)
+{
+  ListenStats* stats = &(irRecv->listen);
+  uint64_t charge_nc;
 
-    /* Error exit */
-    if (state == ERROR) {
-      return err_code;
-    } /* if (state == ERROR) */
+  if (!stats->n_commands) return 0;
 
-  } /* while(true) */
+  /* uA * us = pC */
+  charge_nc = (stats->awake_us * active_ua + stats->asleep_us * sleep_ua) / 1000;
+
+  /* nC * mV = pJ */
+  return (uint32_t)((charge_nc * mv / 1000000) / stats->n_commands);
 }
 
 
@@ -345,20 +1224,55 @@ IRRecv* IRRecv_create_skel(void)
   irRecv->Init       =   &(init_irrecv);
 
   irRecv->ReadIRPin  =   &(read_ir_pin_irrecv);
+  irRecv->PulseWidth =   &(pulse_width);
   irRecv->Recv       =   &(recv_irrecv);
   irRecv->ReadData   =   &(read_data_irrecv);
   irRecv->RecvPacket =   &(recv_packet_irrecv);
+  irRecv->Sleep      =   &(sleep_irrecv);
 
   irRecv->irComm->mod_freq = DEF_MOD_FREQ;
   irRecv->CalcPeriod(irRecv);
 
   irRecv->repeat = PACKET_REPEAT;
 
+  irRecv->idle_timeout_us = 0;
+
+  irRecv->sync_mode = SYNC_HEADER;
+  irRecv->sync_fill = 0;
+
+  irRecv->edges      = NULL;
+  irRecv->last_edge  = 0;
+  irRecv->last_level = 0;
+  irRecv->last_low   = 0;
+  irRecv->filter     = NULL;
+  irRecv->run_low    = 0;
+
+  irRecv->state      = IDLE;
+  irRecv->bits       = 0;
+  irRecv->buf_index  = 0;
+  irRecv->data_index = 0;
+  irRecv->packet     = 0;
+
+  irRecv->early_accept   = false;
+  irRecv->n_packets      = 0;
+  irRecv->n_early_accept = 0;
+
   irRecv->tmp_buf = (uint64_t*)malloc(sizeof(uint64_t)*irRecv->repeat);
   for (int i=0; i<irRecv->repeat; i++) {
     irRecv->tmp_buf[i] = 0U;
   }
 
+  irRecv->soft_decision = false;
+  irRecv->conf = (uint8_t*)calloc(irRecv->repeat, IRRECV_MAX_BITS);
+  memset(irRecv->bit_conf, 0, sizeof(irRecv->bit_conf));
+
+  irRecv->dev_sum  = 0;
+  irRecv->dev_max  = 0;
+  irRecv->n_pulses = 0;
+  IRRecv_reset_link_stats(irRecv);
+
+  IRRecv_set_listen(irRecv, 0, 0);
+
   return irRecv;
 }
 
@@ -382,8 +1296,11 @@ IRRecv* IRRecv_create_with_freq(uint8_t ir_pin, uint32_t mod_freq)
 void IRRecv_destroy(IRRecv* irRecv)
 {
   if(irRecv) {
+    IRRecv_disable_capture(irRecv);
+    IRRecv_disable_filter(irRecv);
     if (irRecv->irComm) IRComm_destroy(irRecv->irComm);
     free(irRecv->tmp_buf);
+    free(irRecv->conf);
     free(irRecv);
   }
 }
\ No newline at end of file
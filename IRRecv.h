@@ -25,6 +25,12 @@
 
 #include "IRComm.h"
 
+/* Edge capture queue, filled from the pin change interrupt */
+#include "SPSCFIFO.h"
+
+/* Optional glitch filter in front of the decoder */
+#include "IRFilter.h"
+
 /* Timeout pulse length */
 #define PULSE_TIMEOUT    25000
 #define PACKET_TIMEOUT   100000
@@ -36,6 +42,78 @@
 #define ERROR_IDLE_TIMEOUT -6
 #define IRRECV_SUCCESS     0
 
+/* Incremental decoder status (IRRecv_feed_pulse) */
+#define IRRECV_PKT_READY   IRRECV_SUCCESS
+#define IRRECV_NEED_MORE   1
+
+/* Edge capture */
+#define IRRECV_EDGE_DEPTH  256     /* Captured edges kept before the decoder catches up */
+#define IRRECV_MAX_CAPTURE 4       /* Receivers that can capture at the same time */
+
+/* Soft decisions */
+#define IRRECV_MAX_BITS    64      /* Widest packet, parity included */
+#define IRRECV_CONF_MAX    255     /* Confidence saturates here */
+
+/* Link quality */
+#define LINK_HIST_BINS     8
+
+#define LINK_PARITY_UNKNOWN  -1
+#define LINK_PARITY_FAIL     0
+#define LINK_PARITY_PASS     1
+
+/**
+ * An enum to handle the packet receiving
+ */
+typedef enum __recv_state__ {
+  IDLE,
+  PKT_ARRIVED,
+  PKT_READ,
+  PKT_GAP,
+  ERROR,
+  FINISH
+} RecvState; 
+
+/**
+ * Link quality of one received packet.
+ * Deviations are in 1/16 of a carrier period, from the ideal
+ * one/zero lengths at the recovered clock.
+ */
+typedef struct __link_quality__ {
+  uint8_t  n_copies;       // Copies the packet was voted from
+  uint8_t  disagree_bits;  // Bits where the copies didn't all agree
+  int8_t   parity;         // LINK_PARITY_*, reported by the protocol
+  uint16_t dev_mean;       // Mean pulse deviation
+  uint16_t dev_max;        // Worst pulse deviation
+} LinkQuality;
+
+/**
+ * Rolling histograms of the link. When a bin saturates, all
+ * the bins are halved, so the old packets fade out.
+ *   disagree  --> bin i: i disagreeing bits (last bin: or more)
+ *   deviation --> bin i: mean deviation below 2^i (last bin: or more)
+ */
+typedef struct __link_histogram__ {
+  uint16_t disagree[LINK_HIST_BINS];
+  uint16_t deviation[LINK_HIST_BINS];
+  uint16_t parity_pass;
+  uint16_t parity_fail;
+  uint16_t lost;           // Packets that broke off in the middle
+} LinkHistogram;
+
+/**
+ * Duty-cycled listening record (IRRecv_listen)
+ */
+typedef struct __listen_stats__ {
+  uint32_t n_windows;        // Listen windows opened
+  uint32_t n_wakeups;        // ... that found a carrier
+  uint32_t n_false_wakeups;  // ... with no packet after it
+  uint32_t n_commands;       // Packets received
+  uint32_t last_latency_us;  // Waking window to packet, last one
+  uint32_t max_latency_us;
+  uint64_t awake_us;         // Listening and receiving
+  uint64_t asleep_us;        // Handed to the Sleep hook
+} ListenStats;
+
 /**
  * 
  * The main struct for IRRecv
@@ -53,30 +131,91 @@ typedef struct __ir_recv__ {
   uint32_t period_gap;
   uint8_t  repeat;
 
+  /**
+   * Clock recovery: the decision boundaries follow the received
+   * header instead of the nominal periods above.
+   */
+  uint32_t header_est;        // Running estimate of the header length (us)
+  uint32_t header_threshold;  // Shortest pulse taken as a header
+  uint32_t header_pkt;        // Header of the current packet, clamped
+  uint32_t bit_threshold;     // one/zero boundary for the current packet
+  uint32_t gap_threshold;     // one/gap boundary for the current packet
+
+  uint32_t idle_timeout_us;   // How long RecvPacket waits for a header, 0 for PACKET_TIMEOUT*period ms
+
+  /* Frame sync, SYNC_HEADER or SYNC_PREAMBLE (see IRComm.h) */
+  uint8_t  sync_mode;
+  uint32_t sync_runs[PREAMBLE_RUNS];  // Latest low/high runs, oldest first
+  uint8_t  sync_fill;
+
   uint64_t* tmp_buf;
 
+  /* Edge capture mode: (timestamp in us & ~1) | level, one entry per edge */
+  SPSCFIFO* edges;
+  uint32_t  last_edge;    // Timestamp of the last consumed edge
+  uint8_t   last_level;   // Level after the last consumed edge
+  uint32_t  last_low;     // Length of the low run before the last pulse
+
+  IRFilter* filter;       // Glitch filter, NULL if off
+  uint32_t  run_low;      // Low runs so far, for IRRecv_feed_run
+
+  /* Incremental decoder state, see IRRecv_feed_pulse */
+  RecvState state;
+  uint8_t   bits;         // Bits per copy, parity included
+  uint8_t   buf_index;    // Copy being read
+  uint8_t   data_index;   // Bit being read
+  uint64_t  packet;       // Voted packet once IRRECV_PKT_READY
+
+  /**
+   * Early accept: deliver the packet as soon as the copies read
+   * so far agree and the rest can't change the vote any more
+   * (with soft_decision: not even at full confidence).
+   * Off by default: every copy is read, as before.
+   */
+  bool      early_accept;
+  uint32_t  n_packets;       // Packets delivered
+  uint32_t  n_early_accept;  // ... of which before the last copy
+
+  /**
+   * Soft decisions: every bit keeps how far its pulse was from
+   * the one/zero boundary, in 1/16 of a carrier period.
+   * The copies are voted weighted by it (soft_decision), or by
+   * plain majority, the default. bit_conf is the combined
+   * confidence of each bit of the delivered packet, indexed by
+   * bit position, either way.
+   */
+  bool      soft_decision;
+  uint8_t*  conf;                       // [repeat][IRRECV_MAX_BITS]
+  uint8_t   bit_conf[IRRECV_MAX_BITS];
+
+  /* Link quality of the last packet, and the history */
+  uint32_t      dev_sum;      // Pulse deviations of the current packet
+  uint16_t      dev_max;
+  uint16_t      n_pulses;
+  LinkQuality   link;
+  LinkHistogram link_hist;
+
+  /**
+   * Duty-cycled listening: IRRecv_listen is awake for
+   * listen_window_us every listen_period_us, and calls Sleep
+   * in between. listen_period_us 0 is always on.
+   */
+  uint32_t    listen_period_us;
+  uint32_t    listen_window_us;
+  ListenStats listen;
+
   void (*CalcPeriod)(struct __ir_recv__*);
   void (*Init)(struct __ir_recv__*);
 
   int (*ReadIRPin)(struct __ir_recv__*);
+  uint32_t (*PulseWidth)(struct __ir_recv__*);
   int (*Recv)(struct __ir_recv__*);
   uint32_t (*ReadData)(struct __ir_recv__*, uint8_t);
   int (*RecvPacket)(struct __ir_recv__*, uint64_t*, uint8_t);
+  void (*Sleep)(struct __ir_recv__*, uint32_t);
 
 } IRRecv;
 
-/**
- * An enum to handle the packet receiving
- */
-typedef enum __recv_state__ {
-  IDLE,
-  PKT_ARRIVED,
-  PKT_READ,
-  PKT_GAP,
-  ERROR,
-  FINISH
-} RecvState; 
-
 /**
  * 
  * Method definitions for IRRecv
@@ -87,9 +226,134 @@ extern "C" {
 #endif
 
 void calc_period_irrecv(IRRecv* irRecv);
+
+/**
+ * Clock recovery.
+ * IRRecv_calibrate derives the decision boundaries of the packet
+ * from its received header, and folds it into the running estimate.
+ * IRRecv_reset_calibration goes back to the nominal periods.
+ */
+void IRRecv_calibrate(IRRecv* irRecv, uint32_t header);
+void IRRecv_reset_calibration(IRRecv* irRecv);
+
+/**
+ * Frame sync: SYNC_HEADER (default) or SYNC_PREAMBLE,
+ * the same way as the transmitter.
+ */
+void IRRecv_set_sync_mode(IRRecv* irRecv, uint8_t sync_mode);
+
+/**
+ * On-air time of a packet of 'bits' (parity included) in us,
+ * all copies, worst case (all ones), at the recovered clock.
+ */
+uint32_t IRRecv_packet_airtime(IRRecv* irRecv, uint8_t bits);
 void init_irrecv(IRRecv* irRecv);
 
 int read_ir_pin_irrecv(IRRecv* irRecv);
+
+/**
+ * Pulse front-ends: both return the length of the next
+ * signal (1) pulse in us, or PULSE_TIMEOUT.
+ * pulse_width         --> busy-polls the pin
+ * pulse_width_capture --> consumes the captured edges
+ */
+uint32_t pulse_width(IRRecv* irRecv);
+uint32_t pulse_width_capture(IRRecv* irRecv);
+
+/**
+ * Edge capture mode.
+ *
+ * IRRecv_enable_capture attaches a pin change interrupt that
+ * timestamps every edge into irRecv->edges, and switches the
+ * decoder over to pulse_width_capture. The MCU is free (or
+ * asleep) between edges and the pulse lengths no longer depend
+ * on how fast the polling loop runs.
+ *
+ * IRRecv_feed_edge is what the interrupt calls. It can be fed
+ * with synthetic edges as well, e.g. from a host test.
+ * --> Returns 0, or -1 if the edge queue overflowed.
+ */
+int IRRecv_enable_capture(IRRecv* irRecv, uint32_t depth);
+void IRRecv_disable_capture(IRRecv* irRecv);
+int IRRecv_feed_edge(IRRecv* irRecv, uint32_t timestamp, uint8_t level);
+
+/**
+ * Glitch filter for both front-ends, see IRFilter.h.
+ * Zero thresholds pick the defaults for the carrier period.
+ */
+void IRRecv_enable_filter(IRRecv* irRecv, uint32_t min_pulse_us, uint32_t merge_gap_us);
+void IRRecv_disable_filter(IRRecv* irRecv);
+
+/**
+ * Incremental packet decoder.
+ *
+ * IRRecv_begin_packet arms the decoder for a packet of 'bits'
+ * (parity included). Then every measured pulse goes into
+ * IRRecv_feed_pulse, which returns
+ *   IRRECV_NEED_MORE --> keep feeding
+ *   IRRECV_PKT_READY --> the voted packet is in irRecv->packet
+ *   ERROR_*          --> the packet is lost, decoder is re-armed
+ * PULSE_TIMEOUT can be fed as a duration to report a timeout.
+ * IRRecv_feed also gives the low before the pulse, which the
+ * preamble sync needs (IRRecv_feed_pulse takes irRecv->last_low).
+ * IRRecv_feed_run takes raw runs of either level (e.g. from a
+ * software demodulator), through the glitch filter if it's on.
+ *
+ * IRRecv_poll does the feeding from the captured edges without
+ * waiting, so it can be called from the main loop.
+ */
+void IRRecv_begin_packet(IRRecv* irRecv, uint8_t bits);
+int IRRecv_feed_pulse(IRRecv* irRecv, uint32_t duration);
+int IRRecv_feed(IRRecv* irRecv, uint32_t low, uint32_t high);
+int IRRecv_feed_run(IRRecv* irRecv, uint8_t level, uint32_t duration);
+int IRRecv_poll(IRRecv* irRecv);
+
+/**
+ * The least confident bit of the last delivered packet.
+ * --> Bit position, its confidence in *conf (if not NULL).
+ *     -1 if no packet was delivered.
+ */
+int IRRecv_weakest_bit(IRRecv* irRecv, uint8_t* conf);
+
+/**
+ * Link quality.
+ * IRRecv_report_parity --> the protocol tells how the parity of the
+ *                          last packet went, completing its record.
+ * IRRecv_link_quality  --> record of the last packet
+ * IRRecv_link_histogram --> copy of the rolling histograms
+ */
+void IRRecv_report_parity(IRRecv* irRecv, bool passed);
+const LinkQuality* IRRecv_link_quality(IRRecv* irRecv);
+void IRRecv_link_histogram(IRRecv* irRecv, LinkHistogram* hist);
+void IRRecv_reset_link_stats(IRRecv* irRecv);
+
+/**
+ * Duty-cycled listening.
+ *
+ * IRRecv_set_listen sets the period and the window (0 for the
+ * default, PULSES_FOR_LISTEN_WINDOW), and clears irRecv->listen.
+ * The transmitter has to lead with a wake-up train of a period
+ * and a window (send_wakeup_train).
+ *
+ * IRRecv_listen receives a packet as RecvPacket does, but only
+ * looks for a carrier in the windows and sleeps in between.
+ * Once the carrier shows up, it stays awake for the packet.
+ * A command waits a period and a window more, at most.
+ * Always on (RecvPacket) without a listen period.
+ *
+ * sleep_irrecv is the default Sleep hook: idles until the time
+ * is up (wfi on Cortex-M). Plug in the deep sleep of the board,
+ * woken by a timer, for the real savings.
+ *
+ * IRRecv_listen_energy_uj --> energy per received command so far,
+ *                             from the awake and asleep currents
+ *                             (uA) and the supply (mV).
+ */
+void IRRecv_set_listen(IRRecv* irRecv, uint32_t period_us, uint32_t window_us);
+int IRRecv_listen(IRRecv* irRecv, uint64_t* buf, uint8_t bits);
+void sleep_irrecv(IRRecv* irRecv, uint32_t duration);
+uint32_t IRRecv_listen_energy_uj(IRRecv* irRecv, uint32_t active_ua, uint32_t sleep_ua, uint32_t mv);
+
 int recv_irrecv(IRRecv* irRecv);
 uint32_t read_data_irrecv(IRRecv* irRecv, uint8_t bits);
 int recv_packet_irrecv(IRRecv* irRecv, uint64_t* buf, uint8_t bits);
@@ -0,0 +1,96 @@
+/************************************************************
+
+  IR Transmit Schedule for SWIM Project
+
+  Run-length schedule of the LED, (level, carrier cycles).
+
+  Implementation file.
+
+ ************************************************************/
+#include "IRSchedule.h"
+
+#include <string.h>
+
+#define IRSCHED_MIN_CAPACITY   32
+
+int IRSchedule_push(IRSchedule* sched, uint8_t level, uint32_t cycles)
+{
+  uint16_t* grown;
+  uint16_t  last, n;
+
+  while (cycles) {
+
+    /* Same level as the last one: make it longer */
+    if (sched->n_segs) {
+      last = sched->seg[sched->n_segs-1];
+      if (IRSCHED_LEVEL(last) == level && IRSCHED_CYCLES(last) < IRSCHED_CYCLES_MASK) {
+        n = IRSCHED_CYCLES_MASK - IRSCHED_CYCLES(last);
+        if (n > cycles) n = (uint16_t)cycles;
+        sched->seg[sched->n_segs-1] = last + n;
+        cycles -= n;
+        continue;
+      }
+    }
+
+    if (sched->n_segs >= sched->capacity) {
+      if (sched->capacity == 0xFFFF) return -1;
+      n = !sched->capacity ? IRSCHED_MIN_CAPACITY : 
+        (sched->capacity >= 0x8000) ? 0xFFFF : 2*sched->capacity;
+      grown = (uint16_t*)realloc(sched->seg, sizeof(uint16_t)*n);
+      if (!grown) return -1;
+      sched->seg = grown;
+      sched->capacity = n;
+    }
+
+    n = (cycles > IRSCHED_CYCLES_MASK) ? IRSCHED_CYCLES_MASK : (uint16_t)cycles;
+    sched->seg[sched->n_segs++] = (level ? IRSCHED_LEVEL_BIT : 0) | n;
+    cycles -= n;
+  }
+
+  return 0;
+}
+
+void IRSchedule_clear(IRSchedule* sched)
+{
+  sched->n_segs = 0;
+  sched->valid  = false;
+}
+
+uint32_t IRSchedule_cycles(IRSchedule* sched)
+{
+  uint32_t cycles = 0;
+
+  for (uint16_t i=0; i<sched->n_segs; i++) {
+    cycles += IRSCHED_CYCLES(sched->seg[i]);
+  }
+
+  return cycles;
+}
+
+
+/****************************************************
+ *
+ * Constructors and Destructors for IRSchedule
+ *
+ ****************************************************/
+IRSchedule* IRSchedule_create(uint16_t capacity)
+{
+  IRSchedule* sched = (IRSchedule*)malloc(sizeof(IRSchedule));
+
+  memset(sched, 0, sizeof(IRSchedule));
+
+  if (capacity) {
+    sched->seg = (uint16_t*)malloc(sizeof(uint16_t)*capacity);
+    sched->capacity = sched->seg ? capacity : 0;
+  }
+
+  return sched;
+}
+
+void IRSchedule_destroy(IRSchedule* sched)
+{
+  if (sched) {
+    free(sched->seg);
+    free(sched);
+  }
+}
@@ -0,0 +1,102 @@
+/************************************************************
+
+  IR Transmit Schedule for SWIM Project
+
+  A packet, with its sync, copies, gaps and parity, compiled
+  into the run-lengths of the LED: (level, carrier cycles)
+  segments, one uint16_t each.
+
+    high segment --> the carrier, for that many cycles
+    low segment  --> dark, for that many cycles
+
+  The player then only has to toggle the pin on time: no symbol
+  methods, no per-bit decisions, the pin written on the edges
+  only. A packet sent again (a retry, a repeated reply) reuses
+  the schedule as it is.
+
+  Header file.
+
+ ************************************************************/
+#ifndef __IRSCHEDULE_H__
+#define __IRSCHEDULE_H__
+
+/**
+ *
+ * Some basic includes
+ *
+ */
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifndef __cplusplus
+#include "cbool.h"
+#endif
+
+/* Segment: level in the top bit, carrier cycles below */
+#define IRSCHED_LEVEL_BIT      0x8000
+#define IRSCHED_CYCLES_MASK    0x7FFF
+
+#define IRSCHED_LEVEL(seg)     (((seg) & IRSCHED_LEVEL_BIT) ? 1 : 0)
+#define IRSCHED_CYCLES(seg)    ((seg) & IRSCHED_CYCLES_MASK)
+
+/**
+ *
+ * The main struct for IRSchedule
+ *
+ */
+typedef struct __ir_schedule__ {
+
+  uint16_t* seg;
+  uint16_t  n_segs;
+  uint16_t  capacity;
+
+  /* What it was compiled from, to tell if it can be reused */
+  bool      valid;
+  uint64_t  packet;
+  uint8_t   packet_bits;
+  uint8_t   sync_mode;
+  uint8_t   repeat;
+  uint32_t  period;
+
+  uint32_t  n_compiled;
+  uint32_t  n_reused;
+
+} IRSchedule;
+
+/**
+ *
+ * Method definitions for IRSchedule
+ *
+ */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Appends a segment. Runs of the same level are merged.
+ * --> 0, or -1 if it couldn't grow
+ */
+int IRSchedule_push(IRSchedule* sched, uint8_t level, uint32_t cycles);
+
+void IRSchedule_clear(IRSchedule* sched);
+
+/* Total length in carrier cycles */
+uint32_t IRSchedule_cycles(IRSchedule* sched);
+
+/**
+ *
+ * Constructors and Destructors for IRSchedule
+ *
+ * capacity: segments to start with, it grows as needed
+ *
+ */
+IRSchedule* IRSchedule_create(uint16_t capacity);
+
+void IRSchedule_destroy(IRSchedule* sched);
+
+#ifdef __cplusplus
+} /* Matching } for the extern C */
+#endif
+
+
+#endif /* Include Guard */
@@ -92,14 +92,14 @@ int write_ir_pin_irtrans(IRTrans* irTrans, uint8_t logic)
  * Determine parity bit polarity depending on 
  * the packet. Private function.
  *
- * Inputs: packet in uint32_t, # of bits to be actually sent out.
+ * Inputs: packet in uint64_t, # of bits to be actually sent out.
  * Output: Parity polarity. 1 or 0.
  *
  * Basically, if a packet has even number of 1s, parity is 0,
  * odd number of 1, parity is 1.
  *
  */
-int set_parity(uint32_t data, uint8_t bits, uint8_t parity_bits)
+int set_parity(uint64_t data, uint8_t bits, uint8_t parity_bits)
 {
   uint32_t cnt_one = 0;
 
@@ -206,6 +206,43 @@ void send_zero(IRTrans* irTrans)
  * the SWIM protocol documentation.
  * 
  ***************************************/
+/**
+ * The symbol methods are still the ones the schedule is compiled
+ * from: nobody put their own SendOne & co. in
+ */
+static bool default_symbols_irtrans(IRTrans* irTrans)
+{
+  return (irTrans->SendOne  == &(send_one) &&
+          irTrans->SendZero == &(send_zero) &&
+          irTrans->SendGap  == &(send_gap) &&
+          irTrans->SendHeader == ((irTrans->sync_mode == SYNC_PREAMBLE) ?
+            &(send_preamble) : &(send_header)));
+}
+
+/**
+ * The packet a symbol at a time, through the symbol methods
+ */
+static void send_symbols_irtrans(IRTrans* irTrans, uint8_t packet_bits, uint64_t packet)
+{
+  uint64_t data_to_send = IRTrans_frame(irTrans, packet_bits, packet);
+
+  /* Sending the start bit */
+  irTrans->SendHeader(irTrans);
+
+  for (int repeat=0; repeat<irTrans->repeat; repeat++) {
+    /* Sending the actual packet */
+    for (int i=packet_bits; i>=0; i--) {
+      ( (data_to_send>>i) & 0x1 ) ? \
+        irTrans->SendOne(irTrans) : irTrans->SendZero(irTrans); 
+    }
+
+    /* Sending the 'Gap' bit */
+    if (repeat < irTrans->repeat-1) {
+      irTrans->SendGap(irTrans);
+    }
+  }
+}
+
 /**
  * 
  * send_packet
@@ -213,40 +250,164 @@ void send_zero(IRTrans* irTrans)
  * Sends the packet with designated bits.
  * Also includes the parity.
  *
+ * The packet is compiled into irTrans->schedule first (unless
+ * it's the one already there) and played from it. With any of
+ * SendOne, SendZero, SendHeader or SendGap replaced, or no
+ * memory for the schedule, it's sent through the symbol methods
+ * instead, as it used to be (and counted in n_symbol_sends).
+ *
  */
 void send_packet(IRTrans* irTrans, uint8_t packet_bits, uint64_t packet) 
 {
-  uint64_t data_to_send = 0;
-  int      parity;
+  IRSchedule* sched = irTrans->schedule;
 
-  uint64_t mask = 0;
-  for (int i=0; i<packet_bits; ++i) {
-    mask += (1<<i);
+  if (!default_symbols_irtrans(irTrans)) {
+    irTrans->n_symbol_sends++;
+    send_symbols_irtrans(irTrans, packet_bits, packet);
+    return;
   }
 
-  /* Extend the data bits with parity bits */
-  parity = set_parity(
-    mask & packet, packet_bits, irTrans->irComm->parity_bits);
-  data_to_send = \
-    ((mask & packet) << irTrans->irComm->parity_bits) | (uint64_t)parity;
+  if (IRTrans_schedule_matches(irTrans, sched, packet_bits, packet)) {
+    sched->n_reused++;
+  }
+  else if (IRTrans_compile(irTrans, sched, packet_bits, packet) != 0) {
+    /* Out of memory: not played, but not lost either */
+    irTrans->n_symbol_sends++;
+    send_symbols_irtrans(irTrans, packet_bits, packet);
+    return;
+  }
 
-  /* Sending the start bit */
-  irTrans->SendHeader(irTrans);
+  IRTrans_play(irTrans, sched);
+}
+
+/**
+ * 
+ * IRTrans_compile
+ *
+ * The symbols of send_one, send_zero, send_header (or
+ * send_preamble) and send_gap, as schedule segments.
+ *
+ */
+int IRTrans_compile(IRTrans* irTrans, IRSchedule* sched, uint8_t packet_bits, uint64_t packet)
+{
+  static const uint8_t pattern[PREAMBLE_RUNS] = PREAMBLE_PATTERN;
+
+  uint64_t data_to_send = IRTrans_frame(irTrans, packet_bits, packet);
+  int      err = 0;
+
+  IRSchedule_clear(sched);
+
+  /* The start bit */
+  if (irTrans->sync_mode == SYNC_PREAMBLE) {
+    for (int i=0; i<PREAMBLE_RUNS; i+=2) {
+      err |= IRSchedule_push(sched, 1, pattern[i]*PULSES_FOR_PREAMBLE_UNIT);
+      err |= IRSchedule_push(sched, 0, pattern[i+1]*PULSES_FOR_PREAMBLE_UNIT);
+    }
+  }
+  else {
+    err |= IRSchedule_push(sched, 1, irTrans->pulses_header_one);
+    err |= IRSchedule_push(sched, 0, irTrans->pulses_header_empty);
+  }
 
   for (int repeat=0; repeat<irTrans->repeat; repeat++) {
-    /* Sending the actual packet */
+    /* The actual packet */
     for (int i=packet_bits; i>=0; i--) {
-      ( (data_to_send>>i) & 0x1 ) ? \
-        irTrans->SendOne(irTrans) : irTrans->SendZero(irTrans); 
+      err |= IRSchedule_push(sched, 1, 
+        ((data_to_send>>i) & 0x1) ? irTrans->pulses_one : irTrans->pulses_zero);
+      err |= IRSchedule_push(sched, 0, irTrans->pulses_empty);
     }
 
-    /* Sending the 'Gap' bit */
+    /* The 'Gap' bit */
     if (repeat < irTrans->repeat-1) {
-      irTrans->SendGap(irTrans);
+      err |= IRSchedule_push(sched, 1, irTrans->pulses_gap);
+      err |= IRSchedule_push(sched, 0, irTrans->pulses_empty);
+    }
+  }
+
+  if (err) {
+    IRSchedule_clear(sched);
+    return -1;
+  }
+
+  sched->valid       = true;
+  sched->packet      = data_to_send;
+  sched->packet_bits = packet_bits;
+  sched->sync_mode   = irTrans->sync_mode;
+  sched->repeat      = irTrans->repeat;
+  sched->period      = irTrans->irComm->period;
+  sched->n_compiled++;
+
+  return 0;
+}
+
+bool IRTrans_schedule_matches(IRTrans* irTrans, IRSchedule* sched, uint8_t packet_bits, uint64_t packet)
+{
+  return (sched->valid &&
+          sched->packet_bits == packet_bits &&
+          sched->sync_mode   == irTrans->sync_mode &&
+          sched->repeat      == irTrans->repeat &&
+          sched->period      == irTrans->irComm->period &&
+          sched->packet      == IRTrans_frame(irTrans, packet_bits, packet));
+}
+
+/**
+ * 
+ * IRTrans_play
+ *
+ * The pin is only written on the edges. High segments are
+ * carrier cycles of high_period on, low segments just a wait.
+ *
+ */
+void IRTrans_play(IRTrans* irTrans, IRSchedule* sched)
+{
+  int      (*write)(IRTrans*, uint8_t) = irTrans->WriteIRPin;
+  uint32_t period = irTrans->irComm->period;
+  uint32_t high   = irTrans->high_period;
+  uint32_t t, cycles;
+  uint16_t seg;
+
+  t = micros();
+
+  for (uint16_t i=0; i<sched->n_segs; i++) {
+    seg    = sched->seg[i];
+    cycles = IRSCHED_CYCLES(seg);
+
+    if (IRSCHED_LEVEL(seg)) {
+      while (cycles--) {
+        write(irTrans, 1);
+        while (micros() - t <= high);
+        write(irTrans, 0);
+
+        t += period;
+        while ((int32_t)(micros() - t) < 0);
+      }
+    }
+    else {
+      t += cycles*period;
+      while ((int32_t)(micros() - t) < 0);
     }
   }
 }
 
+/**
+ * IRTrans_frame
+ *
+ * The data bits extended with the parity bits, as send_packet
+ * puts them on air (bit packet_bits first, down to bit 0).
+ *
+ */
+uint64_t IRTrans_frame(IRTrans* irTrans, uint8_t packet_bits, uint64_t packet)
+{
+  int      parity;
+  uint64_t mask = (packet_bits >= 64) ? ~(uint64_t)0 : (((uint64_t)1<<packet_bits) - 1);
+
+  /* Extend the data bits with parity bits */
+  parity = set_parity(
+    mask & packet, packet_bits, irTrans->irComm->parity_bits);
+
+  return ((mask & packet) << irTrans->irComm->parity_bits) | (uint64_t)parity;
+}
+
 /**
  * send_header
  * 
@@ -262,6 +423,26 @@ void send_header(IRTrans* irTrans)
   send_bit(irTrans, irTrans->pulses_header_one, irTrans->pulses_header_empty);
 }
 
+/**
+ * send_preamble
+ * 
+ * Send the short preamble instead of the header.
+ * 
+ * The signal will be compsed of (in PULSES_FOR_PREAMBLE_UNIT)
+ * <-1-><-1-><-1-><-1-><---2---><-1->
+ * _-_-_____-_-_____-_-_-_-_-_______
+ *  
+ */
+void send_preamble(IRTrans* irTrans)
+{
+  static const uint8_t pattern[PREAMBLE_RUNS] = PREAMBLE_PATTERN;
+
+  for (int i=0; i<PREAMBLE_RUNS; i+=2) {
+    send_bit(irTrans, 
+      pattern[i]*PULSES_FOR_PREAMBLE_UNIT, pattern[i+1]*PULSES_FOR_PREAMBLE_UNIT);
+  }
+}
+
 /**
  * send_gap
  * 
@@ -277,6 +458,28 @@ void send_gap(IRTrans* irTrans)
   send_bit(irTrans, irTrans->pulses_gap, irTrans->pulses_empty);
 }
 
+/**
+ * send_wakeup_train
+ * 
+ * Send zeros for a whole listen period (and window) of the
+ * receiver, so it catches one while it's awake.
+ * 
+ * The signal will be compsed of
+ * <-ONE-><--EMPTY--><-ONE-><--EMPTY-->     ...
+ * _-_-_-____________-_-_-_____________     ...
+ *  
+ */
+void send_wakeup_train(IRTrans* irTrans, uint32_t duration)
+{
+  uint32_t symbol = \
+    (PULSES_FOR_WAKEUP_ONE + PULSES_FOR_WAKEUP_EMPTY) * irTrans->irComm->period;
+  uint32_t n = (duration + symbol - 1) / symbol;
+
+  for (uint32_t i=0; i<n; i++) {
+    send_bit(irTrans, PULSES_FOR_WAKEUP_ONE, PULSES_FOR_WAKEUP_EMPTY);
+  }
+}
+
 /***************************************
  
   Basic access interfaces for IRTrans
@@ -295,6 +498,13 @@ uint8_t get_ir_pin(IRTrans* irTrans)
   return irTrans->irComm->IR_Pin;
 }
 
+void IRTrans_set_sync_mode(IRTrans* irTrans, uint8_t sync_mode)
+{
+  irTrans->sync_mode  = sync_mode;
+  irTrans->SendHeader = (sync_mode == SYNC_PREAMBLE) ? 
+    &(send_preamble) : &(send_header);
+}
+
 /***************************************
   
   Constructors and destructors for 
@@ -326,6 +536,9 @@ IRTrans* IRTrans_create(int ir_pin)
   irTrans->GetIRPin   = &(get_ir_pin);
 
   irTrans->repeat     = PACKET_REPEAT;
+  irTrans->sync_mode  = SYNC_HEADER;
+  irTrans->schedule   = IRSchedule_create(0);
+  irTrans->n_symbol_sends = 0;
 
   irTrans->CalcPeriod(irTrans);
   return irTrans;
@@ -355,5 +568,6 @@ void IRTrans_destroy(IRTrans* irTrans)
     if(!irTrans) return;
 
     if (irTrans->irComm) IRComm_destroy(irTrans->irComm);
+    IRSchedule_destroy(irTrans->schedule);
     free(irTrans);
 }
\ No newline at end of file
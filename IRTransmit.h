@@ -33,6 +33,9 @@
  ******************************/
 #include "IRComm.h"
 
+/* Run-length schedule the packets are compiled into */
+#include "IRSchedule.h"
+
 /**
  * 
  * The main struct for IRComm
@@ -51,6 +54,10 @@ typedef struct __ir_transmit__ {
   uint32_t pulses_gap;
 
   uint8_t  repeat;
+  uint8_t  sync_mode;   // SYNC_HEADER or SYNC_PREAMBLE
+
+  IRSchedule* schedule; // Last packet sent, reused if it's sent again
+  uint32_t n_symbol_sends; // Packets send_packet sent through SendOne & co. instead
 
   void (*CalcPeriod)(struct __ir_transmit__*);
   void (*Init)(struct __ir_transmit__*);
@@ -83,19 +90,51 @@ void init_irtrans(IRTrans* irTrans);
 
 int  write_ir_pin_irtrans(IRTrans* irTrans, uint8_t);
 
-int set_parity(uint32_t data, uint8_t bits, uint8_t parity_bits);
+int set_parity(uint64_t data, uint8_t bits, uint8_t parity_bits);
 
 void send_bit(IRTrans* irTrans, uint32_t high_cnt, uint32_t low_cnt);
 void send_one(IRTrans* irTrans);
 void send_zero(IRTrans* irTrans);
 void send_packet(IRTrans* irTrans, uint8_t packet_bits, uint64_t packet);
+uint64_t IRTrans_frame(IRTrans* irTrans, uint8_t packet_bits, uint64_t packet);
+
+/**
+ * Packet compiled into a schedule, exactly as send_packet sends
+ * it: sync, copies, gaps and parity. From the default symbols:
+ * SendOne, SendZero, SendHeader and SendGap aren't called, and
+ * send_packet only uses it while they're the defaults.
+ * --> 0, or -1 if the schedule couldn't grow
+ */
+int IRTrans_compile(IRTrans* irTrans, IRSchedule* sched, uint8_t packet_bits, uint64_t packet);
+
+/* The schedule still holds this packet, as it would be compiled now */
+bool IRTrans_schedule_matches(IRTrans* irTrans, IRSchedule* sched, uint8_t packet_bits, uint64_t packet);
+
+/**
+ * Plays the schedule on the pin. The cycles are timed from the
+ * start of the schedule, so a late edge doesn't push the rest.
+ */
+void IRTrans_play(IRTrans* irTrans, IRSchedule* sched);
 void send_header(IRTrans* irTrans);
+void send_preamble(IRTrans* irTrans);
 void send_gap(IRTrans* irTrans);
 
+/**
+ * Wake-up train for a duty-cycled receiver, at least 'duration'
+ * us long. Send it right before the packet.
+ */
+void send_wakeup_train(IRTrans* irTrans, uint32_t duration);
+
 uint32_t get_period_irtrans(IRTrans* irTrans);
 uint32_t get_mod_freq(IRTrans* irTrans);
 uint8_t get_ir_pin(IRTrans* irTrans);
 
+/**
+ * Frame sync of the packets: SYNC_HEADER (default) or SYNC_PREAMBLE.
+ * The receiver has to be set the same way.
+ */
+void IRTrans_set_sync_mode(IRTrans* irTrans, uint8_t sync_mode);
+
 /***************************************
  * 
  * Constructors and destructors for 
@@ -0,0 +1,256 @@
+/************************************************************
+
+  IR Transmit Queue for SWIM Project
+
+  Packets sent in the background, a tick at a time.
+
+  Implementation file.
+
+ ************************************************************/
+#include "IRTxQueue.h"
+
+#include <string.h>
+
+/* Detect Arduino */
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#else
+//#include "WProgram.h"
+#endif
+
+/* Segments of a 64 bit packet with its copies, so the tick never allocates */
+#define IRTXQ_SCHED_CAPACITY(repeat)   (PREAMBLE_RUNS + 2 + (repeat)*2*66)
+
+/**
+ * Next segment of the packet on air
+ * --> false when the packet is over
+ */
+static bool load_segment_irtxq(IRTxQueue* txq)
+{
+  uint16_t seg;
+
+  if (txq->seg >= txq->sched->n_segs) return false;
+
+  seg = txq->sched->seg[txq->seg++];
+  txq->seg_level   = IRSCHED_LEVEL(seg);
+  txq->cycles_left = IRSCHED_CYCLES(seg);
+
+  return true;
+}
+
+/**
+ * Puts the oldest packet on air.
+ * --> false if it couldn't be compiled (and was dropped)
+ */
+static bool start_packet_irtxq(IRTxQueue* txq, uint32_t now_us)
+{
+  uint8_t    tail = atomic_load_explicit(&txq->tail, memory_order_relaxed);
+  IRTxEntry* e = &(txq->entry[tail & txq->mask]);
+  IRTrans*   irTrans = txq->irTrans;
+
+  /* The done callback gets it as it was sent */
+  if (e->fill) e->packet = e->fill(e->ctx, e->packet);
+
+  if (!IRTrans_schedule_matches(irTrans, txq->sched, e->packet_bits, e->packet)) {
+    if (IRTrans_compile(irTrans, txq->sched, e->packet_bits, e->packet) != 0) return false;
+  }
+  else {
+    txq->sched->n_reused++;
+  }
+
+  /**
+   * Right after the last one, unless the queue ran dry in between:
+   * next_us is then as old as the idle time, too old to compare
+   * once that's past 2^31 us (or never set, on the first packet).
+   */
+  if (txq->dry || (int32_t)(now_us - txq->next_us) > (int32_t)irTrans->irComm->period) {
+    txq->next_us = now_us;
+    txq->dry     = false;
+  }
+
+  txq->seg    = 0;
+  txq->pin    = 0;
+  txq->active = load_segment_irtxq(txq);
+
+  return true;
+}
+
+/* Takes the oldest packet off the queue and tells the caller */
+static void finish_packet_irtxq(IRTxQueue* txq, int status)
+{
+  uint8_t   tail = atomic_load_explicit(&txq->tail, memory_order_relaxed);
+  IRTxEntry e = txq->entry[tail & txq->mask];
+
+  txq->active = false;
+
+  /* The entry is copied out before it's handed back to push */
+  tail++;
+  atomic_store_explicit(&txq->tail, tail, memory_order_release);
+  if (atomic_load_explicit(&txq->head, memory_order_acquire) == tail) txq->dry = true;
+
+  if (status == IRTXQ_SUCCESS) txq->n_sent++;
+  else txq->n_failed++;
+
+  if (e.done) e.done(e.ctx, e.packet, status);
+}
+
+int IRTxQueue_push(IRTxQueue* txq, uint8_t packet_bits, uint64_t packet, IRTxDone done, void* ctx)
+{
+  return IRTxQueue_push_fill(txq, packet_bits, packet, NULL, done, ctx);
+}
+
+int IRTxQueue_push_fill(IRTxQueue* txq, uint8_t packet_bits, uint64_t packet,
+  IRTxFill fill, IRTxDone done, void* ctx)
+{
+  uint8_t    head = atomic_load_explicit(&txq->head, memory_order_relaxed);
+  uint8_t    tail = atomic_load_explicit(&txq->tail, memory_order_acquire);
+  IRTxEntry* e;
+
+  if ((uint8_t)(head - tail) > txq->mask) return IRTXQ_FULL;
+
+  e = &(txq->entry[head & txq->mask]);
+  e->packet      = packet;
+  e->packet_bits = packet_bits;
+  e->fill        = fill;
+  e->done        = done;
+  e->ctx         = ctx;
+
+  /* Published last, the tick may pick it up right away */
+  atomic_store_explicit(&txq->head, (uint8_t)(head + 1), memory_order_release);
+
+  return IRTXQ_SUCCESS;
+}
+
+uint8_t IRTxQueue_depth(IRTxQueue* txq)
+{
+  uint8_t tail = atomic_load_explicit(&txq->tail, memory_order_acquire);
+  uint8_t head = atomic_load_explicit(&txq->head, memory_order_acquire);
+
+  return (uint8_t)(head - tail);
+}
+
+uint8_t IRTxQueue_room(IRTxQueue* txq)
+{
+  return (uint8_t)(txq->mask - IRTxQueue_depth(txq) + 1);
+}
+
+uint32_t IRTxQueue_tick(IRTxQueue* txq, uint32_t now_us)
+{
+  IRTrans* irTrans = txq->irTrans;
+  uint32_t period  = irTrans->irComm->period;
+  uint32_t late, n, wait;
+
+  /* Claimed in one step: a tick coming in between can't get it too */
+  if (atomic_exchange_explicit(&txq->in_tick, 1, memory_order_acquire)) return IRTXQ_RETRY_US;
+
+  for (;;) {
+
+    if (!txq->active) {
+      if (atomic_load_explicit(&txq->head, memory_order_acquire) ==
+          atomic_load_explicit(&txq->tail, memory_order_relaxed)) {
+        wait = IRTXQ_IDLE;
+        break;
+      }
+      if (!start_packet_irtxq(txq, now_us)) {
+        finish_packet_irtxq(txq, IRTXQ_FAILED);
+        continue;
+      }
+      if (!txq->active) {
+        finish_packet_irtxq(txq, IRTXQ_SUCCESS);
+        continue;
+      }
+    }
+
+    if ((int32_t)(now_us - txq->next_us) < 0) {
+      wait = txq->next_us - now_us;
+      break;
+    }
+
+    /* The edge at next_us is due */
+    if (txq->seg_level) {
+      if (txq->pin) {
+        irTrans->WriteIRPin(irTrans, 0);
+        txq->pin = 0;
+        txq->next_us = txq->cycle_us + period;
+        txq->cycles_left--;
+        continue;
+      }
+
+      if (txq->cycles_left) {
+        /* Too late for this one's on time: left dark, the rest stays on time */
+        late = now_us - txq->next_us;
+        if (late > irTrans->high_period) {
+          n = late / period + 1;
+          if (n > txq->cycles_left) n = txq->cycles_left;
+          txq->next_us     += n*period;
+          txq->cycles_left -= n;
+          txq->n_skipped   += n;
+          continue;
+        }
+
+        /* On while <= high_period, as IRTrans_play */
+        irTrans->WriteIRPin(irTrans, 1);
+        txq->pin      = 1;
+        txq->cycle_us = txq->next_us;
+        txq->next_us  = txq->cycle_us + irTrans->high_period + 1;
+        continue;
+      }
+    }
+    else if (txq->cycles_left) {
+      txq->next_us += txq->cycles_left * period;
+      txq->cycles_left = 0;
+      continue;
+    }
+
+    /* Segment over */
+    if (!load_segment_irtxq(txq)) {
+      finish_packet_irtxq(txq, IRTXQ_SUCCESS);
+    }
+  }
+
+  atomic_store_explicit(&txq->in_tick, 0, memory_order_release);
+  return wait;
+}
+
+void IRTxQueue_flush(IRTxQueue* txq)
+{
+  while (IRTxQueue_tick(txq, micros()) != IRTXQ_IDLE);
+}
+
+
+/****************************************************
+ *
+ * Constructors and Destructors for IRTxQueue
+ *
+ ****************************************************/
+IRTxQueue* IRTxQueue_create(IRTrans* irTrans, uint8_t depth)
+{
+  IRTxQueue* txq = (IRTxQueue*)malloc(sizeof(IRTxQueue));
+  uint8_t    size = 1;
+
+  memset(txq, 0, sizeof(IRTxQueue));
+
+  if (depth > IRTXQ_MAX_DEPTH) depth = IRTXQ_MAX_DEPTH;
+  while (size < depth) size <<= 1;
+
+  txq->irTrans = irTrans;
+  txq->entry   = (IRTxEntry*)malloc(sizeof(IRTxEntry)*size);
+  txq->mask    = size - 1;
+  txq->sched   = IRSchedule_create(IRTXQ_SCHED_CAPACITY(irTrans->repeat));
+  txq->dry     = true;
+
+  atomic_init(&txq->head, 0);
+  atomic_init(&txq->tail, 0);
+  atomic_init(&txq->in_tick, 0);
+
+  return txq;
+}
+
+void IRTxQueue_destroy(IRTxQueue* txq)
+{
+  if (txq) {
+    IRSchedule_destroy(txq->sched);
+    free(txq->entry);
+    free(txq);
+  }
+}
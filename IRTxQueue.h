@@ -0,0 +1,169 @@
+/************************************************************
+
+  IR Transmit Queue for SWIM Project
+
+  send_packet blocks for the whole packet: tens of ms for a
+  17 bit packet with its copies. The queue sends them in the
+  background instead:
+
+    IRTxQueue_push --> the packet is queued, returns right away
+    IRTxQueue_tick --> steps the packet on air through its
+                       schedule (IRSchedule.h), writing the pin
+                       on the edges that are due by now_us
+
+  The tick returns how long until the next edge, so it can run
+  from a one-shot timer interrupt that rearms itself with that,
+  or be polled from the main loop. It doesn't read the clock
+  itself: the host builds drive it with a simulated one.
+
+  One producer (push) and one ticking context, as in SPSCFIFO:
+  each index is written by one side only, published with a
+  release store and read with an acquire load. A tick that
+  interrupts another one returns right away.
+
+  Header file.
+
+ ************************************************************/
+#ifndef __IRTXQUEUE_H__
+#define __IRTXQUEUE_H__
+
+/**
+ *
+ * Some basic includes
+ *
+ */
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "IRTransmit.h"
+
+#ifdef __cplusplus
+#include <atomic>
+typedef std::atomic<uint8_t> irtxq_index_t;
+#else
+#include <stdatomic.h>
+typedef _Atomic uint8_t irtxq_index_t;
+#endif
+
+/* Status codes */
+#define IRTXQ_SUCCESS          0
+#define IRTXQ_FULL             -1
+#define IRTXQ_FAILED           -2      /* Couldn't be compiled, not sent */
+
+#define IRTXQ_MAX_DEPTH        128
+
+/* What IRTxQueue_tick returns with nothing to send */
+#define IRTXQ_IDLE             0xFFFFFFFF
+
+/* ... and when it interrupted another tick: try again this soon */
+#ifndef IRTXQ_RETRY_US
+#define IRTXQ_RETRY_US         2
+#endif
+
+/**
+ * Called once a packet is out (IRTXQ_SUCCESS) or dropped
+ * (IRTXQ_FAILED). Runs in the ticking context: keep it short.
+ */
+typedef void (*IRTxDone)(void* ctx, uint64_t packet, int status);
+
+/**
+ * Called as the packet is taken off the queue, before it's
+ * compiled: gives back the packet to send, with whatever is
+ * only known then (e.g. a time) filled in. Ticking context too.
+ */
+typedef uint64_t (*IRTxFill)(void* ctx, uint64_t packet);
+
+typedef struct __ir_tx_entry__ {
+  uint64_t packet;
+  uint8_t  packet_bits;
+  IRTxFill fill;
+  IRTxDone done;
+  void*    ctx;
+} IRTxEntry;
+
+/**
+ *
+ * The main struct for IRTxQueue
+ *
+ */
+typedef struct __ir_tx_queue__ {
+
+  IRTrans*   irTrans;
+
+  IRTxEntry* entry;
+  uint8_t    mask;                // Depth - 1, a power of two
+  irtxq_index_t head;             // Written by push only
+  irtxq_index_t tail;             // Written by tick only
+
+  /* The packet on air */
+  IRSchedule* sched;
+  bool       active;
+  uint16_t   seg;                 // Next segment
+  uint8_t    seg_level;
+  uint16_t   cycles_left;         // Of the current segment
+  uint8_t    pin;                 // Level written last
+  uint32_t   cycle_us;            // Start of the current carrier cycle
+  uint32_t   next_us;             // Next edge
+  bool       dry;                 // Queue emptied since, next_us is stale
+  irtxq_index_t in_tick;
+
+  uint32_t   n_sent;
+  uint32_t   n_failed;
+  uint32_t   n_skipped;           // Carrier cycles left dark, the tick came too late
+
+} IRTxQueue;
+
+/**
+ *
+ * Method definitions for IRTxQueue
+ *
+ */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Queues a packet, framed as send_packet does. 'done' may be NULL.
+ * It's played from IRTrans_compile: replaced symbol methods
+ * (SendOne & co.) aren't called from the tick.
+ * --> IRTXQ_SUCCESS, or IRTXQ_FULL
+ */
+int IRTxQueue_push(IRTxQueue* txq, uint8_t packet_bits, uint64_t packet, IRTxDone done, void* ctx);
+
+/* Same, 'fill' (may be NULL) gets the packet as it goes on air */
+int IRTxQueue_push_fill(IRTxQueue* txq, uint8_t packet_bits, uint64_t packet,
+  IRTxFill fill, IRTxDone done, void* ctx);
+
+/* Packets not out yet, the one on air included */
+uint8_t IRTxQueue_depth(IRTxQueue* txq);
+
+/* Packets that can still be pushed */
+uint8_t IRTxQueue_room(IRTxQueue* txq);
+
+/**
+ * Writes the edges due by now_us.
+ * --> us until the next one, IRTXQ_IDLE if the queue is empty
+ */
+uint32_t IRTxQueue_tick(IRTxQueue* txq, uint32_t now_us);
+
+/* Ticks from micros() until the queue is empty */
+void IRTxQueue_flush(IRTxQueue* txq);
+
+/**
+ *
+ * Constructors and Destructors for IRTxQueue
+ *
+ * depth: packets it holds, rounded up to a power of two
+ * The IRTrans stays the caller's.
+ *
+ */
+IRTxQueue* IRTxQueue_create(IRTrans* irTrans, uint8_t depth);
+
+void IRTxQueue_destroy(IRTxQueue* txq);
+
+#ifdef __cplusplus
+} /* Matching } for the extern C */
+#endif
+
+
+#endif /* Include Guard */
@@ -0,0 +1,170 @@
+/************************************************************
+
+  A lock-free FIFO for SWIM-SnH
+
+  Single-producer/single-consumer variant of the FIFO. Meant
+  for handing raw ADC data from an interrupt handler, or from
+  the RP2040's core1, over to the context that drains it.
+
+  Implementation file
+
+ ************************************************************/
+#include "SPSCFIFO.h"
+
+/*************************************************************
+
+  Producer side
+
+**************************************************************/
+
+uint32_t SPSCFIFO_reserve(SPSCFIFO* fifo, fifo_data_t** span, uint32_t n)
+{
+  uint32_t head = atomic_load_explicit(&fifo->head, memory_order_relaxed);
+  uint32_t free_n, to_end;
+
+  /* Only refresh the tail from the consumer's cache line when needed */
+  free_n = fifo->capacity - (head - fifo->tail_cache);
+  if (free_n < n) {
+    fifo->tail_cache = atomic_load_explicit(&fifo->tail, memory_order_acquire);
+    free_n = fifo->capacity - (head - fifo->tail_cache);
+  }
+
+  to_end = fifo->capacity - (head & fifo->mask);
+  if (n > free_n) n = free_n;
+  if (n > to_end) n = to_end;
+
+  (*span) = &(fifo->buf[head & fifo->mask]);
+  return n;
+}
+
+void SPSCFIFO_commit(SPSCFIFO* fifo, uint32_t n)
+{
+  uint32_t head = atomic_load_explicit(&fifo->head, memory_order_relaxed);
+  atomic_store_explicit(&fifo->head, head + n, memory_order_release);
+}
+
+int push_spsc_fifo(SPSCFIFO* fifo, fifo_data_t data)
+{
+  fifo_data_t* span;
+
+  if (!SPSCFIFO_reserve(fifo, &span, 1)) {
+    fifo->n_rejected++;
+    return SPSC_FULL;
+  }
+
+  (*span) = data;
+  SPSCFIFO_commit(fifo, 1);
+
+  return SPSC_SUCCESS;
+}
+
+/*************************************************************
+
+  Consumer side
+
+**************************************************************/
+
+uint32_t SPSCFIFO_peek(SPSCFIFO* fifo, const fifo_data_t** span, uint32_t n)
+{
+  uint32_t tail = atomic_load_explicit(&fifo->tail, memory_order_relaxed);
+  uint32_t avail, to_end;
+
+  avail = fifo->head_cache - tail;
+  if (avail < n) {
+    fifo->head_cache = atomic_load_explicit(&fifo->head, memory_order_acquire);
+    avail = fifo->head_cache - tail;
+  }
+
+  to_end = fifo->capacity - (tail & fifo->mask);
+  if (n > avail) n = avail;
+  if (n > to_end) n = to_end;
+
+  (*span) = &(fifo->buf[tail & fifo->mask]);
+  return n;
+}
+
+void SPSCFIFO_release(SPSCFIFO* fifo, uint32_t n)
+{
+  uint32_t tail = atomic_load_explicit(&fifo->tail, memory_order_relaxed);
+  atomic_store_explicit(&fifo->tail, tail + n, memory_order_release);
+}
+
+int pop_spsc_fifo(SPSCFIFO* fifo, fifo_data_t* data)
+{
+  const fifo_data_t* span;
+
+  if (!SPSCFIFO_peek(fifo, &span, 1)) {
+    return SPSC_EMPTY;
+  }
+
+  (*data) = (*span);
+  SPSCFIFO_release(fifo, 1);
+
+  return SPSC_SUCCESS;
+}
+
+uint32_t SPSCFIFO_count(SPSCFIFO* fifo)
+{
+  uint32_t tail = atomic_load_explicit(&fifo->tail, memory_order_acquire);
+  uint32_t head = atomic_load_explicit(&fifo->head, memory_order_acquire);
+
+  return head - tail;
+}
+
+uint32_t SPSCFIFO_drain(SPSCFIFO* fifo, FIFO* dest)
+{
+  const fifo_data_t* span;
+  uint32_t n, pass;
+  uint32_t moved = 0;
+
+  /* At most two spans: up to the end of the buffer, then from the start */
+  for (pass=0; pass<2; pass++) {
+    n = SPSCFIFO_peek(fifo, &span, fifo->capacity);
+    if (!n) break;
+
+    FIFO_push_n(dest, span, n);
+    SPSCFIFO_release(fifo, n);
+    moved += n;
+  }
+
+  return moved;
+}
+
+/*************************************************************
+
+  Constructors and destructors
+
+**************************************************************/
+
+SPSCFIFO* SPSCFIFO_create(uint32_t fifo_depth)
+{
+  /* Line aligned, or the padding doesn't separate anything. aligned_alloc wants a multiple of it */
+  size_t    size = (sizeof(SPSCFIFO) + SPSC_CACHE_LINE - 1) & ~(size_t)(SPSC_CACHE_LINE - 1);
+  SPSCFIFO* fifo = (SPSCFIFO*)aligned_alloc(SPSC_CACHE_LINE, size);
+  uint32_t  cap = 1;
+
+  while (cap < fifo_depth) cap <<= 1;
+
+  atomic_init(&fifo->head, 0);
+  atomic_init(&fifo->tail, 0);
+  fifo->tail_cache = 0;
+  fifo->head_cache = 0;
+  fifo->n_rejected = 0;
+
+  fifo->capacity = cap;
+  fifo->mask     = cap - 1;
+  fifo->buf      = (fifo_data_t*)malloc(sizeof(fifo_data_t)*cap);
+
+  fifo->Push     = &(push_spsc_fifo);
+  fifo->Pop      = &(pop_spsc_fifo);
+
+  return fifo;
+}
+
+void SPSCFIFO_destroy(SPSCFIFO* fifo)
+{
+  if (fifo) {
+    if (fifo->buf) free(fifo->buf);
+    free(fifo);
+  }
+}
@@ -0,0 +1,135 @@
+/************************************************************
+
+  A lock-free FIFO for SWIM-SnH
+
+  Single-producer/single-consumer variant of the FIFO. Meant
+  for handing raw ADC data from an interrupt handler, or from
+  the RP2040's core1, over to the context that drains it
+  (e.g. senddata_swim_protocol on core0).
+
+  Only the producer writes 'head' and only the consumer writes
+  'tail'. The indices are published with release stores and
+  read with acquire loads, so no locks and no atomic
+  read-modify-write instructions are needed. (Cortex-M0+ does
+  not have them anyway.)
+
+  Unlike the FIFO, a full SPSCFIFO rejects the new entry:
+  the producer is not allowed to move the consumer's tail.
+
+  Header file
+
+ ************************************************************/
+#ifndef __SWIM_SNH_SPSC_FIFO_H__
+#define __SWIM_SNH_SPSC_FIFO_H__
+
+/**
+ Some standard includes
+ */
+#include <stdlib.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+#include <atomic>
+typedef std::atomic<uint32_t> spsc_index_t;
+#else
+#include <stdatomic.h>
+#include "cbool.h"
+typedef _Atomic uint32_t spsc_index_t;
+#endif
+
+/* fifo_data_t and the FIFO to drain into */
+#include "FIFO.h"
+
+/**
+ Producer and consumer counters are kept on separate cache
+ lines so that the two sides don't keep stealing the line
+ from each other. RP2040 has no data cache, but the host
+ builds do. SPSCFIFO_create allocates the struct line aligned.
+ */
+#ifndef SPSC_CACHE_LINE
+#define SPSC_CACHE_LINE              64
+#endif
+
+/* Status codes */
+#define SPSC_SUCCESS                 0
+#define SPSC_FULL                    -1
+#define SPSC_EMPTY                   -2
+
+/**
+ The SPSC FIFO
+ */
+typedef struct __spsc_fifo__ {
+
+  /* Producer side */
+  spsc_index_t head;               /* Write counter, written by the producer only */
+  uint32_t     tail_cache;         /* Producer's last seen copy of tail */
+  uint32_t     n_rejected;         /* Pushes rejected because the FIFO was full */
+  uint8_t      pad_producer[SPSC_CACHE_LINE - 3*sizeof(uint32_t)];
+
+  /* Consumer side */
+  spsc_index_t tail;               /* Read counter, written by the consumer only */
+  uint32_t     head_cache;         /* Consumer's last seen copy of head */
+  uint8_t      pad_consumer[SPSC_CACHE_LINE - 2*sizeof(uint32_t)];
+
+  /* Read-only after SPSCFIFO_create */
+  uint32_t     capacity;           /* Power of two */
+  uint32_t     mask;
+  fifo_data_t* buf;
+
+  int (*Push)(struct __spsc_fifo__*, fifo_data_t data);
+  int (*Pop)(struct __spsc_fifo__*, fifo_data_t* data);
+
+} SPSCFIFO;
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ Single entry access.
+ Producer: push_spsc_fifo --> SPSC_SUCCESS or SPSC_FULL
+ Consumer: pop_spsc_fifo  --> SPSC_SUCCESS or SPSC_EMPTY
+ */
+int push_spsc_fifo(SPSCFIFO* fifo, fifo_data_t data);
+int pop_spsc_fifo(SPSCFIFO* fifo, fifo_data_t* data);
+
+/**
+ Batch access for the producer.
+ SPSCFIFO_reserve hands back a contiguous writable span of up to
+ 'n' entries and returns its length. The entries become visible
+ to the consumer once SPSCFIFO_commit is called.
+ */
+uint32_t SPSCFIFO_reserve(SPSCFIFO* fifo, fifo_data_t** span, uint32_t n);
+void SPSCFIFO_commit(SPSCFIFO* fifo, uint32_t n);
+
+/**
+ Batch access for the consumer.
+ SPSCFIFO_peek hands back a contiguous readable span of up to
+ 'n' entries and returns its length. The entries are handed
+ back to the producer once SPSCFIFO_release is called.
+ */
+uint32_t SPSCFIFO_peek(SPSCFIFO* fifo, const fifo_data_t** span, uint32_t n);
+void SPSCFIFO_release(SPSCFIFO* fifo, uint32_t n);
+
+/**
+ Number of entries currently stored. Approximate when called
+ while the other side is running.
+ */
+uint32_t SPSCFIFO_count(SPSCFIFO* fifo);
+
+/**
+ Consumer side helper: moves everything stored into a FIFO.
+ Returns the number of moved entries.
+ */
+uint32_t SPSCFIFO_drain(SPSCFIFO* fifo, FIFO* dest);
+
+SPSCFIFO* SPSCFIFO_create(uint32_t fifo_depth);
+
+void SPSCFIFO_destroy(SPSCFIFO* fifo);
+
+#ifdef __cplusplus
+} /* Matching } for the extern C */
+#endif
+
+#endif /* Include Guard */
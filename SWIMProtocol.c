@@ -110,6 +110,79 @@ bool parity_check(uint64_t packet, uint8_t data_bits, uint8_t parity_bits)
   return false;
 }
 
+/**
+ * Parity check with a repair attempt.
+ *
+ * With a single parity bit we know that something flipped, not what.
+ * The receiver does: the bit whose pulses were closest to the one/zero
+ * boundary. If that one is marginal enough, flip it and check again.
+ * 
+ */
+static bool parity_repair_swim_protocol(
+  SWIMProtocol* s_prot, uint64_t* packet, uint8_t data_bits)
+{
+  uint64_t repaired;
+  uint8_t  conf;
+  int      weakest;
+
+  /* The outcome goes into the link quality record either way */
+  if (parity_check(*packet, data_bits, SWIM_PARITY_BITS)) {
+    IRRecv_report_parity(s_prot->Recv, true);
+    return true;
+  }
+  IRRecv_report_parity(s_prot->Recv, false);
+
+  weakest = IRRecv_weakest_bit(s_prot->Recv, &conf);
+  if (weakest < 0 || conf >= SWIM_REPAIR_MAX_CONF) return false;
+
+  repaired = (*packet) ^ ((uint64_t)1<<weakest);
+  if (!parity_check(repaired, data_bits, SWIM_PARITY_BITS)) return false;
+
+  (*packet) = repaired;
+  s_prot->n_repaired++;
+
+  return true;
+}
+
+/**
+ * Formats a FIFO entry into a 17 bit channel data packet,
+ * topped with the time delta if asked for.
+ * 
+ */
+uint64_t fifo_to_packet(fifo_data_t fifo_data, bool with_ts)
+{
+  uint64_t addr, adc_data, ts_delta;
+
+  ts_delta  = ((fifo_data&FIFO_ENTRY_TS_MASK)>>FIFO_ENTRY_TS_SHIFT);
+  fifo_data = (fifo_data & FIFO_DATA_MASK);
+  addr      = ((fifo_data&FIFO_ADC_ADDR_MASK)>>FIFO_ADC_ADDR_SHIFT);
+  adc_data  = (fifo_data&FIFO_ADC_DATA_MASK);
+
+  if (with_ts) {
+    return (ts_delta<<SWIM_CHAN_DATA_BITS) | addr | adc_data;
+  }
+  return (addr | adc_data);
+}
+
+/**
+ * The end of burst packet, closing a READ_ALL reply of n_sent packets.
+ * Timestamped replies get the age in the delta field as it goes out.
+ * 
+ */
+static uint64_t eob_packet(uint32_t n_sent)
+{
+  return ((uint64_t)SWIM_EOB_ADDR<<SWIM_ADC_DATA_BITS) | (n_sent&SWIM_ADC_DATA_TRANS_MASK);
+}
+
+/**
+ * The time source for the timestamps, same as the uptime
+ * 
+ */
+uint32_t swim_clock_ms(void)
+{
+  return (uint32_t)millis();
+}
+
 /**
  * Parses and returns the bit width of a command
  * 
@@ -150,6 +223,12 @@ uint8_t cmd_to_data_bit(uint8_t cmd)
  *
  ***************************************************************************/
 
+/* A reply is still being queued, or still going out */
+static bool tx_busy_swim_protocol(SWIMProtocol* s_prot)
+{
+  return s_prot->txQueue && (s_prot->tx_pending || IRTxQueue_depth(s_prot->txQueue));
+}
+
 /**
  *
  * Actually runs the command...
@@ -162,15 +241,152 @@ int sendcmd_swim_protocol(SWIMProtocol* s_prot, uint8_t cmd, uint32_t ch_addr)
   uint32_t cmd_packet_formatted = \
     ((cmd&SWIM_CMD_MASK)<<SWIM_CHAN_ADDR_BITS) | (ch_addr & SWIM_CMD_CHADDR_MASK);
 
+  /* The pin is the reply's until the txQueue is empty */
+  if (tx_busy_swim_protocol(s_prot)) {
+    return SWIM_TX_PENDING;
+  }
+
   /* Sending a command packet is simple as sending a 8 bit packet */
   if (s_prot->pin_mode != OUTPUT) {
     s_prot->Trans->Init(s_prot->Trans);
   }
+  if (s_prot->wakeup_us) {
+    send_wakeup_train(s_prot->Trans, s_prot->wakeup_us);
+  }
   s_prot->Trans->SendPacket(s_prot->Trans, SWIM_CMD_DATA_BITS, cmd_packet_formatted);
 
   return SWIM_SUCCESS;
 }
 
+/**
+ * One packet of a reply: queued if there's a txQueue, sent right
+ * away otherwise. 'fill' (may be NULL) gets the packet as it goes
+ * on air.
+ * --> SWIM_FAILURE if the txQueue is full, nothing waits for room here
+ * 
+ */
+static int send_reply_fill_swim_protocol(SWIMProtocol* s_prot, uint8_t data_bits,
+  uint64_t packet, IRTxFill fill)
+{
+  if (!s_prot->txQueue) {
+    if (fill) packet = fill(s_prot, packet);
+    s_prot->Trans->SendPacket(s_prot->Trans, data_bits, packet);
+    return SWIM_SUCCESS;
+  }
+
+  if (IRTxQueue_push_fill(s_prot->txQueue, data_bits, packet, fill, NULL, s_prot) == IRTXQ_FULL) {
+    return SWIM_FAILURE;
+  }
+
+  return SWIM_SUCCESS;
+}
+
+static int send_reply_swim_protocol(SWIMProtocol* s_prot, uint8_t data_bits, uint64_t packet)
+{
+  return send_reply_fill_swim_protocol(s_prot, data_bits, packet, NULL);
+}
+
+/**
+ * Puts the age of the newest sample into the EOB, in ms, as the
+ * EOB goes on air (IRTxFill). From the tick with a txQueue: the
+ * packets queued ahead of it are out by then.
+ *
+ */
+static uint64_t fill_eob_swim_protocol(void* ctx, uint64_t packet)
+{
+  SWIMProtocol* s_prot = (SWIMProtocol*)ctx;
+  uint32_t age = swim_clock_ms() - s_prot->eob_time;
+
+  if (age > FIFO_TS_DELTA_MAX) age = FIFO_TS_DELTA_MAX;
+  return packet | ((uint64_t)age<<SWIM_CHAN_DATA_BITS);
+}
+
+/* Closes a READ_ALL reply of n_sent packets */
+static int send_eob_swim_protocol(SWIMProtocol* s_prot, uint8_t data_bits, uint32_t n_sent)
+{
+  if (!s_prot->timestamped) {
+    return send_reply_swim_protocol(s_prot, data_bits, eob_packet(n_sent));
+  }
+
+  /* The newest sample in the reply: nothing got stored since it was read */
+  s_prot->eob_time = s_prot->spFIFO->last_time;
+  return send_reply_fill_swim_protocol(s_prot, data_bits, eob_packet(n_sent), &fill_eob_swim_protocol);
+}
+
+/* How many more packets of the reply fit now, a frame at most */
+static uint32_t reply_room_swim_protocol(SWIMProtocol* s_prot)
+{
+  uint32_t room;
+
+  if (!s_prot->txQueue) return SWIM_N_CHANNELS;
+
+  room = IRTxQueue_room(s_prot->txQueue);
+  return (room < SWIM_N_CHANNELS) ? room : SWIM_N_CHANNELS;
+}
+
+/**
+ * The READ_ALL reply from where it was left: the spill log, the
+ * FIFO, then the EOB. With a txQueue, only as much as it has room
+ * for: the rest stays where it is and tx_pending is set, for the
+ * next SendData or ReadCmd to pick it up.
+ * --> SWIM_SUCCESS once the EOB is in, else SWIM_TX_PENDING
+ *
+ */
+static int send_readall_swim_protocol(SWIMProtocol* s_prot)
+{
+  fifo_data_t frame[SWIM_N_CHANNELS];
+  uint32_t n_frame, room, i;
+  uint32_t tmp_fifo_data;
+  uint8_t  data_bits;
+  uint64_t packet;
+
+  data_bits = cmd_to_data_bit(SWIM_CMD_READ_ALL);
+  if (s_prot->timestamped) data_bits += SWIM_TS_DELTA_BITS;
+
+  s_prot->tx_pending = true;
+
+  /* Whatever spilled during a link outage is older: goes out first */
+  if (s_prot->spFIFO->spill) {
+    while ((room = reply_room_swim_protocol(s_prot)) > 0 &&
+           (n_frame = SpillLog_drain(s_prot->spFIFO->spill, frame, room)) > 0) {
+      for (i=0; i<n_frame; i++) {
+        packet = fifo_to_packet(frame[i], s_prot->timestamped);
+        send_reply_swim_protocol(s_prot, data_bits, packet);
+      }
+      s_prot->tx_n_sent += n_frame;
+    }
+    if (!room) return SWIM_TX_PENDING;
+  }
+
+  if (s_prot->tx_retain) {
+    /* Reading without consuming, so the reply can be sent again */
+    while ((room = reply_room_swim_protocol(s_prot)) > 0 &&
+           FIFO_cursor_next(s_prot->spFIFO, &(s_prot->tx_cursor), &tmp_fifo_data)) {
+      packet = fifo_to_packet(tmp_fifo_data, s_prot->timestamped);
+      send_reply_swim_protocol(s_prot, data_bits, packet);
+      s_prot->tx_n_sent++;
+    }
+  }
+  else {
+    /* Clearing up all the data in FIFO, a frame at a time */
+    while ((room = reply_room_swim_protocol(s_prot)) > 0 &&
+           (n_frame = FIFO_pop_n(s_prot->spFIFO, frame, room)) > 0) {
+      for (i=0; i<n_frame; i++) {
+        packet = fifo_to_packet(frame[i], s_prot->timestamped);
+        send_reply_swim_protocol(s_prot, data_bits, packet);
+      }
+      s_prot->tx_n_sent += n_frame;
+    }
+  }
+  if (!room) return SWIM_TX_PENDING;
+
+  /* Closing the burst, so the surface doesn't wait for more */
+  send_eob_swim_protocol(s_prot, data_bits, s_prot->tx_n_sent);
+  s_prot->tx_pending = false;
+
+  return SWIM_SUCCESS;
+}
+
 /**
  *
  * Actually sends the data... according to the received command
@@ -183,11 +399,10 @@ int senddata_swim_protocol(SWIMProtocol* s_prot)
   uint32_t tmp_fifo_data;
   uint8_t  data_bits;
   uint64_t packet;
-  uint64_t addr, adc_data;
 
-  if (!s_prot->spFIFO->n_nodes) {
-    /* No data stored... */
-    return SWIM_FAILURE;
+  /* Collecting whatever the capture side has produced so far */
+  if (s_prot->capFIFO) {
+    SPSCFIFO_drain(s_prot->capFIFO, s_prot->spFIFO);
   }
 
   data_bits = cmd_to_data_bit(s_prot->cmd_cache);
@@ -197,48 +412,55 @@ int senddata_swim_protocol(SWIMProtocol* s_prot)
     s_prot->pin_mode = OUTPUT;
   }
 
+  /* Topping up the READ_ALL reply the txQueue had no room for */
+  if (s_prot->tx_pending) {
+    return send_readall_swim_protocol(s_prot);
+  }
+
   switch (s_prot->cmd_cache) {
 
     case SWIM_CMD_SLEEP:
 
       packet = (uint64_t)SWIM_ACK;
-      s_prot->Trans->SendPacket(s_prot->Trans, data_bits, packet);
 
-      return SWIM_SUCCESS;
+      return send_reply_swim_protocol(s_prot, data_bits, packet);
     
     case SWIM_CMD_READ_ALL:
 
-      /* Clearing up all the data in FIFO */
-      while (s_prot->spFIFO->n_nodes > 0) {
-        tmp_fifo_data = (s_prot->spFIFO->Pop(s_prot->spFIFO) & FIFO_DATA_MASK);
-        addr          = ((tmp_fifo_data&FIFO_ADC_ADDR_MASK)>>FIFO_ADC_ADDR_SHIFT);
-        adc_data      = (tmp_fifo_data&FIFO_ADC_DATA_MASK);
-        packet        = (addr | adc_data);
+      if (s_prot->timestamped) data_bits += SWIM_TS_DELTA_BITS;
+
+      s_prot->tx_n_sent = 0;
 
-        s_prot->Trans->SendPacket(s_prot->Trans, data_bits, packet);  
+      if (!s_prot->spFIFO->n_nodes && \
+          !(s_prot->spFIFO->spill && SpillLog_count(s_prot->spFIFO->spill))) {
+        /* No data stored... the surface doesn't have to wait for it though */
+        send_eob_swim_protocol(s_prot, data_bits, 0);
+        return SWIM_FAILURE;
       }
 
-      return SWIM_SUCCESS;
+      if (s_prot->tx_retain) {
+        FIFO_cursor_begin(s_prot->spFIFO, &(s_prot->tx_cursor));
+      }
 
-    case SWIM_CMD_READ_ONE:
+      return send_readall_swim_protocol(s_prot);
 
-      /* Popping a data from FIFO may cause some trouble?? */
-      tmp_fifo_data = (s_prot->spFIFO->Pop(s_prot->spFIFO) & FIFO_DATA_MASK);
-      addr          = ((tmp_fifo_data&FIFO_ADC_ADDR_MASK)>>FIFO_ADC_ADDR_SHIFT);
-      adc_data      = (tmp_fifo_data&FIFO_ADC_DATA_MASK);
-      packet        = (addr | adc_data);
+    case SWIM_CMD_READ_ONE:
 
-      s_prot->Trans->SendPacket(s_prot->Trans, data_bits, packet);
+      /* Served from the latest value table, the FIFO is left alone */
+      if (!FIFO_latest(s_prot->spFIFO, s_prot->ch_addr_cache, &tmp_fifo_data)) {
+        /* Nothing sampled on that channel yet... */
+        return SWIM_FAILURE;
+      }
+      packet = fifo_to_packet(tmp_fifo_data, false);
 
-      return SWIM_SUCCESS;
+      return send_reply_swim_protocol(s_prot, data_bits, packet);
 
     case SWIM_CMD_READ_BATT:
 
       /* Be sure to update the battery level manually... */
       packet = (uint64_t)s_prot->battery_level;
-      s_prot->Trans->SendPacket(s_prot->Trans, data_bits, packet);
 
-      return SWIM_SUCCESS;
+      return send_reply_swim_protocol(s_prot, data_bits, packet);
 
     case SWIM_CMD_READ_FPGA_TEMP:
 
@@ -249,29 +471,43 @@ int senddata_swim_protocol(SWIMProtocol* s_prot)
 
       /* Manually update the uptime first */
       packet = (uint64_t)s_prot->uptime;
-      s_prot->Trans->SendPacket(s_prot->Trans, data_bits, packet);
 
-      return SWIM_SUCCESS;
+      return send_reply_swim_protocol(s_prot, data_bits, packet);
 
     case SWIM_CMD_WAKEUP:
 
       packet = (uint64_t)SWIM_ACK;
-      s_prot->Trans->SendPacket(s_prot->Trans, data_bits, packet);
 
-      return SWIM_SUCCESS; 
+      return send_reply_swim_protocol(s_prot, data_bits, packet); 
 
     default:
       /* As a default option, just send ACK signal back */
       packet = (uint64_t)SWIM_ACK;
       data_bits = SWIM_ACK_BITS;
-      s_prot->Trans->SendPacket(s_prot->Trans, data_bits, packet);
 
-      return SWIM_SUCCESS;
+      return send_reply_swim_protocol(s_prot, data_bits, packet);
   }
 
   return SWIM_FAILURE;
 }
 
+/**
+ *
+ * Confirms the delivery of the last READ_ALL reply
+ * SWIMProtocol->ConfirmData(SWIMProtocol*)
+ * --> Only matters with tx_retain. Releases the sent data from the FIFO.
+ *
+ */
+int confirm_data_swim_protocol(SWIMProtocol* s_prot)
+{
+  if (!s_prot->tx_retain) return SWIM_SUCCESS;
+
+  FIFO_cursor_commit(s_prot->spFIFO, &(s_prot->tx_cursor));
+  FIFO_cursor_begin(s_prot->spFIFO, &(s_prot->tx_cursor));
+
+  return SWIM_SUCCESS;
+}
+
 /**
  *
  * Parses the command to react
@@ -285,19 +521,32 @@ int readcmd_swim_protocol(SWIMProtocol* s_prot)
   int status;
   bool parity_check_result;
 
+  /* The reply still going out has the pin: topped up, not waited for */
+  if (s_prot->tx_pending) {
+    send_readall_swim_protocol(s_prot);
+  }
+  if (tx_busy_swim_protocol(s_prot)) {
+    return SWIM_TX_PENDING;
+  }
+
   if (s_prot->pin_mode != INPUT) {
     s_prot->Recv->Init(s_prot->Recv);
   }
  
-  status = s_prot->Recv->RecvPacket(s_prot->Recv, &packet, SWIM_CMD_DATA_BITS+SWIM_PARITY_BITS);
+  /* Plain RecvPacket, unless listening is duty-cycled */
+  status = IRRecv_listen(s_prot->Recv, &packet, SWIM_CMD_DATA_BITS+SWIM_PARITY_BITS);
   if (!status) {
 
     if (status == SWIM_SUCCESS) {
-      parity_check_result = parity_check(packet, SWIM_CHAN_DATA_BITS, SWIM_PARITY_BITS);
+      parity_check_result = parity_repair_swim_protocol(s_prot, &packet, SWIM_CHAN_DATA_BITS);
     }
 
     if (parity_check_result) {
-      s_prot->cmd_cache = (uint8_t)((packet&(SWIM_CMD_MASK<<1))>>1);
+      /* packet: [cmd(3)][ch_addr(5)][parity] */
+      s_prot->cmd_cache = (uint8_t)\
+        ((packet>>(SWIM_CHAN_ADDR_BITS+SWIM_PARITY_BITS)) & SWIM_CMD_MASK);
+      s_prot->ch_addr_cache = (uint8_t)\
+        ((packet>>SWIM_PARITY_BITS) & SWIM_CMD_CHADDR_MASK);
       return SWIM_SUCCESS;
     }
     else return SWIM_FAILURE;
@@ -312,28 +561,55 @@ int readcmd_swim_protocol(SWIMProtocol* s_prot)
  * Read all data from the FIFO --> Reads data from all 30 data channels
  * SWIMProtocol->ReadAll(SWIMProtocol*)
  * --> Saves all the 30 data into Internal FIFO
+ * --> Done at the end of burst packet, or once the next packet is
+ *     overdue (SWIM_READALL_SLACK airtimes). burst_expected/received
+ *     tell if anything got lost on the way.
  *
  */
 int readall_swim_protocol(SWIMProtocol* s_prot)
 {
+  fifo_data_t frame[SWIM_N_CHANNELS];
+  uint32_t n_frame = 0;
   int status = 0;
   bool parity_check_result;
   uint64_t packet;
   uint32_t addr_shifted;
   uint32_t adc_data;
   uint32_t fifo_data_tmp;
+  uint32_t frame_deadline;
+  uint32_t eob_age = 0;
+  uint8_t  data_bits = SWIM_CHAN_DATA_BITS;
+  bool     eob = false;
 
   if (s_prot->pin_mode != INPUT) {
     s_prot->Recv->Init(s_prot->Recv);
   }
 
-  while (status != ERROR_IDLE_TIMEOUT) { 
+  /* Deltas are exact; the absolute times get anchored at the EOB */
+  if (s_prot->timestamped) data_bits += SWIM_TS_DELTA_BITS;
+
+  s_prot->burst_expected = 0;
+  s_prot->burst_received = 0;
+
+  /* The reply has to start first... */
+  s_prot->Recv->idle_timeout_us = (uint32_t)SWIM_READALL_FIRST_TIMEOUT_MS*1000;
+
+  while (!eob && status != ERROR_IDLE_TIMEOUT) { 
 
     status = s_prot->Recv->RecvPacket(
-      s_prot->Recv, &packet, SWIM_CHAN_DATA_BITS+SWIM_PARITY_BITS);
+      s_prot->Recv, &packet, data_bits+SWIM_PARITY_BITS);
+
+    /**
+     * ... then the packets come back to back. Allowing for the rest
+     * of the current one (early accept) and for a lost one.
+     * (Recalculated, the receiver clock follows the sender's.)
+     */
+    frame_deadline = SWIM_READALL_SLACK * \
+      IRRecv_packet_airtime(s_prot->Recv, data_bits+SWIM_PARITY_BITS);
+    s_prot->Recv->idle_timeout_us = frame_deadline;
     
     if (status == SWIM_SUCCESS) {
-      parity_check_result = parity_check(packet, SWIM_CHAN_DATA_BITS, SWIM_PARITY_BITS);
+      parity_check_result = parity_repair_swim_protocol(s_prot, &packet, data_bits);
     }
     else {
       /* Ignoring failed parity check signal */
@@ -347,13 +623,49 @@ int readall_swim_protocol(SWIMProtocol* s_prot)
       adc_data = \
         (uint32_t)((packet&SWIM_ADC_DATA_RECV_MASK)>>SWIM_PARITY_BITS);
 
+      /* The end of the burst: nothing else to wait for */
+      if (((packet>>(SWIM_ADC_DATA_BITS+SWIM_PARITY_BITS))&SWIM_CMD_CHADDR_MASK) == SWIM_EOB_ADDR) {
+        s_prot->burst_expected = adc_data;
+        eob_age = (uint32_t)\
+          ((packet>>(SWIM_CHAN_DATA_BITS+SWIM_PARITY_BITS))&FIFO_TS_DELTA_MAX);
+        eob = true;
+        break;
+      }
+      s_prot->burst_received++;
+
       fifo_data_tmp = (addr_shifted|adc_data);
 
-      s_prot->spFIFO->Push(s_prot->spFIFO, fifo_data_tmp);      
+      if (s_prot->timestamped) {
+        fifo_data_tmp |= (uint32_t)\
+          (((packet>>(SWIM_CHAN_DATA_BITS+SWIM_PARITY_BITS))&FIFO_TS_DELTA_MAX)<<FIFO_ENTRY_TS_SHIFT);
+      }
+
+      /* Collecting a whole frame before handing it to the FIFO */
+      frame[n_frame++] = fifo_data_tmp;
+      if (n_frame >= SWIM_N_CHANNELS) {
+        FIFO_push_n(s_prot->spFIFO, frame, n_frame);
+        n_frame = 0;
+      }
     }
     else continue;
 
-  } /* while (status != ERROR_IDLE_TIMEOUT) */
+  } /* while (!eob && status != ERROR_IDLE_TIMEOUT) */
+
+  /* Leftovers of a partial frame */
+  if (n_frame) {
+    FIFO_push_n(s_prot->spFIFO, frame, n_frame);
+  }
+
+  /**
+   * The newest sample is eob_age old on our clock. The entries still
+   * stored from earlier bursts move along: the deltas chain across.
+   */
+  if (eob && s_prot->timestamped) {
+    FIFO_anchor_newest(s_prot->spFIFO, swim_clock_ms() - eob_age);
+  }
+
+  /* Back to the default wait for the other commands */
+  s_prot->Recv->idle_timeout_us = 0;
 
   return SWIM_SUCCESS;
 }
@@ -382,7 +694,7 @@ uint16_t readone_swim_protocol(SWIMProtocol* s_prot)
     s_prot->Recv, &packet, SWIM_CHAN_DATA_BITS+SWIM_PARITY_BITS);
   
   if (status == SWIM_SUCCESS) {
-    parity_check_result = parity_check(packet, SWIM_CHAN_DATA_BITS, SWIM_PARITY_BITS);
+    parity_check_result = parity_repair_swim_protocol(s_prot, &packet, SWIM_CHAN_DATA_BITS);
   }
   else {
     /* Ignoring failed parity check signal */
@@ -409,6 +721,68 @@ uint16_t readone_swim_protocol(SWIMProtocol* s_prot)
   return SWIM_SUCCESS;
 }
 
+/**
+ *
+ * Turns on timestamped READ_ALL data. Both ends have to agree.
+ * The submerged unit passes its clock (swim_clock_ms) to stamp the samples,
+ * the surface passes NULL to rebuild times from the received deltas.
+ * --> Returns 0 if successful, -1 with packed FIFO storage
+ *
+ */
+int swim_enable_timestamps(SWIMProtocol* s_prot, uint32_t (*clock)(void))
+{
+  if (!FIFO_enable_timestamps(s_prot->spFIFO, clock)) return SWIM_FAILURE;
+
+  s_prot->timestamped = true;
+  return SWIM_SUCCESS;
+}
+
+/**
+ *
+ * Duty-cycled listening for the commands
+ *
+ */
+int swim_enable_listen(SWIMProtocol* s_prot, uint32_t period_ms, bool listener)
+{
+  uint32_t period_us = period_ms * 1000;
+
+  if (listener) {
+    IRRecv_set_listen(s_prot->Recv, period_us, 0);
+    s_prot->wakeup_us = 0;
+  }
+  else {
+    IRRecv_set_listen(s_prot->Recv, 0, 0);
+    s_prot->wakeup_us = period_us ? 
+      period_us + PULSES_FOR_LISTEN_WINDOW * s_prot->Trans->irComm->period : 0;
+  }
+
+  return SWIM_SUCCESS;
+}
+
+/**
+ *
+ * Queued replies, see IRTxQueue.h
+ *
+ */
+int swim_enable_tx_queue(SWIMProtocol* s_prot, uint8_t depth)
+{
+  /* Not while a reply is on it */
+  if (tx_busy_swim_protocol(s_prot)) {
+    return SWIM_TX_PENDING;
+  }
+
+  if (s_prot->txQueue) {
+    IRTxQueue_destroy(s_prot->txQueue);
+    s_prot->txQueue = NULL;
+  }
+
+  if (depth) {
+    s_prot->txQueue = IRTxQueue_create(s_prot->Trans, depth);
+  }
+
+  return SWIM_SUCCESS;
+}
+
 /**
  *
  * Sends 'Wake Up' signal to the submerged unit
@@ -485,16 +859,37 @@ SWIMProtocol* SWIMProtocol_create(void)
   SWIMProtocol* s_prot     = (SWIMProtocol*)malloc(sizeof(SWIMProtocol));
   s_prot->Recv             = IRRecv_create(DEF_IR_PIN);
   s_prot->Trans            = IRTrans_create(DEF_IR_PIN);
+#if SWIM_FIFO_STORAGE == FIFO_STORAGE_WORD
   s_prot->spFIFO           = FIFO_create(SWIM_FIFO_DEPTH);
+#else
+  s_prot->spFIFO           = FIFO_create_packed(SWIM_FIFO_DEPTH, SWIM_FIFO_STORAGE);
+#endif
+  FIFO_set_policy(s_prot->spFIFO, SWIM_FIFO_POLICY);
+  s_prot->capFIFO          = NULL;
 
   s_prot->cmd_cache        = 0;
+  s_prot->ch_addr_cache    = 0;
   
   s_prot->pin_mode         = 0;
+
+  s_prot->tx_retain        = false;
+  s_prot->timestamped      = false;
+  s_prot->n_repaired       = 0;
+  s_prot->burst_expected   = 0;
+  s_prot->burst_received   = 0;
+  s_prot->eob_time         = 0;
+  s_prot->tx_pending       = false;
+  s_prot->tx_n_sent        = 0;
+  s_prot->wakeup_us        = 0;
+  s_prot->txQueue          = NULL;
+  FIFO_cursor_begin(s_prot->spFIFO, &(s_prot->tx_cursor));
   s_prot->Trans->Init(s_prot->Trans);
 
   /* Matching function pointers for methods */
   s_prot->SendCmd     = &(sendcmd_swim_protocol);
   s_prot->SendData    = &(senddata_swim_protocol);
+  s_prot->ReadCmd     = &(readcmd_swim_protocol);
+  s_prot->ConfirmData = &(confirm_data_swim_protocol);
 
   s_prot->ReadAll     = &(readall_swim_protocol);
   s_prot->ReadOne     = &(readone_swim_protocol);
@@ -515,16 +910,37 @@ SWIMProtocol* SWIMProtocol_create_with_params(
   SWIMProtocol* s_prot     = (SWIMProtocol*)malloc(sizeof(SWIMProtocol));
   s_prot->Recv             = IRRecv_create_with_freq(ir_pin, mod_freq);
   s_prot->Trans            = IRTrans_create_with_freq(ir_pin, mod_freq);
+#if SWIM_FIFO_STORAGE == FIFO_STORAGE_WORD
   s_prot->spFIFO           = FIFO_create(fifo_depth);
+#else
+  s_prot->spFIFO           = FIFO_create_packed(fifo_depth, SWIM_FIFO_STORAGE);
+#endif
+  FIFO_set_policy(s_prot->spFIFO, SWIM_FIFO_POLICY);
+  s_prot->capFIFO          = NULL;
 
   s_prot->cmd_cache        = 0;
+  s_prot->ch_addr_cache    = 0;
 
   s_prot->pin_mode         = 0;
+
+  s_prot->tx_retain        = false;
+  s_prot->timestamped      = false;
+  s_prot->n_repaired       = 0;
+  s_prot->burst_expected   = 0;
+  s_prot->burst_received   = 0;
+  s_prot->eob_time         = 0;
+  s_prot->tx_pending       = false;
+  s_prot->tx_n_sent        = 0;
+  s_prot->wakeup_us        = 0;
+  s_prot->txQueue          = NULL;
+  FIFO_cursor_begin(s_prot->spFIFO, &(s_prot->tx_cursor));
   s_prot->Trans->Init(s_prot->Trans);
 
   /* Matching function pointers for methods */
   s_prot->SendCmd     = &(sendcmd_swim_protocol);
   s_prot->SendData    = &(senddata_swim_protocol);
+  s_prot->ReadCmd     = &(readcmd_swim_protocol);
+  s_prot->ConfirmData = &(confirm_data_swim_protocol);
 
   s_prot->ReadAll     = &(readall_swim_protocol);
   s_prot->ReadOne     = &(readone_swim_protocol);
@@ -547,6 +963,10 @@ void SWIMProtocol_destroy(SWIMProtocol* s_prot)
       IRRecv_destroy(s_prot->Recv);
     }
 
+    if (s_prot->txQueue) {
+      IRTxQueue_destroy(s_prot->txQueue);
+    }
+
     if (s_prot->Trans) {
       IRTrans_destroy(s_prot->Trans);
     }
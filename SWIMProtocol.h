@@ -32,16 +32,56 @@
 
 /* SWIM IR Libraries */
 #include "IRTransmit.h"
+#include "IRTxQueue.h"
 #include "IRRecv.h"
 
 /* FIFO library */
 #include "FIFO.h"
+#include "SPSCFIFO.h"
+#include "SpillLog.h"
 
 /* SWIM Communication parameters */
 #ifndef SWIM_FIFO_DEPTH
 #define SWIM_FIFO_DEPTH                  30
 #endif
 
+/* What the FIFO drops during long link outages, see FIFO_POLICY_* */
+#ifndef SWIM_FIFO_POLICY
+#define SWIM_FIFO_POLICY                 FIFO_POLICY_DROP_OLDEST
+#endif
+
+/* Number of data channels in a READ_ALL frame */
+#ifndef SWIM_N_CHANNELS
+#define SWIM_N_CHANNELS                  30
+#endif
+
+/**
+ * A packet failing the parity gets its least confident bit flipped,
+ * if that bit is this marginal (combined confidence, 1/16 periods).
+ * 0 turns the repair off.
+ */
+#ifndef SWIM_REPAIR_MAX_CONF
+#define SWIM_REPAIR_MAX_CONF             32
+#endif
+
+/**
+ * READ_ALL burst timing.
+ * The reply has this long to start, then every packet is due within
+ * SWIM_READALL_SLACK packet airtimes of the previous one.
+ */
+#ifndef SWIM_READALL_FIRST_TIMEOUT_MS
+#define SWIM_READALL_FIRST_TIMEOUT_MS    500
+#endif
+
+#ifndef SWIM_READALL_SLACK
+#define SWIM_READALL_SLACK               2
+#endif
+
+/* FIFO_STORAGE_WORD, or FIFO_STORAGE_PACKED17/24 to buffer more frames in SRAM */
+#ifndef SWIM_FIFO_STORAGE
+#define SWIM_FIFO_STORAGE                FIFO_STORAGE_WORD
+#endif
+
 /************************************************************
  * 
  * SWIM Command List 
@@ -72,6 +112,7 @@
 #define SWIM_ACK_BITS                    3
 #define SWIM_CHAN_ADDR_BITS              5
 #define SWIM_ADC_DATA_BITS               12
+#define SWIM_TS_DELTA_BITS               12         /* Optional, on top of the channel data */
 
 #define SWIM_FIFO_ADC_ADDR_GAP_BITS      3
 #define SWIM_FIFO_HEADER_SPACE_BITS      12
@@ -96,6 +137,14 @@
 #endif
 
 #define SWIM_CMD_MASK                    0x7
+
+/**
+ * End of a READ_ALL burst: a channel packet with this (unused) address,
+ * the number of data packets sent in the ADC field. With timestamps,
+ * the delta field holds the age of the newest sample (ms, saturated)
+ * as the EOB goes out, which the surface anchors the burst on.
+ */
+#define SWIM_EOB_ADDR                    0x1F
 #define SWIM_CMD_CHADDR_MASK             0x1F
 
 /************************************************************
@@ -115,6 +164,7 @@
  ************************************************************/
 #define SWIM_SUCCESS                     0
 #define SWIM_FAILURE                     -1
+#define SWIM_TX_PENDING                  1          /* Queued reply not all out yet, see swim_enable_tx_queue */
 #define SWIM_PIN_OUTPUT                  0
 #define SWIM_PIN_INPUT                   1
 
@@ -135,16 +185,37 @@ typedef struct __swim_protocol__ {
   IRRecv*       Recv;
   IRTrans*      Trans;
   FIFO*         spFIFO;
+  SPSCFIFO*     capFIFO;  /* Optional ISR/core1 capture queue, drained into spFIFO */
 
   uint8_t       cmd_cache;
+  uint8_t       ch_addr_cache;   /* Channel address that came with the command */
   uint8_t       battery_level;
   uint32_t      uptime;
 
   uint8_t       pin_mode; /* 0 for output, 1 for input */
 
+  bool          tx_retain;  /* Keep READ_ALL data in the FIFO until ConfirmData */
+  FIFOCursor    tx_cursor;  /* End of the last READ_ALL reply */
+
+  bool          timestamped; /* READ_ALL data carries time deltas */
+
+  uint32_t      n_repaired;  /* Packets saved by flipping their weakest bit */
+
+  uint32_t      burst_expected;  /* Packets the last READ_ALL burst announced */
+  uint32_t      burst_received;  /* ... and the ones that made it */
+  uint32_t      eob_time;        /* Newest sample of the reply going out, for the EOB age */
+
+  bool          tx_pending; /* READ_ALL reply the txQueue had no room for all of */
+  uint32_t      tx_n_sent;  /* ... and its packets queued so far */
+
+  uint32_t      wakeup_us;  /* Wake-up train ahead of each command, 0 for none */
+
+  IRTxQueue*    txQueue;    /* Optional, SendData replies go out in the background */
+
   int           (*SendCmd)(struct __swim_protocol__*, uint8_t, uint32_t);
   int           (*SendData)(struct __swim_protocol__*);
   int           (*ReadCmd)(struct __swim_protocol__*);
+  int           (*ConfirmData)(struct __swim_protocol__*);
 
   int           (*ReadAll)(struct __swim_protocol__*);
   uint16_t      (*ReadOne)(struct __swim_protocol__*);
@@ -169,6 +240,7 @@ extern "C" {
  * Actually sends the command...
  * SWIMProtocol->SendCmd(SWIMProtocol*, command in uint8_t)
  * --> Returns 0 if successful ack received, else -1
+ *     SWIM_TX_PENDING while a queued reply still has the pin
  *
  */
 int sendcmd_swim_protocol(SWIMProtocol* s_prot, uint8_t cmd, uint32_t ch_addr);
@@ -178,15 +250,29 @@ int sendcmd_swim_protocol(SWIMProtocol* s_prot, uint8_t cmd, uint32_t ch_addr);
  * Actually sends the data... according to the received command
  * SWIMProtocol->SendData(SWIMProtocol*)
  * --> Returns 0 if successful ack received, else -1
+ *     With a txQueue: SWIM_TX_PENDING if the READ_ALL reply didn't
+ *     all fit, the next call (or ReadCmd) queues more of it
  *
  */
 int senddata_swim_protocol(SWIMProtocol* s_prot);
 
+/**
+ *
+ * Confirms the delivery of the last READ_ALL reply
+ * SWIMProtocol->ConfirmData(SWIMProtocol*)
+ * --> Only matters with tx_retain. Releases the sent data from the FIFO.
+ *     Until then, another READ_ALL resends it.
+ *
+ */
+int confirm_data_swim_protocol(SWIMProtocol* s_prot);
+
 /**
  *
  * Parses the command to react
  * SWIMProtocol->ReadCmd(SWIMProtocol*)
  * --> Returns 0 if successful
+ *     SWIM_TX_PENDING right away while a queued reply is going
+ *     out, after topping it up: call again from the loop
  * 
  */
 int readcmd_swim_protocol(SWIMProtocol* s_prot);
@@ -196,6 +282,9 @@ int readcmd_swim_protocol(SWIMProtocol* s_prot);
  * Read all data from the FIFO --> Reads data from all 30 data channels
  * SWIMProtocol->ReadAll(SWIMProtocol*)
  * --> Saves all the 30 data into Internal FIFO
+ * --> Done at the end of burst packet, or once the next packet is
+ *     overdue (SWIM_READALL_SLACK airtimes). burst_expected/received
+ *     tell if anything got lost on the way.
  *
  */
 int readall_swim_protocol(SWIMProtocol* s_prot);
@@ -209,6 +298,51 @@ int readall_swim_protocol(SWIMProtocol* s_prot);
  */
 uint16_t readone_swim_protocol(SWIMProtocol* s_prot);
 
+/**
+ *
+ * Turns on timestamped READ_ALL data. Both ends have to agree.
+ * The submerged unit passes its clock (swim_clock_ms) to stamp the samples,
+ * the surface passes NULL to rebuild times from the received deltas.
+ * Read them back with FIFO_pop_timed(s_prot->spFIFO, &time): on the
+ * surface clock, to within one EOB airtime, once a burst ended with
+ * its EOB.
+ * --> Returns 0 if successful, -1 with packed FIFO storage
+ *
+ */
+int swim_enable_timestamps(SWIMProtocol* s_prot, uint32_t (*clock)(void));
+
+/**
+ *
+ * Duty-cycled listening for the commands, period_ms apart.
+ * The submerged unit passes listener = true: ReadCmd only listens
+ * in short windows and sleeps in between (see IRRecv_listen).
+ * The surface passes false: its commands get the wake-up train.
+ * period_ms 0 turns it off. Both ends have to agree.
+ * --> Returns 0
+ *
+ */
+int swim_enable_listen(SWIMProtocol* s_prot, uint32_t period_ms, bool listener);
+
+/**
+ *
+ * Queued replies: SendData queues what fits and returns, and the
+ * caller goes back to sampling. Nothing in here ticks or waits:
+ * tick s_prot->txQueue from a timer (IRTxQueue_tick, rearmed with
+ * what it returns) or from the loop. A READ_ALL reply longer than
+ * depth is queued a piece at a time, by the calls to SendData or
+ * ReadCmd that follow. ReadCmd and SendCmd return SWIM_TX_PENDING
+ * until the queue has run dry: one pin.
+ * depth 0 turns it off.
+ * --> Returns 0, SWIM_TX_PENDING while a reply is going out
+ *
+ */
+int swim_enable_tx_queue(SWIMProtocol* s_prot, uint8_t depth);
+
+/**
+ * Millisecond clock, the same one the uptime comes from
+ */
+uint32_t swim_clock_ms(void);
+
 /**
  *
  * Sends 'Wake Up' signal to the submerged unit
@@ -0,0 +1,379 @@
+/************************************************************
+
+  A spill log for SWIM-SnH
+
+  Append-only storage that catches the entries the FIFO drops
+  on overflow, in CRC protected pages.
+
+  Implementation file
+
+ ************************************************************/
+/* pwrite and ftruncate, even with -std=c11 */
+#if defined(__linux__) && !defined(_XOPEN_SOURCE)
+#define _XOPEN_SOURCE 700
+#endif
+
+#include "SpillLog.h"
+
+#include <string.h>
+
+#if defined(ARDUINO_ARCH_RP2040) && !defined(ARDUINO_ARCH_MBED)
+#include <hardware/flash.h>
+#include <hardware/sync.h>
+#endif
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+/*************************************************************
+
+  CRC32
+
+**************************************************************/
+
+/* Nibble table: small enough for the MCU, twice the speed of bit by bit */
+static const uint32_t spill_crc_table[16] = {
+  0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC,
+  0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+  0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+  0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+};
+
+uint32_t spill_crc32(const uint8_t* buf, uint32_t len)
+{
+  uint32_t crc = 0xFFFFFFFF;
+
+  while (len--) {
+    crc ^= *buf++;
+    crc = (crc >> 4) ^ spill_crc_table[crc & 0xF];
+    crc = (crc >> 4) ^ spill_crc_table[crc & 0xF];
+  }
+
+  return ~crc;
+}
+
+static uint32_t spill_page_crc(SpillPage* page)
+{
+  uint32_t saved = page->hdr.crc;
+  uint32_t crc;
+
+  page->hdr.crc = 0;
+  crc = spill_crc32((const uint8_t*)page, SPILL_PAGE_SIZE);
+  page->hdr.crc = saved;
+
+  return crc;
+}
+
+/*************************************************************
+
+  SpillLog stuffs
+
+**************************************************************/
+
+/**
+ * Moves the page being filled to the queue for SpillLog_service.
+ */
+static int spill_queue_page(SpillLog* log)
+{
+  if (log->n_pending >= SPILL_PENDING_PAGES) return SPILL_FULL;
+
+  memcpy(&(log->pending[log->n_pending++]), &(log->wpage), sizeof(SpillPage));
+  memset(&(log->wpage), 0, sizeof(SpillPage));
+
+  return SPILL_SUCCESS;
+}
+
+/**
+ * Takes the oldest queued page off the queue.
+ */
+static void spill_dequeue_page(SpillLog* log)
+{
+  log->n_pending--;
+  memmove(log->pending, &(log->pending[1]), sizeof(SpillPage)*log->n_pending);
+}
+
+int SpillLog_service(SpillLog* log)
+{
+  SpillPage* page;
+
+  while (log->n_pending) {
+    if (log->write_page >= log->n_pages) return SPILL_FULL;
+
+    page = &(log->pending[0]);
+    page->hdr.magic = SPILL_PAGE_MAGIC;
+    page->hdr.seq   = log->seq;
+    page->hdr.crc   = spill_page_crc(page);
+
+    if (log->WritePage(log, log->write_page, page)) return SPILL_IO_ERROR;
+
+    log->write_page++;
+    log->seq++;
+
+    spill_dequeue_page(log);
+  }
+
+  return SPILL_SUCCESS;
+}
+
+int SpillLog_flush(SpillLog* log)
+{
+  int status = SpillLog_service(log);
+
+  if (status != SPILL_SUCCESS || !log->wpage.hdr.count) return status;
+
+  spill_queue_page(log);
+  return SpillLog_service(log);
+}
+
+int SpillLog_append(SpillLog* log, fifo_data_t data)
+{
+  SpillPage* page = &(log->wpage);
+
+  /* The page could not be queued earlier: everything is full */
+  if (page->hdr.count >= SPILL_ENTRIES_PER_PAGE && spill_queue_page(log)) {
+    log->n_lost++;
+    return SPILL_FULL;
+  }
+
+  page->data[page->hdr.count++] = data;
+  log->n_appended++;
+
+  /* Out of the way right away, if there's room in the queue */
+  if (page->hdr.count >= SPILL_ENTRIES_PER_PAGE) spill_queue_page(log);
+
+  return SPILL_SUCCESS;
+}
+
+uint32_t SpillLog_drain(SpillLog* log, fifo_data_t* data, uint32_t n)
+{
+  uint32_t got = 0;
+  uint32_t k;
+
+  while (got < n) {
+
+    /* Whatever is left of the current page */
+    if (log->rpos < log->rpage.hdr.count) {
+      k = log->rpage.hdr.count - log->rpos;
+      if (k > n - got) k = n - got;
+      memcpy(data + got, &(log->rpage.data[log->rpos]), sizeof(fifo_data_t)*k);
+      log->rpos += k;
+      got += k;
+      continue;
+    }
+
+    /* Next page from the backend */
+    if (log->read_page < log->write_page) {
+      log->rpos = 0;
+      if (log->ReadPage(log, log->read_page++, &(log->rpage)) ||
+          log->rpage.hdr.magic != SPILL_PAGE_MAGIC ||
+          log->rpage.hdr.count > SPILL_ENTRIES_PER_PAGE ||
+          log->rpage.hdr.crc != spill_page_crc(&(log->rpage))) {
+        log->n_crc_errors++;
+        log->rpage.hdr.count = 0;
+      }
+      continue;
+    }
+
+    /* Then the pages not written out yet */
+    if (log->n_pending) {
+      memcpy(&(log->rpage), &(log->pending[0]), sizeof(SpillPage));
+      log->rpos = 0;
+      spill_dequeue_page(log);
+      continue;
+    }
+
+    /* Finally, the page still being filled */
+    k = log->wpage.hdr.count;
+    if (!k) break;
+    if (k > n - got) k = n - got;
+    memcpy(data + got, log->wpage.data, sizeof(fifo_data_t)*k);
+    memmove(log->wpage.data, &(log->wpage.data[k]),
+      sizeof(fifo_data_t)*(log->wpage.hdr.count - k));
+    log->wpage.hdr.count -= k;
+    got += k;
+  }
+
+  /* Everything is out: start over from the first page */
+  if (log->write_page && log->read_page >= log->write_page &&
+      log->rpos >= log->rpage.hdr.count && !log->n_pending && !log->wpage.hdr.count) {
+    log->write_page = 0;
+    log->read_page  = 0;
+    log->rpos       = 0;
+    log->rpage.hdr.count = 0;
+    if (log->Erase) log->Erase(log);
+  }
+
+  return got;
+}
+
+uint32_t SpillLog_count(SpillLog* log)
+{
+  uint32_t n = (log->rpage.hdr.count - log->rpos) + log->wpage.hdr.count;
+  uint8_t i;
+
+  for (i=0; i<log->n_pending; i++) n += log->pending[i].hdr.count;
+
+  /* Exact unless partially filled pages were flushed */
+  return n + (log->write_page - log->read_page)*SPILL_ENTRIES_PER_PAGE;
+}
+
+/*************************************************************
+
+  RP2040 flash backend
+
+**************************************************************/
+#if defined(ARDUINO_ARCH_RP2040) && !defined(ARDUINO_ARCH_MBED)
+
+/**
+ * Sectors are erased right before their first page is programmed,
+ * with the interrupts off for the whole erase (~50 ms): it only
+ * runs from SpillLog_service, never from the FIFO Push.
+ *
+ * Caveat: flash can't be read while it's being written. If core1
+ * runs code from flash, park it (rp2040.idleOtherCore()) around
+ * SpillLog_service.
+ */
+static int spill_flash_write_page(SpillLog* log, uint32_t page_idx, const SpillPage* page)
+{
+  uint32_t offset = *(uint32_t*)log->ctx + page_idx*SPILL_PAGE_SIZE;
+  uint32_t ints = save_and_disable_interrupts();
+
+  if ((offset % FLASH_SECTOR_SIZE) == 0) {
+    flash_range_erase(offset, FLASH_SECTOR_SIZE);
+  }
+  flash_range_program(offset, (const uint8_t*)page, SPILL_PAGE_SIZE);
+
+  restore_interrupts(ints);
+  return SPILL_SUCCESS;
+}
+
+static int spill_flash_read_page(SpillLog* log, uint32_t page_idx, SpillPage* page)
+{
+  uint32_t offset = *(uint32_t*)log->ctx + page_idx*SPILL_PAGE_SIZE;
+
+  memcpy(page, (const void*)(XIP_BASE + offset), SPILL_PAGE_SIZE);
+  return SPILL_SUCCESS;
+}
+
+SpillLog* SpillLog_create_flash(uint32_t flash_offset, uint32_t n_pages)
+{
+  SpillLog* log = SpillLog_create_skel(n_pages);
+
+  log->ctx = malloc(sizeof(uint32_t));
+  *(uint32_t*)log->ctx = flash_offset;
+
+  log->WritePage = &(spill_flash_write_page);
+  log->ReadPage  = &(spill_flash_read_page);
+
+  return log;
+}
+
+#endif
+
+/*************************************************************
+
+  Linux file backend
+
+**************************************************************/
+#if defined(__linux__)
+
+typedef struct __spill_file__ {
+
+  int            fd;
+  const uint8_t* map;
+  size_t         size;
+
+} SpillFile;
+
+static int spill_file_write_page(SpillLog* log, uint32_t page_idx, const SpillPage* page)
+{
+  SpillFile* file = (SpillFile*)log->ctx;
+  off_t offset = (off_t)page_idx*SPILL_PAGE_SIZE;
+
+  if (pwrite(file->fd, page, SPILL_PAGE_SIZE, offset) != SPILL_PAGE_SIZE) {
+    return SPILL_IO_ERROR;
+  }
+  return SPILL_SUCCESS;
+}
+
+/* The shared mapping sees the pwrite()s through the page cache */
+static int spill_file_read_page(SpillLog* log, uint32_t page_idx, SpillPage* page)
+{
+  SpillFile* file = (SpillFile*)log->ctx;
+
+  memcpy(page, file->map + (size_t)page_idx*SPILL_PAGE_SIZE, SPILL_PAGE_SIZE);
+  return SPILL_SUCCESS;
+}
+
+static void spill_file_close(SpillLog* log)
+{
+  SpillFile* file = (SpillFile*)log->ctx;
+
+  if (file->map) munmap((void*)file->map, file->size);
+  if (file->fd >= 0) close(file->fd);
+}
+
+SpillLog* SpillLog_create_file(const char* path, uint32_t n_pages)
+{
+  SpillLog* log;
+  SpillFile* file;
+  void* map;
+  int fd;
+
+  fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) return NULL;
+
+  if (ftruncate(fd, (off_t)n_pages*SPILL_PAGE_SIZE) != 0) {
+    close(fd);
+    return NULL;
+  }
+
+  map = mmap(NULL, (size_t)n_pages*SPILL_PAGE_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED) {
+    close(fd);
+    return NULL;
+  }
+
+  log  = SpillLog_create_skel(n_pages);
+  file = (SpillFile*)malloc(sizeof(SpillFile));
+  file->fd   = fd;
+  file->map  = (const uint8_t*)map;
+  file->size = (size_t)n_pages*SPILL_PAGE_SIZE;
+
+  log->ctx       = file;
+  log->WritePage = &(spill_file_write_page);
+  log->ReadPage  = &(spill_file_read_page);
+  log->Close     = &(spill_file_close);
+
+  return log;
+}
+
+#endif
+
+/*************************************************************
+
+  Constructors and destructors
+
+**************************************************************/
+
+SpillLog* SpillLog_create_skel(uint32_t n_pages)
+{
+  SpillLog* log = (SpillLog*)malloc(sizeof(SpillLog));
+
+  memset(log, 0, sizeof(SpillLog));
+  log->n_pages = n_pages;
+
+  return log;
+}
+
+void SpillLog_destroy(SpillLog* log)
+{
+  if (log) {
+    if (log->Close) log->Close(log);
+    if (log->ctx) free(log->ctx);
+    free(log);
+  }
+}
@@ -0,0 +1,180 @@
+/************************************************************
+
+  A spill log for SWIM-SnH
+
+  Append-only storage that catches the entries the FIFO drops
+  on overflow (FIFO_POLICY_DROP_OLDEST), so that long optical
+  link outages don't lose data. Entries are collected into
+  fixed-size pages protected by a CRC32. Full pages wait in RAM
+  until SpillLog_service() writes them out from the main loop,
+  since a flash write stalls the MCU for tens of ms and the
+  appends come from the FIFO Push. A drain reads the pages back
+  in order.
+
+  Backends:
+  1. RP2040 (Arduino-Pico): on-board flash, past the sketch.
+  2. Linux: a plain file, read back through mmap.
+  3. Anything else: SpillLog_create_skel + own page callbacks.
+
+  Header file
+
+ ************************************************************/
+#ifndef __SWIM_SNH_SPILL_LOG_H__
+#define __SWIM_SNH_SPILL_LOG_H__
+
+/**
+ Some standard includes
+ */
+#include <stdlib.h>
+#include <stdint.h>
+#ifndef __cplusplus
+#include "cbool.h"
+#endif
+
+#include "FIFO.h"
+
+/* One flash program page */
+#define SPILL_PAGE_SIZE              256
+#define SPILL_PAGE_MAGIC             0x5357     /* 'SW' */
+
+/* Full pages held in RAM until SpillLog_service() */
+#ifndef SPILL_PENDING_PAGES
+#define SPILL_PENDING_PAGES          2
+#endif
+
+/* Status codes */
+#define SPILL_SUCCESS                0
+#define SPILL_FULL                   -1
+#define SPILL_IO_ERROR               -2
+
+/**
+ Page layout: 16 byte header and 60 entries.
+ The CRC covers the whole page with the crc field set to 0.
+ */
+typedef struct __spill_page_header__ {
+
+  uint16_t magic;
+  uint16_t count;                  /* Valid entries in this page */
+  uint32_t seq;                    /* Page sequence number */
+  uint32_t crc;
+  uint32_t reserved;
+
+} SpillPageHeader;
+
+#define SPILL_ENTRIES_PER_PAGE \
+  ((SPILL_PAGE_SIZE - sizeof(SpillPageHeader))/sizeof(fifo_data_t))
+
+typedef struct __spill_page__ {
+
+  SpillPageHeader hdr;
+  fifo_data_t     data[SPILL_ENTRIES_PER_PAGE];
+
+} SpillPage;
+
+/**
+ The SpillLog
+ */
+typedef struct __spill_log__ {
+
+  uint32_t  n_pages;               /* Capacity in pages */
+  uint32_t  write_page;            /* Next page slot to write */
+  uint32_t  read_page;             /* Next page slot to drain */
+  uint32_t  seq;                   /* Sequence number of the next page */
+
+  SpillPage wpage;                 /* Page being filled */
+  SpillPage rpage;                 /* Page being drained */
+  uint16_t  rpos;                  /* Next entry in rpage */
+
+  SpillPage pending[SPILL_PENDING_PAGES];  /* Full pages, oldest first */
+  uint8_t   n_pending;
+
+  uint32_t  n_appended;            /* Entries taken in */
+  uint32_t  n_lost;                /* Entries lost because the log was full */
+  uint32_t  n_crc_errors;          /* Pages skipped by the drain */
+
+  void*     ctx;                   /* Backend data */
+
+  int  (*WritePage)(struct __spill_log__*, uint32_t page_idx, const SpillPage*);
+  int  (*ReadPage)(struct __spill_log__*, uint32_t page_idx, SpillPage*);
+  void (*Close)(struct __spill_log__*);
+
+  /* Optional, called when a drain empties the log and writing starts
+     over at page 0. Neither backend here sets it: the flash one erases
+     each sector right before programming its first page, and the file
+     is overwritten in place. */
+  void (*Erase)(struct __spill_log__*);
+
+} SpillLog;
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ Appends an entry, in RAM only: full pages are queued for
+ SpillLog_service(). Once SPILL_PENDING_PAGES are queued and
+ the page being filled is full too, entries are lost.
+ --> SPILL_SUCCESS or SPILL_FULL
+ */
+int SpillLog_append(SpillLog* log, fifo_data_t data);
+
+/**
+ Writes the queued pages out to the backend. Call it from the
+ main loop, where stalling for a flash erase is harmless.
+ --> SPILL_SUCCESS, SPILL_FULL or SPILL_IO_ERROR
+ */
+int SpillLog_service(SpillLog* log);
+
+/**
+ Writes out the queued pages and the partially filled one, if any.
+ */
+int SpillLog_flush(SpillLog* log);
+
+/**
+ Reads up to 'n' of the oldest entries back, in order, from the
+ backend and then from the pages still in RAM.
+ Pages failing the CRC check are skipped.
+ Once everything is drained, the log is erased and reused.
+ --> Number of entries read
+ */
+uint32_t SpillLog_drain(SpillLog* log, fifo_data_t* data, uint32_t n);
+
+/**
+ Number of entries waiting to be drained.
+ */
+uint32_t SpillLog_count(SpillLog* log);
+
+/**
+ CRC32 (IEEE 802.3) used for the pages.
+ */
+uint32_t spill_crc32(const uint8_t* buf, uint32_t len);
+
+/**
+ Constructors and destructors
+ */
+SpillLog* SpillLog_create_skel(uint32_t n_pages);
+
+#if defined(ARDUINO_ARCH_RP2040) && !defined(ARDUINO_ARCH_MBED)
+/**
+ Flash backed log starting at 'flash_offset' bytes into the flash.
+ The region must be sector (4 kB) aligned and must not overlap
+ the sketch or the file system.
+ */
+SpillLog* SpillLog_create_flash(uint32_t flash_offset, uint32_t n_pages);
+#endif
+
+#if defined(__linux__)
+/**
+ File backed log. The file is created or truncated.
+ */
+SpillLog* SpillLog_create_file(const char* path, uint32_t n_pages);
+#endif
+
+void SpillLog_destroy(SpillLog* log);
+
+#ifdef __cplusplus
+} /* Matching } for the extern C */
+#endif
+
+#endif /* Include Guard */
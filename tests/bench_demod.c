@@ -0,0 +1,161 @@
+/************************************************************
+
+  IRDemod benchmark
+
+  Samples per second through the software demodulator, on noisy
+  synthetic photodiode samples (carrier on half the time), for
+  the default block and for sliding windows. Then through to an
+  IRRecv decoder, on transmitter compiled packets. The ratio is
+  against the 500 kHz ADC: how much faster than real time.
+
+ ************************************************************/
+#include "test.h"
+
+#include "IRDemod.h"
+#include "IRTransmit.h"
+
+#define SAMPLE_RATE      500000
+#define CARRIER          38000
+#define N_SAMPLES        500000          /* 1 s */
+#define BENCH_PASSES     40
+#define PACKET_GAP       5000            /* us between packets */
+
+static uint16_t samples[N_SAMPLES];
+
+static double step_phase(double phase)
+{
+  return phase + 6.283185307179586 * CARRIER / SAMPLE_RATE;
+}
+
+static uint16_t adc(double x)
+{
+  return (x < 0) ? 0 : (x > 4095) ? 4095 : (uint16_t)x;
+}
+
+/* Bursts of carrier, 1 ms on, 1 ms off, noise on top */
+static void synth_bursts(uint64_t* seed)
+{
+  double phase = 0;
+
+  for (uint32_t n=0; n<N_SAMPLES; n++) {
+    phase = step_phase(phase);
+    samples[n] = adc(1500 + 20*test_gauss(seed) + (((n/500) & 1) ? 200*sin(phase) : 0));
+  }
+}
+
+/* Packets as the transmitter sends them, PACKET_GAP apart. --> Samples */
+static uint32_t synth_packets(IRTrans* tx, uint64_t* seed, uint32_t* n_packets)
+{
+  IRSchedule* sched = IRSchedule_create(128);
+  uint32_t period = tx->irComm->period;
+  uint32_t n = 0, end, cycles;
+  uint64_t t_us = 0;
+  double   phase = 0;
+
+  *n_packets = 0;
+
+  while (1) {
+    IRTrans_compile(tx, sched, 17, test_rand(seed) & 0x1FFFF);
+
+    cycles = 0;
+    for (uint16_t i=0; i<sched->n_segs; i++) cycles += IRSCHED_CYCLES(sched->seg[i]);
+    if ((t_us + cycles*period + PACKET_GAP) * SAMPLE_RATE / 1000000 > N_SAMPLES) break;
+
+    for (uint16_t i=0; i<=sched->n_segs; i++) {
+      /* Idle line after the packet */
+      uint8_t level = (i < sched->n_segs) ? IRSCHED_LEVEL(sched->seg[i]) : 0;
+
+      t_us += (i < sched->n_segs) ? IRSCHED_CYCLES(sched->seg[i])*period : PACKET_GAP;
+      end = (uint32_t)(t_us * SAMPLE_RATE / 1000000);
+
+      for (; n<end; n++) {
+        phase = step_phase(phase);
+        samples[n] = adc(1500 + 20*test_gauss(seed) + (level ? 200*sin(phase) : 0));
+      }
+    }
+    (*n_packets)++;
+  }
+
+  IRSchedule_destroy(sched);
+  return n;
+}
+
+/* Msamples/s, the demodulator alone */
+static double bench_alone(IRDemod* demod)
+{
+  uint64_t used = 0;
+  double t0 = bench_now();
+
+  for (int k=0; k<BENCH_PASSES; k++) {
+    used += IRDemod_process(demod, samples, N_SAMPLES);
+  }
+
+  bench_sink = demod->n_runs;
+  return used/(bench_now() - t0)/1e6;
+}
+
+/* Msamples/s into a decoder, and the packets it got right per pass */
+static double bench_decode(IRDemod* demod, IRRecv* rx, uint32_t n, uint32_t* n_ok)
+{
+  uint64_t total = 0;
+  uint32_t used;
+  double t0 = bench_now();
+
+  *n_ok = 0;
+  for (int k=0; k<BENCH_PASSES; k++) {
+    IRRecv_begin_packet(rx, 18);
+    used = 0;
+    while (used < n) {
+      used += IRDemod_process(demod, &(samples[used]), n - used);
+      if (demod->status == IRRECV_PKT_READY) {
+        (*n_ok)++;
+        IRRecv_begin_packet(rx, 18);
+      }
+    }
+    total += used;
+  }
+
+  *n_ok /= BENCH_PASSES;
+  return total/(bench_now() - t0)/1e6;
+}
+
+int main(void)
+{
+  static const struct { uint16_t window; uint8_t hops; } cfgs[] = {
+    { 0, 1 }, { 52, 2 }, { 104, 4 }, { 128, 8 }
+  };
+  IRTrans* tx = IRTrans_create(3);
+  IRRecv* rx = IRRecv_create(2);
+  IRDemod* demod;
+  uint64_t seed = 1;
+  uint32_t n, n_packets, n_ok;
+  double msps;
+
+  synth_bursts(&seed);
+
+  printf("demodulator alone          Msamples/s  x real time\n");
+  for (unsigned c=0; c<sizeof(cfgs)/sizeof(cfgs[0]); c++) {
+    demod = cfgs[c].window ?
+      IRDemod_create_with_window(SAMPLE_RATE, CARRIER, cfgs[c].window, cfgs[c].hops) :
+      IRDemod_create(SAMPLE_RATE, CARRIER);
+
+    msps = bench_alone(demod);
+    printf("  window %3u, %u hop(s)      %8.1f  %11.0f\n", demod->window, demod->hops,
+      msps, msps*1e6/SAMPLE_RATE);
+    IRDemod_destroy(demod);
+  }
+
+  n = synth_packets(tx, &seed, &n_packets);
+  IRRecv_enable_filter(rx, 0, 0);
+  demod = IRDemod_create_for_irrecv(SAMPLE_RATE, rx);
+
+  msps = bench_decode(demod, rx, n, &n_ok);
+  printf("into the decoder, 17 bits  %8.1f  %11.0f  (%u/%u packets)\n",
+    msps, msps*1e6/SAMPLE_RATE, n_ok, n_packets);
+
+  IRDemod_destroy(demod);
+  IRRecv_destroy(rx);
+  IRTrans_destroy(tx);
+
+  return 0;
+}
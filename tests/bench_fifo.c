@@ -0,0 +1,194 @@
+/************************************************************
+
+  FIFO benchmark
+
+  The ring buffer against the linked list it replaced (kept
+  here as it was: malloc per push, a walk to the node before
+  the last one on every pop and every drop). The load is the
+  READ_ALL cycle: fill up to depth, then drain it all.
+  Then the packed storages against the word one: the same
+  cycle, and the bytes each one takes.
+
+ ************************************************************/
+#include "test.h"
+
+#include "FIFO.h"
+
+/*************************************************************
+
+  The linked-list FIFO, as it was
+
+**************************************************************/
+typedef struct __list_node__ {
+  fifo_data_t data;
+  struct __list_node__* next;
+} ListNode;
+
+typedef struct __list_fifo__ {
+  uint32_t  n_nodes;
+  uint32_t  depth;
+  ListNode* first_node;
+  ListNode* last_node;
+} ListFIFO;
+
+static void list_push(ListFIFO* fifo, fifo_data_t data)
+{
+  ListNode* tmp;
+
+  if (fifo->n_nodes >= fifo->depth) {
+    ListNode* del_tmp = fifo->last_node;
+    ListNode* del_tmp_prev = fifo->first_node;
+
+    while (del_tmp_prev->next != fifo->last_node) del_tmp_prev = del_tmp_prev->next;
+
+    fifo->last_node = del_tmp_prev;
+    fifo->last_node->next = NULL;
+
+    free(del_tmp);
+    fifo->n_nodes--;
+  }
+
+  tmp = (ListNode*)malloc(sizeof(ListNode));
+  tmp->data = data;
+  tmp->next = fifo->first_node;
+  fifo->first_node = tmp;
+  if (!fifo->last_node) fifo->last_node = tmp;
+  fifo->n_nodes++;
+}
+
+static fifo_data_t list_pop(ListFIFO* fifo)
+{
+  ListNode* tmp = fifo->last_node;
+  ListNode* tmp_prev;
+  fifo_data_t ret_data;
+
+  if (!tmp) return 0;
+  ret_data = tmp->data;
+
+  if (fifo->first_node == fifo->last_node) {
+    fifo->first_node = NULL;
+    fifo->last_node = NULL;
+    free(tmp);
+    fifo->n_nodes = 0;
+    return ret_data;
+  }
+
+  tmp_prev = fifo->first_node;
+  while (tmp_prev->next != fifo->last_node) tmp_prev = tmp_prev->next;
+  fifo->last_node = tmp_prev;
+  fifo->last_node->next = NULL;
+
+  fifo->n_nodes--;
+  free(tmp);
+
+  return ret_data;
+}
+
+/*************************************************************
+
+  The benchmark
+
+**************************************************************/
+/* ns per entry (one push and one pop) over 'cycles' fill/drain cycles */
+static double bench_fill_drain(FIFO* fifo, uint32_t cycles)
+{
+  uint32_t depth = fifo->depth;
+  uint64_t sum = 0;
+  double t0 = bench_now();
+
+  for (uint32_t c=0; c<cycles; c++) {
+    /* Address in bits 15..19, as the sampling code pushes them */
+    for (uint32_t i=0; i<depth; i++) fifo->Push(fifo, ((i & 0x1F) << 15) | (i & 0xFFF));
+    while (fifo->n_nodes) sum += fifo->Pop(fifo);
+  }
+
+  bench_sink = sum;
+
+  return (bench_now() - t0) * 1e9 / ((double)depth*cycles);
+}
+
+static double bench_ring(uint32_t depth, uint32_t cycles)
+{
+  FIFO* fifo = FIFO_create(depth);
+  double ns = bench_fill_drain(fifo, cycles);
+
+  FIFO_destroy(fifo);
+  return ns;
+}
+
+static double bench_list(uint32_t depth, uint32_t cycles)
+{
+  ListFIFO fifo = { 0, depth, NULL, NULL };
+  uint64_t sum = 0;
+  double t0 = bench_now();
+
+  for (uint32_t c=0; c<cycles; c++) {
+    for (uint32_t i=0; i<depth; i++) list_push(&fifo, i & 0xFFF);
+    while (fifo.n_nodes) sum += list_pop(&fifo);
+  }
+
+  bench_sink = sum;
+
+  return (bench_now() - t0) * 1e9 / ((double)depth*cycles);
+}
+
+/* Overflowing: every push past the depth drops the oldest entry */
+static double bench_ring_overflow(uint32_t depth, uint32_t n)
+{
+  FIFO* fifo = FIFO_create(depth);
+  double t0 = bench_now();
+
+  for (uint32_t i=0; i<n; i++) fifo->Push(fifo, i & 0xFFF);
+
+  FIFO_destroy(fifo);
+  return (bench_now() - t0) * 1e9 / n;
+}
+
+static double bench_list_overflow(uint32_t depth, uint32_t n)
+{
+  ListFIFO fifo = { 0, depth, NULL, NULL };
+  double t0 = bench_now();
+
+  for (uint32_t i=0; i<n; i++) list_push(&fifo, i & 0xFFF);
+
+  while (fifo.n_nodes) list_pop(&fifo);
+  return (bench_now() - t0) * 1e9 / n;
+}
+
+int main(void)
+{
+  static const uint32_t depths[] = { 30, 256, 1024 };
+
+  printf("fill/drain, ns per entry       ring      list\n");
+  for (unsigned k=0; k<sizeof(depths)/sizeof(depths[0]); k++) {
+    uint32_t cycles = 2000000 / (depths[k]*depths[k]/16 + depths[k]);
+
+    printf("  depth %5u               %8.1f  %8.1f\n", depths[k],
+      bench_ring(depths[k], cycles*50), bench_list(depths[k], cycles));
+  }
+
+  printf("overflowing push, ns per entry\n");
+  for (unsigned k=0; k<sizeof(depths)/sizeof(depths[0]); k++) {
+    printf("  depth %5u               %8.1f  %8.1f\n", depths[k],
+      bench_ring_overflow(depths[k], 2000000), bench_list_overflow(depths[k], 200000));
+  }
+
+  printf("packed storage                 ns/entry  storage  footprint (bytes)\n");
+  for (unsigned k=0; k<sizeof(depths)/sizeof(depths[0]); k++) {
+    static const uint8_t bits[] = {
+      FIFO_STORAGE_WORD, FIFO_STORAGE_PACKED24, FIFO_STORAGE_PACKED17
+    };
+
+    for (unsigned b=0; b<sizeof(bits); b++) {
+      FIFO* fifo = (bits[b] == FIFO_STORAGE_WORD) ?
+        FIFO_create(depths[k]) : FIFO_create_packed(depths[k], bits[b]);
+
+      printf("  depth %5u, %2u bit entries %8.1f %8u %8u\n", depths[k], bits[b],
+        bench_fill_drain(fifo, 20000000 / depths[k]),
+        FIFO_storage_bytes(fifo), FIFO_footprint(fifo));
+      FIFO_destroy(fifo);
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,123 @@
+/************************************************************
+
+  IRFilter benchmark
+
+  Packets recovered per 1000 sent, with and without the glitch
+  filter, as the demodulated output gets noisier. Every run of
+  the transmitter compiled packet is hit with probability p:
+    pulse --> split by a dropout of 1..6 carrier periods
+    low   --> a glitch of 1..6 carrier periods in the middle
+  The filter defaults are 4 periods, so the longer ones get
+  through it. Both go through IRRecv_feed_run, the filter in
+  front or not.
+
+ ************************************************************/
+#include "test.h"
+
+#include "IRRecv.h"
+#include "IRTransmit.h"
+
+#define BENCH_SENT       1000
+#define MAX_RUNS         2048
+
+typedef struct {
+  uint8_t  level;
+  uint32_t us;
+} Run;
+
+static Run runs[MAX_RUNS];
+static uint32_t n_runs;
+
+static void add_run(uint8_t level, uint32_t us)
+{
+  runs[n_runs].level = level;
+  runs[n_runs].us    = us;
+  n_runs++;
+}
+
+static double uniform(uint64_t* seed)
+{
+  return (test_rand(seed) >> 11) / 9007199254740992.0;
+}
+
+/* A run, split in three by a short run of the other level with probability p */
+static void noisy_run(uint8_t level, uint32_t us, uint32_t period, double p, uint64_t* seed)
+{
+  uint32_t head, blip;
+
+  if (uniform(seed) >= p) {
+    add_run(level, us);
+    return;
+  }
+
+  blip = period*(uint32_t)(1 + test_rand(seed) % 6);
+  head = (uint32_t)(us*(0.2 + 0.6*uniform(seed)));
+  if (head + blip >= us) blip = us - head - 1;
+
+  add_run(level, head);
+  add_run(!level, blip);
+  add_run(level, us - head - blip);
+}
+
+static void packet_runs(IRTrans* tx, IRSchedule* sched, uint64_t packet, double p, uint64_t* seed)
+{
+  uint32_t period = tx->irComm->period;
+
+  IRTrans_compile(tx, sched, 17, packet);
+
+  n_runs = 0;
+  noisy_run(0, 40*period, period, p, seed);
+  for (uint16_t i=0; i<sched->n_segs; i++) {
+    noisy_run(IRSCHED_LEVEL(sched->seg[i]), IRSCHED_CYCLES(sched->seg[i])*period, period, p, seed);
+  }
+  add_run(0, PULSE_TIMEOUT);
+  add_run(1, PULSE_TIMEOUT);
+}
+
+/* Packets out of BENCH_SENT that came out right */
+static uint32_t bench_run(bool filter, double p)
+{
+  IRTrans* tx = IRTrans_create(3);
+  IRRecv* rx = IRRecv_create(2);
+  IRSchedule* sched = IRSchedule_create(128);
+  uint64_t seed = 1, packet;
+  uint32_t ok = 0, i;
+  int status;
+
+  if (filter) IRRecv_enable_filter(rx, 0, 0);
+
+  for (uint32_t k=0; k<BENCH_SENT; k++) {
+    packet = test_rand(&seed) & 0x1FFFF;
+    packet_runs(tx, sched, packet, p, &seed);
+
+    IRRecv_begin_packet(rx, 18);
+    if (rx->filter) IRFilter_reset(rx->filter);
+    rx->run_low = 0;
+
+    status = IRRECV_NEED_MORE;
+    for (i=0; i<n_runs && status == IRRECV_NEED_MORE; i++) {
+      status = IRRecv_feed_run(rx, runs[i].level, runs[i].us);
+    }
+
+    if (status == IRRECV_PKT_READY && rx->packet == IRTrans_frame(tx, 17, packet)) ok++;
+  }
+
+  IRSchedule_destroy(sched);
+  IRRecv_destroy(rx);
+  IRTrans_destroy(tx);
+
+  return ok;
+}
+
+int main(void)
+{
+  static const double ps[] = { 0, 0.005, 0.01, 0.02, 0.05, 0.1, 0.2, 0.4 };
+
+  printf("17 bit packets recovered per %u sent\n", BENCH_SENT);
+  printf("  noise p      raw  filtered\n");
+  for (unsigned k=0; k<sizeof(ps)/sizeof(ps[0]); k++) {
+    printf("  %7.3f  %7u  %8u\n", ps[k], bench_run(false, ps[k]), bench_run(true, ps[k]));
+  }
+
+  return 0;
+}
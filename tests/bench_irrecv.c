@@ -0,0 +1,129 @@
+/************************************************************
+
+  IRRecv decode benchmark
+
+  Decode throughput of the incremental decoder, fed the pulses
+  of transmitter compiled packets, and of the capture path:
+  edges into the queue, then IRRecv_poll. Soft decisions on
+  and off, for a 17 bit and a 63 bit payload.
+
+ ************************************************************/
+#include "test.h"
+
+#include "IRRecv.h"
+#include "IRTransmit.h"
+
+#define BENCH_PACKETS    200000
+#define MAX_RUNS         (2*(PREAMBLE_RUNS + 4*(IRRECV_MAX_BITS + 1)))
+
+static uint32_t pulses[MAX_RUNS], lows[MAX_RUNS];
+
+/* The pulses of the packet, and the low before each */
+static uint32_t packet_pulses(IRTrans* tx, uint8_t bits, uint64_t packet)
+{
+  IRSchedule* sched = IRSchedule_create(64);
+  uint32_t period = tx->irComm->period;
+  uint32_t n = 0, low = 0;
+
+  IRTrans_compile(tx, sched, bits, packet);
+
+  for (uint16_t i=0; i<sched->n_segs; i++) {
+    uint32_t us = IRSCHED_CYCLES(sched->seg[i])*period;
+
+    if (!IRSCHED_LEVEL(sched->seg[i])) {
+      low += us;
+      continue;
+    }
+    lows[n] = low;
+    pulses[n++] = us;
+    low = 0;
+  }
+
+  IRSchedule_destroy(sched);
+  return n;
+}
+
+/* Packets/s, and Mpulses/s in *mpps (pulses fed: early accept stops short) */
+static double bench_feed(IRRecv* rx, uint8_t bits, uint32_t n, double* mpps)
+{
+  uint64_t n_fed = 0;
+  uint32_t ok = 0, i;
+  double t0 = bench_now(), dt;
+
+  for (uint32_t k=0; k<BENCH_PACKETS; k++) {
+    IRRecv_begin_packet(rx, bits);
+    for (i=0; i<n; i++) {
+      if (IRRecv_feed(rx, lows[i], pulses[i]) == IRRECV_PKT_READY) {
+        ok++;
+        break;
+      }
+    }
+    n_fed += (i < n) ? i + 1 : n;
+  }
+
+  dt = bench_now() - t0;
+  bench_sink = ok;
+
+  *mpps = n_fed/dt/1e6;
+  return ok/dt;
+}
+
+static double bench_capture(IRRecv* rx, uint8_t bits, uint32_t n)
+{
+  uint32_t ok = 0, t = rx->last_edge;
+  double t0 = bench_now(), dt;
+
+  for (uint32_t k=0; k<BENCH_PACKETS; k++) {
+    IRRecv_begin_packet(rx, bits);
+    for (uint32_t i=0; i<n; i++) {
+      t += lows[i];
+      IRRecv_feed_edge(rx, t, 1);
+      t += pulses[i];
+      IRRecv_feed_edge(rx, t, 0);
+
+      /* The clock has to keep up, or the poll sees the signal stop */
+      host_clock_set(t);
+
+      /* Drained as it goes, as the main loop would */
+      if (SPSCFIFO_count(rx->edges) > IRRECV_EDGE_DEPTH/2 && IRRecv_poll(rx) == IRRECV_PKT_READY) {
+        ok++;
+      }
+    }
+    if (IRRecv_poll(rx) == IRRECV_PKT_READY) ok++;
+    while (SPSCFIFO_count(rx->edges)) IRRecv_poll(rx);
+  }
+
+  dt = bench_now() - t0;
+  bench_sink = ok;
+
+  return ok/dt;
+}
+
+int main(void)
+{
+  static const uint8_t widths[] = { 17, 63 };
+  IRTrans* tx = IRTrans_create(3);
+  IRRecv* rx = IRRecv_create(2);
+  double mpps, pps;
+
+  IRRecv_enable_capture(rx, 0);
+  rx->early_accept = true;
+
+  printf("decode, packets/s (Mpulses/s)   feed               capture\n");
+  for (unsigned w=0; w<sizeof(widths); w++) {
+    uint32_t n = packet_pulses(tx, widths[w], 0x5A5A5A5A5A5A5A5AULL);
+
+    for (int soft=1; soft>=0; soft--) {
+      rx->soft_decision = soft;
+      pps = bench_feed(rx, widths[w] + 1, n, &mpps);
+      printf("  %2u bits, %s          %9.0f (%5.1f)  %9.0f\n", widths[w],
+        soft ? "soft" : "hard", pps, mpps, bench_capture(rx, widths[w] + 1, n));
+    }
+  }
+
+  IRRecv_disable_capture(rx);
+  IRRecv_destroy(rx);
+  IRTrans_destroy(tx);
+
+  return 0;
+}
@@ -0,0 +1,140 @@
+/************************************************************
+
+  IRRecv_listen benchmark
+
+  Energy and latency of duty-cycled listening, for a few listen
+  periods. Each command comes at a random time: a wake-up train
+  of a period and a window (as send_wakeup_train sends it),
+  then the transmitter compiled packet. The receiver polls the
+  demodulated line on the simulated clock, and its Sleep hook
+  just moves the clock on.
+
+  Latency is from the start of the train to the packet, against
+  the bound of a period, a window and the airtime. Energy is per
+  command, against the receiver always on, with 5 mA awake,
+  50 uA asleep, at 3.3 V.
+
+ ************************************************************/
+#include "test.h"
+
+#include "IRRecv.h"
+#include "IRTransmit.h"
+
+#define N_COMMANDS       100
+#define MAX_RUNS         40000
+#define COMMAND_BITS     8
+
+#define ACTIVE_UA        5000
+#define SLEEP_UA         50
+#define SUPPLY_MV        3300
+
+/* The line: level of each run, and when it starts */
+static uint64_t run_start[MAX_RUNS];
+static uint8_t  run_level[MAX_RUNS];
+static uint32_t n_runs, cur;
+
+static void add_run(uint64_t* t, uint8_t level, uint32_t us)
+{
+  run_start[n_runs] = *t;
+  run_level[n_runs] = level;
+  n_runs++;
+  *t += us;
+}
+
+/* Demodulated output, 1 while the carrier is on */
+static int read_line(IRRecv* irRecv)
+{
+  uint64_t now = host_clock_now();
+
+  (void)irRecv;
+  while (cur + 1 < n_runs && run_start[cur + 1] <= now) cur++;
+
+  return (n_runs && run_start[cur] <= now) ? run_level[cur] : 0;
+}
+
+static void sleep_line(IRRecv* irRecv, uint32_t duration)
+{
+  (void)irRecv;
+  host_clock_advance(duration);
+}
+
+/* The wake-up train and the packet, from 't' */
+static void command_runs(IRTrans* tx, IRRecv* rx, IRSchedule* sched, uint64_t t, uint64_t packet)
+{
+  uint32_t period = tx->irComm->period;
+  uint32_t symbol = (PULSES_FOR_WAKEUP_ONE + PULSES_FOR_WAKEUP_EMPTY)*period;
+  uint32_t train = rx->listen_period_us + rx->listen_window_us;
+
+  n_runs = 0;
+  cur = 0;
+
+  for (uint32_t i=0; i<(train + symbol - 1)/symbol; i++) {
+    add_run(&t, 1, PULSES_FOR_WAKEUP_ONE*period);
+    add_run(&t, 0, PULSES_FOR_WAKEUP_EMPTY*period);
+  }
+
+  IRTrans_compile(tx, sched, COMMAND_BITS, packet);
+  for (uint16_t i=0; i<sched->n_segs; i++) {
+    add_run(&t, IRSCHED_LEVEL(sched->seg[i]), IRSCHED_CYCLES(sched->seg[i])*period);
+  }
+  add_run(&t, 0, 0);
+}
+
+static void bench_period(IRTrans* tx, IRSchedule* sched, uint32_t period_us)
+{
+  IRRecv* rx = IRRecv_create(2);
+  uint64_t seed = 9, t0, arrival, latency, lat_sum = 0, lat_max = 0, packet, buf;
+  uint32_t ok = 0, airtime, bound;
+  double   total, always_on_uj;
+
+  host_reset();
+  rx->ReadIRPin = &read_line;
+  rx->Sleep     = &sleep_line;
+  IRRecv_set_listen(rx, period_us, 0);
+
+  t0 = host_clock_now();
+  for (int k=0; k<N_COMMANDS; k++) {
+    arrival = host_clock_now() + 1000 + test_rand(&seed) % (3ULL*period_us);
+    packet  = test_rand(&seed) & ((1 << COMMAND_BITS) - 1);
+    command_runs(tx, rx, sched, arrival, packet);
+
+    if (IRRecv_listen(rx, &buf, COMMAND_BITS + 1) == IRRECV_PKT_READY &&
+        buf == IRTrans_frame(tx, COMMAND_BITS, packet)) {
+      latency = host_clock_now() - arrival;
+      lat_sum += latency;
+      if (latency > lat_max) lat_max = latency;
+      ok++;
+    }
+  }
+
+  total   = (double)(host_clock_now() - t0);
+  airtime = IRRecv_packet_airtime(rx, COMMAND_BITS + 1);
+  bound   = period_us + rx->listen_window_us + airtime;
+  always_on_uj = total*ACTIVE_UA*SUPPLY_MV/1e9/(ok ? ok : 1);
+
+  printf("  %4u ms  %3u/%u  %7.1f  %7.1f  %7.1f  %6.2f%%  %8u  %8.0f\n",
+    period_us/1000, ok, N_COMMANDS,
+    ok ? lat_sum/(double)ok/1000 : 0, lat_max/1000.0, bound/1000.0,
+    100.0*rx->listen.awake_us/total,
+    IRRecv_listen_energy_uj(rx, ACTIVE_UA, SLEEP_UA, SUPPLY_MV), always_on_uj);
+
+  IRRecv_destroy(rx);
+}
+
+int main(void)
+{
+  static const uint32_t periods[] = { 50000, 100000, 250000, 500000, 1000000 };
+  IRTrans* tx = IRTrans_create(3);
+  IRSchedule* sched = IRSchedule_create(64);
+
+  printf("%u commands of %u bits, arriving at random\n", N_COMMANDS, COMMAND_BITS);
+  printf("  period  cmds    mean ms   max ms  bound ms  awake    uJ/cmd  always on\n");
+  for (unsigned p=0; p<sizeof(periods)/sizeof(periods[0]); p++) {
+    bench_period(tx, sched, periods[p]);
+  }
+
+  IRSchedule_destroy(sched);
+  IRTrans_destroy(tx);
+
+  return 0;
+}
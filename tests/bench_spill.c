@@ -0,0 +1,77 @@
+/************************************************************
+
+  SpillLog benchmark
+
+  Append and drain rates through the Linux file backend, with
+  the FIFO in front as in a link outage: every Push past the
+  depth spills, and the main loop writes each page out once
+  it is queued.
+
+ ************************************************************/
+#include "test.h"
+
+#include <unistd.h>
+
+#include "FIFO.h"
+#include "SpillLog.h"
+
+#define BENCH_PAGES      1024
+
+int main(void)
+{
+  char path[] = "/tmp/bench_spill_XXXXXX";
+  int fd = mkstemp(path);
+  uint32_t n = BENCH_PAGES*SPILL_ENTRIES_PER_PAGE;
+  fifo_data_t buf[32];
+  uint64_t sum = 0;
+  double t0, push_s = 0, service_s = 0, drain_s;
+  uint32_t got = 0, k;
+  SpillLog* log;
+  FIFO* fifo;
+
+  if (fd < 0) return 1;
+  close(fd);
+
+  log  = SpillLog_create_file(path, BENCH_PAGES);
+  fifo = FIFO_create(30);
+  FIFO_attach_spill(fifo, log);
+
+  for (int round=0; round<3; round++) {
+    for (uint32_t i=0; i<n + 30; i++) {
+      t0 = bench_now();
+      fifo->Push(fifo, i & 0xFFF);
+      push_s += bench_now() - t0;
+
+      /* The main loop, once a page is queued */
+      if (log->n_pending) {
+        t0 = bench_now();
+        SpillLog_service(log);
+        service_s += bench_now() - t0;
+      }
+    }
+
+    t0 = bench_now();
+    while ((k = SpillLog_drain(log, buf, 32)) > 0) {
+      for (uint32_t j=0; j<k; j++) sum += buf[j];
+      got += k;
+    }
+    drain_s = bench_now() - t0;
+
+    while (fifo->n_nodes) fifo->Pop(fifo);
+  }
+
+  bench_sink = sum;
+
+  printf("spill through the file backend, %u pages x 3\n", BENCH_PAGES);
+  printf("  push + append     %8.1f ns/entry\n", push_s*1e9/(3.0*(n + 30)));
+  printf("  service           %8.1f us/page\n", service_s*1e6/(3.0*BENCH_PAGES));
+  printf("  drain             %8.1f ns/entry (last round)\n", drain_s*1e9/n);
+  printf("  drained %u of %u, lost %u, crc errors %u\n",
+    got, 3*n, log->n_lost, log->n_crc_errors);
+
+  FIFO_destroy(fifo);
+  SpillLog_destroy(log);
+  unlink(path);
+
+  return 0;
+}
@@ -0,0 +1,99 @@
+/************************************************************
+
+  SPSCFIFO benchmark
+
+  Throughput between two threads, entry by entry and by
+  batches of 32, for a few capacities. Both sides yield when
+  the FIFO is full or empty, so it runs on one core as well
+  (then it mostly measures the handoff per time slice).
+
+ ************************************************************/
+#include "test.h"
+
+#include <pthread.h>
+#include <sched.h>
+
+#include "SPSCFIFO.h"
+
+#define BENCH_ENTRIES    20000000u
+#define BENCH_BATCH      32
+
+typedef struct {
+  SPSCFIFO* fifo;
+  int       batch;
+} BenchArgs;
+
+static void* bench_producer(void* arg)
+{
+  BenchArgs* a = (BenchArgs*)arg;
+  fifo_data_t* span;
+  uint32_t next = 0, n, k;
+
+  while (next < BENCH_ENTRIES) {
+    if (!a->batch) {
+      if (push_spsc_fifo(a->fifo, next) == SPSC_SUCCESS) next++;
+      else sched_yield();
+      continue;
+    }
+
+    n = SPSCFIFO_reserve(a->fifo, &span, BENCH_BATCH);
+    for (k=0; k<n && next<BENCH_ENTRIES; k++) span[k] = next++;
+    if (k) SPSCFIFO_commit(a->fifo, k);
+    else sched_yield();
+  }
+
+  return NULL;
+}
+
+/* Mentries/s */
+static double bench_run(uint32_t capacity, int batch)
+{
+  SPSCFIFO* fifo = SPSCFIFO_create(capacity);
+  BenchArgs args = { fifo, batch };
+  const fifo_data_t* span;
+  fifo_data_t data;
+  uint64_t sum = 0;
+  uint32_t got = 0, n, k;
+  pthread_t producer;
+  double t0 = bench_now(), dt;
+
+  pthread_create(&producer, NULL, &bench_producer, &args);
+
+  while (got < BENCH_ENTRIES) {
+    if (!batch) {
+      if (pop_spsc_fifo(fifo, &data) == SPSC_SUCCESS) {
+        sum += data;
+        got++;
+      }
+      else sched_yield();
+      continue;
+    }
+
+    n = SPSCFIFO_peek(fifo, &span, BENCH_BATCH);
+    for (k=0; k<n; k++) sum += span[k];
+    if (n) SPSCFIFO_release(fifo, n);
+    else sched_yield();
+    got += n;
+  }
+
+  pthread_join(producer, NULL);
+  dt = bench_now() - t0;
+
+  bench_sink = sum;
+  SPSCFIFO_destroy(fifo);
+
+  return BENCH_ENTRIES / dt / 1e6;
+}
+
+int main(void)
+{
+  static const uint32_t caps[] = { 64, 1024, 16384 };
+
+  printf("two threads, Mentries/s    single     batch%d\n", BENCH_BATCH);
+  for (unsigned k=0; k<sizeof(caps)/sizeof(caps[0]); k++) {
+    printf("  capacity %6u         %8.1f  %8.1f\n", caps[k],
+      bench_run(caps[k], 0), bench_run(caps[k], 1));
+  }
+
+  return 0;
+}
@@ -0,0 +1,87 @@
+/************************************************************
+
+  Vote benchmark
+
+  The word-parallel majority kernel (vote() in IRRecv.c)
+  against the per-bit loop it replaced, kept here as it was.
+  Both are run on the same random copies first, and have to
+  agree on every one.
+
+ ************************************************************/
+#include "test.h"
+
+/* IRRecv.c, not in the header */
+uint64_t vote(uint64_t* data_set, uint8_t n_data, uint8_t bits);
+
+/* The per-bit loop, as it was */
+static uint64_t vote_loop(uint64_t* data_set, uint8_t n_data, uint8_t bits)
+{
+  int i, di;
+  uint64_t data = 0;
+  uint32_t n_ones, n_zeros;
+
+  if (n_data <= 1) return data_set[0];
+
+  for(i=bits-1; i>=0; i--) {
+    n_ones = 0;
+    n_zeros = 0;
+
+    for (di=0; di<n_data; ++di) {
+      ((data_set[di]>>i) & 0x1) ? n_ones++ : n_zeros++ ;
+    }
+
+    if (n_ones >= n_zeros) data |= ((uint64_t)1<<i);
+  }
+
+  return data;
+}
+
+#define BENCH_VOTES      2000000
+
+/* ns per vote */
+static double bench_run(uint64_t (*fn)(uint64_t*, uint8_t, uint8_t),
+  uint64_t* copies, uint8_t n, uint8_t bits)
+{
+  uint64_t sum = 0;
+  double t0 = bench_now();
+
+  for (uint32_t k=0; k<BENCH_VOTES; k++) {
+    copies[0] ^= k;
+    sum += fn(copies, n, bits);
+  }
+
+  bench_sink = sum;
+  return (bench_now() - t0)*1e9/BENCH_VOTES;
+}
+
+int main(void)
+{
+  static const uint8_t ns[] = { 3, 5, 7, 15 };
+  static const uint8_t widths[] = { 18, 64 };
+  uint64_t copies[255], seed = 1;
+  uint32_t bad = 0;
+
+  /* Same answers, any number of copies and width */
+  for (uint32_t t=0; t<200000; t++) {
+    uint8_t n = (uint8_t)(1 + test_rand(&seed) % ((t % 10) ? 9 : 255));
+    uint8_t bits = (uint8_t)(1 + test_rand(&seed) % 64);
+    uint64_t mask = (bits >= 64) ? ~0ULL : ((1ULL << bits) - 1);
+
+    for (uint8_t j=0; j<n; j++) copies[j] = test_rand(&seed) & mask;
+    if (vote(copies, n, bits) != vote_loop(copies, n, bits)) bad++;
+  }
+  printf("kernel vs loop, 200000 random votes: %u mismatch(es)\n", bad);
+
+  printf("ns per vote                 loop    kernel\n");
+  for (unsigned w=0; w<sizeof(widths); w++) {
+    for (unsigned k=0; k<sizeof(ns); k++) {
+      for (uint8_t j=0; j<ns[k]; j++) copies[j] = test_rand(&seed);
+
+      printf("  %2u copies, %2u bits  %8.1f  %8.1f\n", ns[k], widths[w],
+        bench_run(&vote_loop, copies, ns[k], widths[w]),
+        bench_run(&vote, copies, ns[k], widths[w]));
+    }
+  }
+
+  return bad ? 1 : 0;
+}
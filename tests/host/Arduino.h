@@ -0,0 +1,82 @@
+/************************************************************
+
+  Host stand-in for Arduino.h, for the SWIM tests
+
+  Enough of the Arduino API for the libraries to build and run
+  on Linux. The clock is simulated: micros() and millis() move
+  it on by a fixed step per call, and the tests move it on as
+  they like.
+  The pins are plain levels, with the CHANGE interrupts fired
+  when a test sets them.
+
+  Header file.
+
+ ************************************************************/
+#ifndef __HOST_ARDUINO_H__
+#define __HOST_ARDUINO_H__
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#define HIGH                 1
+#define LOW                  0
+
+#define INPUT                0
+#define OUTPUT               1
+
+#define CHANGE               1
+#define FALLING              2
+#define RISING               3
+
+#define HOST_N_PINS          64
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ *
+ * The Arduino API
+ *
+ */
+uint32_t micros(void);
+uint32_t millis(void);
+void     delay(uint32_t ms);
+void     delayMicroseconds(uint32_t us);
+
+void     pinMode(uint8_t pin, uint8_t mode);
+int      digitalRead(uint8_t pin);
+void     digitalWrite(uint8_t pin, uint8_t level);
+
+int      digitalPinToInterrupt(uint8_t pin);
+void     attachInterrupt(uint8_t irq, void (*isr)(void), int mode);
+void     detachInterrupt(uint8_t irq);
+void     noInterrupts(void);
+void     interrupts(void);
+
+/**
+ *
+ * Test controls
+ *
+ */
+/* Simulated time in us, and how much each micros() or millis() call moves it on */
+void     host_clock_set(uint64_t now_us);
+uint64_t host_clock_now(void);
+void     host_clock_advance(uint64_t us);
+void     host_clock_step(uint32_t us_per_call);
+
+/* Sets an input level, firing its CHANGE interrupt if it changed */
+void     host_pin_set(uint8_t pin, uint8_t level);
+
+/* Called on every digitalWrite(), at host_clock_now() */
+typedef void (*HostWriteHook)(uint8_t pin, uint8_t level);
+void     host_on_write(HostWriteHook hook);
+
+/* Back to time 0, step 1 us, pins HIGH, no hooks or interrupts */
+void     host_reset(void);
+
+#ifdef __cplusplus
+} /* Matching } for the extern C */
+#endif
+
+#endif /* Include Guard */
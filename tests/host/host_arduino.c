@@ -0,0 +1,138 @@
+/************************************************************
+
+  Host stand-in for Arduino.h, for the SWIM tests
+
+  Simulated clock and pins.
+
+  Implementation file.
+
+ ************************************************************/
+#include "Arduino.h"
+
+static uint64_t      host_now;
+static uint32_t      host_step = 1;
+static uint8_t       host_low[HOST_N_PINS];      /* Zeroed: all pins HIGH */
+static void        (*host_isr[HOST_N_PINS])(void);
+static HostWriteHook host_write_hook;
+
+/*************************************************************
+
+  The Arduino API
+
+**************************************************************/
+
+uint32_t micros(void)
+{
+  host_now += host_step;
+  return (uint32_t)host_now;
+}
+
+uint32_t millis(void)
+{
+  host_now += host_step;
+  return (uint32_t)(host_now/1000);
+}
+
+void delay(uint32_t ms)
+{
+  host_now += (uint64_t)ms*1000;
+}
+
+void delayMicroseconds(uint32_t us)
+{
+  host_now += us;
+}
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+  (void)pin;
+  (void)mode;
+}
+
+int digitalRead(uint8_t pin)
+{
+  return (pin < HOST_N_PINS && host_low[pin]) ? LOW : HIGH;
+}
+
+void digitalWrite(uint8_t pin, uint8_t level)
+{
+  if (pin < HOST_N_PINS) host_low[pin] = !level;
+  if (host_write_hook) host_write_hook(pin, level);
+}
+
+int digitalPinToInterrupt(uint8_t pin)
+{
+  return pin;
+}
+
+void attachInterrupt(uint8_t irq, void (*isr)(void), int mode)
+{
+  (void)mode;
+  if (irq < HOST_N_PINS) host_isr[irq] = isr;
+}
+
+void detachInterrupt(uint8_t irq)
+{
+  if (irq < HOST_N_PINS) host_isr[irq] = NULL;
+}
+
+void noInterrupts(void)
+{
+}
+
+void interrupts(void)
+{
+}
+
+/*************************************************************
+
+  Test controls
+
+**************************************************************/
+
+void host_clock_set(uint64_t now_us)
+{
+  host_now = now_us;
+}
+
+uint64_t host_clock_now(void)
+{
+  return host_now;
+}
+
+void host_clock_advance(uint64_t us)
+{
+  host_now += us;
+}
+
+void host_clock_step(uint32_t us_per_call)
+{
+  host_step = us_per_call;
+}
+
+void host_pin_set(uint8_t pin, uint8_t level)
+{
+  if (pin >= HOST_N_PINS) return;
+
+  if (host_low[pin] == !level) return;
+
+  host_low[pin] = !level;
+  if (host_isr[pin]) host_isr[pin]();
+}
+
+void host_on_write(HostWriteHook hook)
+{
+  host_write_hook = hook;
+}
+
+void host_reset(void)
+{
+  host_now  = 0;
+  host_step = 1;
+  host_write_hook = NULL;
+
+  for (int i=0; i<HOST_N_PINS; i++) {
+    host_low[i] = 0;
+    host_isr[i] = NULL;
+  }
+}
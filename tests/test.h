@@ -0,0 +1,87 @@
+/************************************************************
+
+  Minimal test helpers for the SWIM host tests
+
+  CHECK() counts the failures and carries on, TEST_RUN() prints
+  the name of each case, test_exit() sums them up. The bench
+  helpers time with the monotonic clock.
+
+  Header file.
+
+ ************************************************************/
+#ifndef __SWIM_TEST_H__
+#define __SWIM_TEST_H__
+
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+#include <math.h>
+
+static int test_failures = 0;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+      fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond); \
+      test_failures++; \
+    } \
+  } while (0)
+
+#define CHECK_EQ(a, b) do { \
+    unsigned long long a_ = (unsigned long long)(a), b_ = (unsigned long long)(b); \
+    if (a_ != b_) { \
+      fprintf(stderr, "%s:%d: CHECK failed: %s == %s (0x%llx != 0x%llx)\n", \
+        __FILE__, __LINE__, #a, #b, a_, b_); \
+      test_failures++; \
+    } \
+  } while (0)
+
+#define TEST_RUN(fn) do { printf("  %s\n", #fn); fn(); } while (0)
+
+static inline int test_exit(const char* name)
+{
+  if (test_failures) {
+    printf("%s: %d check(s) FAILED\n", name, test_failures);
+    return 1;
+  }
+  printf("%s: ok\n", name);
+  return 0;
+}
+
+/* Wall time in seconds, for the benchmarks */
+static inline double bench_now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+/* Keeps a result alive, so the compiler can't drop the work */
+static volatile uint64_t bench_sink;
+
+/* Small reproducible PRNG (xorshift64) */
+static inline uint64_t test_rand(uint64_t* state)
+{
+  uint64_t x = *state;
+
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  return (*state = x);
+}
+
+/* Normal deviate, Box-Muller */
+static inline double test_gauss(uint64_t* state)
+{
+  double u = ((test_rand(state) >> 11) + 1.0) / 9007199254740994.0;
+  double v = (test_rand(state) >> 11) / 9007199254740992.0;
+
+  return sqrt(-2.0*log(u)) * cos(6.283185307179586*v);
+}
+
+#endif /* Include Guard */
@@ -0,0 +1,269 @@
+/************************************************************
+
+  IRDemod host tests
+
+  Synthetic photodiode samples: a DC level (ambient light), the
+  carrier as a sine while the LED is on, and gaussian noise on
+  every sample, clipped to the ADC. The runs that come out are
+  checked against the ones that went in, and transmitter
+  compiled packets are decoded through IRRecv_feed_run.
+
+ ************************************************************/
+#include "test.h"
+
+#include "IRDemod.h"
+#include "IRTransmit.h"
+
+#define SAMPLE_RATE      500000
+#define CARRIER          38000
+#define MAX_SAMPLES      200000
+#define MAX_RUNS         512
+
+typedef struct {
+  uint8_t  level;
+  uint32_t us;
+} Run;
+
+typedef struct {
+  uint16_t dc;
+  uint16_t amp;            // Carrier amplitude, ADC counts
+  double   noise;          // Standard deviation, ADC counts
+} Signal;
+
+static uint16_t samples[MAX_SAMPLES];
+
+/* The samples of the runs. The carrier phase goes on across the offs */
+static uint32_t synth(const Run* runs, uint32_t n_runs, const Signal* sig, uint64_t* seed)
+{
+  double   phase = (test_rand(seed) >> 11) / 9007199254740992.0 * 6.283185307179586;
+  double   step = 6.283185307179586 * CARRIER / SAMPLE_RATE, x;
+  uint64_t end_us = 0;
+  uint32_t n = 0, end;
+
+  for (uint32_t i=0; i<n_runs; i++) {
+    end_us += runs[i].us;
+    end = (uint32_t)(end_us * SAMPLE_RATE / 1000000);
+
+    for (; n<end && n<MAX_SAMPLES; n++) {
+      phase += step;
+      x = sig->dc + sig->noise*test_gauss(seed);
+      if (runs[i].level) x += sig->amp*sin(phase);
+
+      samples[n] = (x < 0) ? 0 : (x > 4095) ? 4095 : (uint16_t)x;
+    }
+  }
+
+  return n;
+}
+
+/* Sink that keeps the runs, lows given out in pieces put back together */
+typedef struct {
+  Run      run[MAX_RUNS];
+  uint32_t n;
+} RunLog;
+
+static int log_sink(void* ctx, uint8_t level, uint32_t duration)
+{
+  RunLog* log = (RunLog*)ctx;
+
+  if (log->n && log->run[log->n - 1].level == level) {
+    log->run[log->n - 1].us += duration;
+  }
+  else if (log->n < MAX_RUNS) {
+    log->run[log->n].level = level;
+    log->run[log->n].us    = duration;
+    log->n++;
+  }
+
+  return IRRECV_NEED_MORE;
+}
+
+/**
+ * The demodulated runs of 'n' samples, fed in chunks of up to
+ * 'chunk' (0: all at once). A new demodulator every time: the
+ * level and the partial block it was left with would carry over.
+ * --> Its block, in us
+ */
+static uint32_t demod_runs(RunLog* log, uint32_t n, uint32_t chunk, uint64_t* seed)
+{
+  IRDemod* demod = IRDemod_create(SAMPLE_RATE, CARRIER);
+  uint32_t used = 0, k, block_us;
+
+  log->n = 0;
+  IRDemod_set_sink(demod, &log_sink, log);
+
+  while (used < n) {
+    k = chunk ? 1 + (uint32_t)(test_rand(seed) % chunk) : n - used;
+    if (k > n - used) k = n - used;
+    used += IRDemod_process(demod, &(samples[used]), k);
+  }
+  IRDemod_flush(demod);
+
+  block_us = demod->block * 1000000 / SAMPLE_RATE;
+  IRDemod_destroy(demod);
+
+  return block_us;
+}
+
+/*************************************************************
+
+  Runs
+
+**************************************************************/
+/* On/off runs of a few hundred us come out within a block or two */
+static void test_runs(void)
+{
+  static const Signal sigs[] = {
+    { 1500, 200, 0 }, { 1500, 200, 20 }, { 300, 120, 15 }, { 3500, 200, 20 }
+  };
+  Run runs[40];
+  RunLog log;
+  uint64_t seed = 3;
+  uint32_t block_us;
+
+  for (unsigned s=0; s<sizeof(sigs)/sizeof(sigs[0]); s++) {
+    for (uint32_t i=0; i<40; i++) {
+      runs[i].level = i & 1;
+      runs[i].us    = 200 + (uint32_t)(test_rand(&seed) % 800);
+    }
+
+    block_us = demod_runs(&log, synth(runs, 40, &sigs[s], &seed), 0, &seed);
+
+    CHECK_EQ(log.n, 40);
+    for (uint32_t i=0; i<log.n && i<40; i++) {
+      CHECK_EQ(log.run[i].level, runs[i].level);
+      CHECK(log.run[i].us + 2*block_us >= runs[i].us);
+      CHECK(log.run[i].us <= runs[i].us + 2*block_us);
+    }
+  }
+}
+
+/* Noise alone, DC anywhere on the ADC: never on */
+static void test_noise_floor(void)
+{
+  static const uint16_t dcs[] = { 100, 1500, 4000 };
+  Run run = { 0, 150000 };
+  Signal sig = { 0, 0, 12 };
+  RunLog log;
+  uint64_t seed = 9;
+
+  for (unsigned d=0; d<sizeof(dcs)/sizeof(dcs[0]); d++) {
+    sig.dc = dcs[d];
+    demod_runs(&log, synth(&run, 1, &sig, &seed), 0, &seed);
+
+    CHECK_EQ(log.n, 1);
+    CHECK_EQ(log.run[0].level, 0);
+  }
+}
+
+/* Any chunking of the samples gives the same runs */
+static void test_chunks(void)
+{
+  static const uint32_t chunks[] = { 1, 7, 26, 1000 };
+  Signal sig = { 1500, 200, 20 };
+  Run runs[40];
+  RunLog whole, part;
+  uint64_t seed = 17;
+  uint32_t n;
+
+  for (uint32_t i=0; i<40; i++) {
+    runs[i].level = i & 1;
+    runs[i].us    = 100 + (uint32_t)(test_rand(&seed) % 900);
+  }
+  n = synth(runs, 40, &sig, &seed);
+
+  demod_runs(&whole, n, 0, &seed);
+
+  for (unsigned c=0; c<sizeof(chunks)/sizeof(chunks[0]); c++) {
+    demod_runs(&part, n, chunks[c], &seed);
+
+    CHECK_EQ(part.n, whole.n);
+    for (uint32_t i=0; i<part.n && i<whole.n; i++) {
+      CHECK_EQ(part.run[i].level, whole.run[i].level);
+      CHECK_EQ(part.run[i].us, whole.run[i].us);
+    }
+  }
+}
+
+/*************************************************************
+
+  Packets
+
+**************************************************************/
+/* The runs of a packet as sent by 'tx', with some idle line on both sides */
+static uint32_t packet_runs(IRTrans* tx, IRSchedule* sched, uint64_t packet, Run* runs)
+{
+  uint32_t period = tx->irComm->period;
+  uint32_t n = 0;
+
+  IRTrans_compile(tx, sched, 17, packet);
+
+  runs[n].level = 0;
+  runs[n].us    = 2000;
+  n++;
+  for (uint16_t i=0; i<sched->n_segs; i++) {
+    runs[n].level = IRSCHED_LEVEL(sched->seg[i]);
+    runs[n].us    = IRSCHED_CYCLES(sched->seg[i])*period;
+    n++;
+  }
+  runs[n].level = 0;
+  runs[n].us    = PULSE_TIMEOUT + 1000;
+  n++;
+
+  return n;
+}
+
+/* Packets decoded from the samples, the carrier down near the on threshold */
+static void test_packets(void)
+{
+  static const Signal sigs[] = { { 1500, 200, 10 }, { 1500, 100, 40 }, { 1500, 60, 30 } };
+  IRTrans* tx = IRTrans_create(3);
+  IRSchedule* sched = IRSchedule_create(128);
+  IRRecv* rx = IRRecv_create(2);
+  IRDemod* demod = IRDemod_create_for_irrecv(SAMPLE_RATE, rx);
+  Run runs[MAX_RUNS];
+  uint64_t seed = 21, packet;
+  uint32_t n, used, ok;
+
+  IRRecv_enable_filter(rx, 0, 0);
+
+  for (unsigned s=0; s<sizeof(sigs)/sizeof(sigs[0]); s++) {
+    ok = 0;
+
+    for (int k=0; k<50; k++) {
+      packet = test_rand(&seed) & 0x1FFFF;
+      n = synth(runs, packet_runs(tx, sched, packet, runs), &sigs[s], &seed);
+
+      IRRecv_begin_packet(rx, 18);
+      IRFilter_reset(rx->filter);
+      rx->run_low = 0;
+
+      used = 0;
+      demod->status = IRRECV_NEED_MORE;
+      while (used < n && demod->status == IRRECV_NEED_MORE) {
+        used += IRDemod_process(demod, &(samples[used]), n - used);
+      }
+
+      if (demod->status == IRRECV_PKT_READY && rx->packet == IRTrans_frame(tx, 17, packet)) ok++;
+      IRDemod_flush(demod);
+    }
+
+    printf("  amp %u noise %.0f: %u/50\n", sigs[s].amp, sigs[s].noise, ok);
+    CHECK(ok >= 48);
+  }
+
+  IRDemod_destroy(demod);
+  IRRecv_destroy(rx);
+  IRSchedule_destroy(sched);
+  IRTrans_destroy(tx);
+}
+
+int main(void)
+{
+  TEST_RUN(test_runs);
+  TEST_RUN(test_noise_floor);
+  TEST_RUN(test_chunks);
+  TEST_RUN(test_packets);
+
+  return test_exit("test_demod");
+}
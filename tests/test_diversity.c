@@ -0,0 +1,252 @@
+/************************************************************
+
+  IRDiversity host tests
+
+  Two branches hear the same transmission, each through its own
+  noise: the transmitter compiled packet, with every run of each
+  branch stretched or shrunk independently. The combined packet
+  has to come out right more often than either branch alone.
+  With a different bit wrong in each branch, the vote has to
+  get the packet back where picking a branch can't.
+
+ ************************************************************/
+#include "test.h"
+
+#include <string.h>
+
+#include "IRDiversity.h"
+#include "IRTransmit.h"
+
+#define N_PACKETS        1000
+#define MAX_PULSES       (PREAMBLE_RUNS + 4*(IRRECV_MAX_BITS + 1))
+
+typedef struct {
+  uint32_t low;
+  uint32_t high;
+} Pulse;
+
+/* The pulses of the packet, every run off by a relative gaussian 'sigma' */
+static uint32_t noisy_pulses(IRTrans* tx, IRSchedule* sched, Pulse* p, double sigma, uint64_t* seed)
+{
+  uint32_t period = tx->irComm->period;
+  uint32_t n = 0, low = 0;
+  double   us;
+
+  for (uint16_t i=0; i<sched->n_segs; i++) {
+    us = IRSCHED_CYCLES(sched->seg[i])*period*(1.0 + sigma*test_gauss(seed));
+    if (us < 1) us = 1;
+
+    if (!IRSCHED_LEVEL(sched->seg[i])) {
+      low += (uint32_t)us;
+      continue;
+    }
+    p[n].low  = low;
+    p[n].high = (uint32_t)us;
+    n++;
+    low = 0;
+  }
+
+  return n;
+}
+
+/* One branch alone, on the same pulses */
+static int single_branch(IRRecv* rx, const Pulse* p, uint32_t n, uint8_t bits)
+{
+  int status = IRRECV_NEED_MORE;
+
+  IRRecv_begin_packet(rx, bits);
+  for (uint32_t i=0; i<n && status == IRRECV_NEED_MORE; i++) {
+    status = IRRecv_feed(rx, p[i].low, p[i].high);
+  }
+
+  return status;
+}
+
+/* Both branches fed pulse by pulse, as they would come in */
+static int combined(IRDiversity* div, const Pulse* pa, uint32_t na, const Pulse* pb, uint32_t nb)
+{
+  int status = IRRECV_NEED_MORE;
+
+  IRDiversity_begin_packet(div, div->bits);
+  for (uint32_t i=0; (i<na || i<nb) && status == IRRECV_NEED_MORE; i++) {
+    if (i < na) status = IRDiversity_feed(div, 0, pa[i].low, pa[i].high);
+    if (i < nb && status == IRRECV_NEED_MORE) status = IRDiversity_feed(div, 1, pb[i].low, pb[i].high);
+  }
+  if (status == IRRECV_NEED_MORE) status = IRDiversity_combine(div);
+
+  return status;
+}
+
+/* Two independently corrupted streams of the same packets */
+static void test_two_streams(void)
+{
+  static const uint8_t modes[] = { IRDIV_COMBINE_VOTE, IRDIV_COMBINE_SELECT };
+  IRTrans* tx = IRTrans_create(3);
+  IRSchedule* sched = IRSchedule_create(64);
+  IRDiversity* div = IRDiversity_create_skel();
+  IRRecv* a = IRRecv_create(2);
+  IRRecv* b = IRRecv_create(4);
+  Pulse pa[MAX_PULSES], pb[MAX_PULSES];
+
+  host_reset();
+  IRDiversity_add_branch(div, a);
+  IRDiversity_add_branch(div, b);
+  div->bits = 18;
+
+  for (unsigned m=0; m<sizeof(modes); m++) {
+    uint64_t seed = 5, packet, frame;
+    uint32_t ok_a = 0, ok_b = 0, ok = 0, na, nb;
+
+    div->mode = modes[m];
+
+    for (uint32_t k=0; k<N_PACKETS; k++) {
+      packet = test_rand(&seed) & 0x1FFFF;
+      frame  = IRTrans_frame(tx, 17, packet);
+      IRTrans_compile(tx, sched, 17, packet);
+
+      na = noisy_pulses(tx, sched, pa, 0.1, &seed);
+      nb = noisy_pulses(tx, sched, pb, 0.1, &seed);
+
+      if (single_branch(a, pa, na, 18) == IRRECV_PKT_READY && a->packet == frame) ok_a++;
+      if (single_branch(b, pb, nb, 18) == IRRECV_PKT_READY && b->packet == frame) ok_b++;
+      if (combined(div, pa, na, pb, nb) == IRRECV_PKT_READY && div->packet == frame) ok++;
+    }
+
+    printf("  %s: branch a %u, branch b %u, combined %u of %u\n",
+      div->mode == IRDIV_COMBINE_VOTE ? "vote  " : "select", ok_a, ok_b, ok, N_PACKETS);
+
+    /* Noisy enough that a branch alone loses some */
+    CHECK(ok_a < N_PACKETS - 20);
+    CHECK(ok_b < N_PACKETS - 20);
+    CHECK(ok > ok_a);
+    CHECK(ok > ok_b);
+  }
+
+  CHECK(div->n_combined > 0);
+  CHECK(div->n_conflicts > 0);
+
+  IRDiversity_destroy(div);
+  IRRecv_destroy(a);
+  IRRecv_destroy(b);
+  IRSchedule_destroy(sched);
+  IRTrans_destroy(tx);
+}
+
+/* Bit 'pos' (from the top) of every copy read the wrong way, only just */
+static void marginal_bit(IRTrans* tx, Pulse* p, uint8_t bits, uint64_t frame, uint8_t pos)
+{
+  uint32_t boundary = (tx->pulses_one + tx->pulses_zero)*tx->irComm->period/2;
+  bool one = (frame >> (bits - 1 - pos)) & 0x1;
+
+  /* The header pulse, then each copy's bits and the gap after them */
+  for (uint8_t c=0; c<tx->repeat; c++) {
+    p[1 + c*(bits + 1) + pos].high = one ? boundary - 4 : boundary + 4;
+  }
+}
+
+/**
+ * Each branch gets a different bit wrong, unsure of it and sure
+ * of the rest. SELECT can only pick one of the wrong packets;
+ * VOTE takes each bit from the branch that's sure of it.
+ */
+static void test_different_bits(void)
+{
+  static const uint8_t modes[] = { IRDIV_COMBINE_VOTE, IRDIV_COMBINE_SELECT };
+  IRTrans* tx = IRTrans_create(3);
+  IRSchedule* sched = IRSchedule_create(64);
+  IRDiversity* div = IRDiversity_create_skel();
+  IRRecv* a = IRRecv_create(2);
+  IRRecv* b = IRRecv_create(4);
+  Pulse pa[MAX_PULSES], pb[MAX_PULSES];
+  uint64_t seed = 9, frame = IRTrans_frame(tx, 17, 0x0A5A5), got[2];
+  uint32_t na, nb;
+
+  host_reset();
+  IRDiversity_add_branch(div, a);
+  IRDiversity_add_branch(div, b);
+  div->bits = 18;
+
+  IRTrans_compile(tx, sched, 17, 0x0A5A5);
+  na = noisy_pulses(tx, sched, pa, 0, &seed);
+  nb = noisy_pulses(tx, sched, pb, 0, &seed);
+  marginal_bit(tx, pa, 18, frame, 3);
+  marginal_bit(tx, pb, 18, frame, 10);
+
+  CHECK_EQ(single_branch(a, pa, na, 18), IRRECV_PKT_READY);
+  CHECK_EQ(a->packet, frame ^ (1ULL << (17 - 3)));
+  CHECK_EQ(single_branch(b, pb, nb, 18), IRRECV_PKT_READY);
+  CHECK_EQ(b->packet, frame ^ (1ULL << (17 - 10)));
+
+  for (unsigned m=0; m<sizeof(modes); m++) {
+    div->mode = modes[m];
+    CHECK_EQ(combined(div, pa, na, pb, nb), IRRECV_PKT_READY);
+    got[m] = div->packet;
+  }
+
+  CHECK_EQ(got[0], frame);
+  CHECK(got[1] == a->packet || got[1] == b->packet);
+  CHECK(got[0] != got[1]);
+
+  IRDiversity_destroy(div);
+  IRRecv_destroy(a);
+  IRRecv_destroy(b);
+  IRSchedule_destroy(sched);
+  IRTrans_destroy(tx);
+}
+
+/* Equal and opposite votes: the better link has the last word */
+static void test_vote_tie(void)
+{
+  IRDiversity* div = IRDiversity_create_skel();
+  IRRecv* a = IRRecv_create(2);
+  IRRecv* b = IRRecv_create(4);
+
+  IRDiversity_add_branch(div, a);
+  IRDiversity_add_branch(div, b);
+
+  for (int better=0; better<2; better++) {
+    IRDiversity_begin_packet(div, 8);
+
+    a->packet = 0xF0;
+    b->packet = 0x0F;
+    memset(a->bit_conf, 40, sizeof(a->bit_conf));
+    memset(b->bit_conf, 40, sizeof(b->bit_conf));
+
+    a->link.disagree_bits = better ? 3 : 0;
+    b->link.disagree_bits = better ? 0 : 3;
+    a->link.dev_mean = b->link.dev_mean = 10;
+
+    div->status[0] = div->status[1] = IRRECV_PKT_READY;
+    div->n_ready = 2;
+
+    CHECK_EQ(IRDiversity_combine(div), IRRECV_PKT_READY);
+    CHECK_EQ(div->packet, (better ? 0x0F : 0xF0));
+    CHECK_EQ(div->bit_conf[0], 0);
+  }
+
+  /* Same disagreement: down to the pulse deviation */
+  IRDiversity_begin_packet(div, 8);
+  a->packet = 0xF0;
+  b->packet = 0x0F;
+  a->link.disagree_bits = b->link.disagree_bits = 1;
+  a->link.dev_mean = 30;
+  b->link.dev_mean = 12;
+  div->status[0] = div->status[1] = IRRECV_PKT_READY;
+  div->n_ready = 2;
+
+  CHECK_EQ(IRDiversity_combine(div), IRRECV_PKT_READY);
+  CHECK_EQ(div->packet, 0x0F);
+
+  IRDiversity_destroy(div);
+  IRRecv_destroy(a);
+  IRRecv_destroy(b);
+}
+
+int main(void)
+{
+  TEST_RUN(test_two_streams);
+  TEST_RUN(test_different_bits);
+  TEST_RUN(test_vote_tie);
+
+  return test_exit("test_diversity");
+}
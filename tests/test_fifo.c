@@ -0,0 +1,157 @@
+/************************************************************
+
+  FIFO host tests
+
+ ************************************************************/
+#include "test.h"
+
+#include "FIFO.h"
+
+/* Ring order, wrap-around and the power-of-two storage */
+static void test_ring_order(void)
+{
+  FIFO* fifo = FIFO_create(30);
+  uint32_t next_in = 0, next_out = 0;
+
+  CHECK_EQ(fifo->depth, 30);
+  CHECK_EQ(fifo->capacity, 32);
+  CHECK_EQ(fifo->mask, 31);
+
+  /* Pushes and pops of varying size, the counters wrap the ring many times */
+  for (int round=0; round<1000; round++) {
+    int n_push = (round*7) % 13;
+    int n_pop  = (round*5) % 13;
+
+    for (int i=0; i<n_push && fifo->n_nodes<fifo->depth; i++) {
+      fifo->Push(fifo, next_in++ & 0xFFF);
+    }
+    for (int i=0; i<n_pop && fifo->n_nodes; i++) {
+      CHECK_EQ(fifo->Pop(fifo), next_out++ & 0xFFF);
+    }
+    CHECK_EQ(fifo->n_nodes, next_in - next_out);
+  }
+
+  FIFO_destroy(fifo);
+}
+
+/* A full FIFO drops its oldest entry, as the linked list did */
+static void test_drop_oldest(void)
+{
+  FIFO* fifo = FIFO_create(4);
+
+  for (uint32_t i=0; i<10; i++) CHECK_EQ(fifo->Push(fifo, i), FIFO_SUCCESS);
+
+  CHECK_EQ(fifo->n_nodes, 4);
+  for (uint32_t i=6; i<10; i++) CHECK_EQ(fifo->Pop(fifo), i);
+
+  /* Empty: 0, and nothing moves */
+  CHECK_EQ(fifo->Pop(fifo), 0);
+  CHECK_EQ(fifo->n_nodes, 0);
+  CHECK_EQ(fifo->head, fifo->tail);
+
+  FIFO_destroy(fifo);
+}
+
+static void test_create(void)
+{
+  FIFO* fifo = FIFO_create(0);
+
+  /* A zero depth still holds one entry */
+  CHECK_EQ(fifo->depth, 1);
+  CHECK_EQ(fifo->capacity, 1);
+  fifo->Push(fifo, 5);
+  fifo->Push(fifo, 6);
+  CHECK_EQ(fifo->Pop(fifo), 6);
+  FIFO_destroy(fifo);
+
+  fifo = FIFO_create_skel();
+  CHECK(fifo->depth > 0);
+  CHECK(fifo->capacity >= fifo->depth);
+  CHECK(fifo->buf != NULL);
+  FIFO_destroy(fifo);
+
+  fifo = FIFO_create(1000);
+  CHECK_EQ(fifo->capacity, 1024);
+  FIFO_destroy(fifo);
+}
+
+/* Packed storage: same order as the word FIFO, address and ADC kept */
+static void test_packed(void)
+{
+  static const uint8_t bits[] = { FIFO_STORAGE_PACKED17, FIFO_STORAGE_PACKED24 };
+  uint64_t seed = 1;
+
+  for (unsigned b=0; b<sizeof(bits); b++) {
+    FIFO* fifo = FIFO_create_packed(30, bits[b]);
+    FIFO* ref = FIFO_create(30);
+
+    CHECK_EQ(fifo->entry_bits, bits[b]);
+    CHECK(FIFO_storage_bytes(fifo) < FIFO_storage_bytes(ref));
+
+    for (int i=0; i<5000; i++) {
+      uint64_t r = test_rand(&seed);
+      fifo_data_t data = (fifo_data_t)(r >> 8) & (FIFO_ENTRY_ADDR_MASK | FIFO_ENTRY_ADC_MASK);
+
+      if (r & 1) {
+        fifo->Push(fifo, data);
+        ref->Push(ref, data);
+      }
+      else if (ref->n_nodes) {
+        CHECK_EQ(fifo->Pop(fifo), ref->Pop(ref));
+      }
+      CHECK_EQ(fifo->n_nodes, ref->n_nodes);
+    }
+
+    FIFO_destroy(ref);
+    FIFO_destroy(fifo);
+  }
+}
+
+/* Received deltas, anchored on the newest entry with older ones still stored */
+static void test_anchor_newest(void)
+{
+  FIFO* fifo = FIFO_create(64);
+  uint32_t time;
+
+  CHECK(FIFO_enable_timestamps(fifo, NULL));
+
+  /* First burst, anchored: samples at 1000, 1010, 1030 */
+  fifo->Push(fifo, (5u << FIFO_ENTRY_TS_SHIFT) | 1);
+  fifo->Push(fifo, (10u << FIFO_ENTRY_TS_SHIFT) | 2);
+  fifo->Push(fifo, (20u << FIFO_ENTRY_TS_SHIFT) | 3);
+  FIFO_anchor_newest(fifo, 1030);
+
+  /* Second burst, not popped in between: 1100, 1140, newest 1140 + 7 */
+  fifo->Push(fifo, (70u << FIFO_ENTRY_TS_SHIFT) | 4);
+  fifo->Push(fifo, (40u << FIFO_ENTRY_TS_SHIFT) | 5);
+  fifo->Push(fifo, (7u << FIFO_ENTRY_TS_SHIFT) | 6);
+
+  /* The second EOB puts it all 500 ms later: the older entries move along */
+  FIFO_anchor_newest(fifo, 1147 + 500);
+
+  CHECK_EQ(FIFO_pop_timed(fifo, &time) & 0xFFF, 1); CHECK_EQ(time, 1500);
+  CHECK_EQ(FIFO_pop_timed(fifo, &time) & 0xFFF, 2); CHECK_EQ(time, 1510);
+  CHECK_EQ(FIFO_pop_timed(fifo, &time) & 0xFFF, 3); CHECK_EQ(time, 1530);
+  CHECK_EQ(FIFO_pop_timed(fifo, &time) & 0xFFF, 4); CHECK_EQ(time, 1600);
+  CHECK_EQ(FIFO_pop_timed(fifo, &time) & 0xFFF, 5); CHECK_EQ(time, 1640);
+  CHECK_EQ(FIFO_pop_timed(fifo, &time) & 0xFFF, 6); CHECK_EQ(time, 1647);
+
+  /* Empty, the anchor still sets where the next delta counts from */
+  FIFO_anchor_newest(fifo, 2000);
+  fifo->Push(fifo, (3u << FIFO_ENTRY_TS_SHIFT) | 7);
+  FIFO_pop_timed(fifo, &time);
+  CHECK_EQ(time, 2003);
+
+  FIFO_destroy(fifo);
+}
+
+int main(void)
+{
+  TEST_RUN(test_ring_order);
+  TEST_RUN(test_drop_oldest);
+  TEST_RUN(test_create);
+  TEST_RUN(test_packed);
+  TEST_RUN(test_anchor_newest);
+
+  return test_exit("test_fifo");
+}
@@ -0,0 +1,396 @@
+/************************************************************
+
+  IRRecv host tests
+
+  The packets are compiled by the transmitter (IRTrans_compile)
+  and turned into what the VSOP38338 would put out: its output
+  goes LOW while the carrier is on. Then
+    capture --> the edges go through the host pin and its CHANGE
+                interrupt, as on the board, and get decoded by
+                IRRecv_poll and by RecvPacket.
+    decoder --> the pulses go straight into the incremental
+                decoder (IRRecv_feed), a whole array at a time.
+
+ ************************************************************/
+#include "test.h"
+
+#include "IRRecv.h"
+#include "IRTransmit.h"
+
+#define RX_PIN           2
+#define TX_PIN           3
+
+#define MAX_RUNS         (2*(PREAMBLE_RUNS + 4*(IRRECV_MAX_BITS + 1)))
+
+/* One run of the demodulated output: carrier on (1) or off, in us */
+typedef struct {
+  uint8_t  level;
+  uint32_t us;
+} Run;
+
+/**
+ * The runs of a packet as sent by 'tx', with up to +-'jitter' us
+ * on every edge. The idle line ends it.
+ */
+static uint32_t packet_runs(IRTrans* tx, uint8_t bits, uint64_t packet,
+  Run* runs, uint32_t jitter, uint64_t* seed)
+{
+  IRSchedule* sched = IRSchedule_create(64);
+  uint32_t period = tx->irComm->period;
+  uint32_t n = 0;
+  int32_t  shift = 0, next;
+
+  IRTrans_compile(tx, sched, bits, packet);
+
+  for (uint16_t i=0; i<sched->n_segs; i++) {
+    next = jitter ? (int32_t)(test_rand(seed) % (2*jitter + 1)) - (int32_t)jitter : 0;
+    runs[n].level = IRSCHED_LEVEL(sched->seg[i]);
+    runs[n].us    = IRSCHED_CYCLES(sched->seg[i])*period + next - shift;
+    shift = next;
+    n++;
+  }
+
+  IRSchedule_destroy(sched);
+  return n;
+}
+
+/* The runs on the receiver pin, through its interrupt */
+static void play_runs(const Run* runs, uint32_t n)
+{
+  for (uint32_t i=0; i<n; i++) {
+    host_pin_set(RX_PIN, runs[i].level ? LOW : HIGH);
+    host_clock_advance(runs[i].us);
+  }
+  host_pin_set(RX_PIN, HIGH);
+}
+
+/* The runs as pulses, each with the low before it */
+static int feed_runs(IRRecv* rx, const Run* runs, uint32_t n)
+{
+  uint32_t low = 0;
+  int status = IRRECV_NEED_MORE;
+
+  for (uint32_t i=0; i<n && status == IRRECV_NEED_MORE; i++) {
+    if (!runs[i].level) {
+      low += runs[i].us;
+      continue;
+    }
+    status = IRRecv_feed(rx, low, runs[i].us);
+    low = 0;
+  }
+
+  return status;
+}
+
+static uint64_t random_packet(uint64_t* seed, uint8_t bits)
+{
+  return test_rand(seed) & ((bits >= 64) ? ~0ULL : ((1ULL << bits) - 1));
+}
+
+/*************************************************************
+
+  Capture
+
+**************************************************************/
+static void test_capture_poll(void)
+{
+  IRTrans* tx = IRTrans_create(TX_PIN);
+  IRRecv* rx = IRRecv_create(RX_PIN);
+  Run runs[MAX_RUNS];
+  uint64_t seed = 7;
+
+  host_reset();
+  CHECK_EQ(IRRecv_enable_capture(rx, 0), 0);
+
+  for (int k=0; k<20; k++) {
+    uint8_t bits = (uint8_t)(8 + k);
+    uint64_t packet = random_packet(&seed, bits);
+    uint32_t n = packet_runs(tx, bits, packet, runs, 0, &seed);
+
+    host_clock_advance(5000);
+    play_runs(runs, n);
+
+    IRRecv_begin_packet(rx, bits + 1);
+    CHECK_EQ(IRRecv_poll(rx), IRRECV_PKT_READY);
+    CHECK_EQ(rx->packet, IRTrans_frame(tx, bits, packet));
+
+    /* Whatever the early accept left over */
+    while (SPSCFIFO_count(rx->edges)) IRRecv_poll(rx);
+  }
+
+  IRRecv_disable_capture(rx);
+  IRRecv_destroy(rx);
+  IRTrans_destroy(tx);
+}
+
+/* Edges a few us off, and the blocking receiver on top of the queue */
+static void test_capture_jitter(void)
+{
+  IRTrans* tx = IRTrans_create(TX_PIN);
+  IRRecv* rx = IRRecv_create(RX_PIN);
+  Run runs[MAX_RUNS];
+  uint64_t seed = 11, buf;
+
+  host_reset();
+  IRRecv_enable_capture(rx, 0);
+
+  for (int k=0; k<20; k++) {
+    uint64_t packet = random_packet(&seed, 17);
+    uint32_t n = packet_runs(tx, 17, packet, runs, 40, &seed);
+
+    host_clock_advance(5000);
+    play_runs(runs, n);
+
+    CHECK_EQ(rx->RecvPacket(rx, &buf, 18), IRRECV_SUCCESS);
+    CHECK_EQ(buf, IRTrans_frame(tx, 17, packet));
+    while (SPSCFIFO_count(rx->edges)) IRRecv_poll(rx);
+  }
+
+  IRRecv_disable_capture(rx);
+  IRRecv_destroy(rx);
+  IRTrans_destroy(tx);
+}
+
+/**
+ * Nothing on the line: by default RecvPacket keeps waiting the
+ * old PACKET_TIMEOUT (periods, in ms), only idle_timeout_us (as
+ * READ_ALL sets it) cuts it short
+ */
+static void test_idle_timeout(void)
+{
+  IRRecv* rx = IRRecv_create(RX_PIN);
+  uint64_t expect = (uint64_t)PACKET_TIMEOUT*rx->irComm->period*1000;
+  uint64_t buf, t0;
+
+  host_reset();
+  host_clock_step(100000);
+
+  CHECK_EQ(rx->idle_timeout_us, 0);
+  t0 = host_clock_now();
+  CHECK_EQ(rx->RecvPacket(rx, &buf, 18), ERROR_IDLE_TIMEOUT);
+  CHECK(host_clock_now() - t0 >= expect);
+  CHECK(host_clock_now() - t0 <= expect + 1000000);
+
+  host_clock_step(10);
+  rx->idle_timeout_us = 20000;
+  t0 = host_clock_now();
+  CHECK_EQ(rx->RecvPacket(rx, &buf, 18), ERROR_IDLE_TIMEOUT);
+  CHECK(host_clock_now() - t0 >= 20000);
+  CHECK(host_clock_now() - t0 <= 20000 + 100);
+
+  host_reset();
+  IRRecv_destroy(rx);
+}
+
+/* More edges than the queue holds: the ISR reports it, nothing is corrupted */
+static void test_capture_overflow(void)
+{
+  IRRecv* rx = IRRecv_create(RX_PIN);
+  int n_failed = 0;
+
+  host_reset();
+  IRRecv_enable_capture(rx, 16);
+
+  for (uint32_t i=0; i<40; i++) {
+    n_failed += (IRRecv_feed_edge(rx, 1000 + 600*i, (uint8_t)(i & 1)) != 0);
+  }
+
+  CHECK_EQ(n_failed, 40 - 16);
+  CHECK_EQ(SPSCFIFO_count(rx->edges), 16);
+
+  IRRecv_disable_capture(rx);
+  IRRecv_destroy(rx);
+}
+
+/* The signal stops half way: the poll gives up after PULSE_TIMEOUT */
+static void test_capture_truncated(void)
+{
+  IRTrans* tx = IRTrans_create(TX_PIN);
+  IRRecv* rx = IRRecv_create(RX_PIN);
+  Run runs[MAX_RUNS];
+  uint64_t seed = 3;
+  uint32_t n;
+
+  host_reset();
+  IRRecv_enable_capture(rx, 0);
+
+  n = packet_runs(tx, 17, 0x1ABCD, runs, 0, &seed);
+  host_clock_advance(5000);
+  play_runs(runs, n/2);
+
+  IRRecv_begin_packet(rx, 18);
+  CHECK_EQ(IRRecv_poll(rx), IRRECV_NEED_MORE);
+
+  host_clock_advance(PULSE_TIMEOUT + 1);
+  CHECK(IRRecv_poll(rx) < 0);
+
+  IRRecv_disable_capture(rx);
+  IRRecv_destroy(rx);
+  IRTrans_destroy(tx);
+}
+
+/*************************************************************
+
+  Incremental decoder
+
+**************************************************************/
+static void test_decode_widths(void)
+{
+  IRTrans* tx = IRTrans_create(TX_PIN);
+  IRRecv* rx = IRRecv_create(RX_PIN);
+  Run runs[MAX_RUNS];
+  uint64_t seed = 5;
+
+  /* Up to 63 bits, the parity makes it 64 */
+  for (uint8_t bits=1; bits<IRRECV_MAX_BITS; bits++) {
+    uint64_t packet = random_packet(&seed, bits);
+    uint32_t n = packet_runs(tx, bits, packet, runs, 0, &seed);
+
+    IRRecv_begin_packet(rx, bits + 1);
+    CHECK_EQ(feed_runs(rx, runs, n), IRRECV_PKT_READY);
+    CHECK_EQ(rx->packet, IRTrans_frame(tx, bits, packet));
+
+    /* The parity covers every data bit, above 32 too */
+    CHECK_EQ((rx->packet & 0x1), (uint64_t)__builtin_parityll(packet));
+  }
+  CHECK_EQ(IRTrans_frame(tx, 40, 1ULL<<35), ((1ULL<<36) | 0x1));
+
+  IRRecv_destroy(rx);
+  IRTrans_destroy(tx);
+}
+
+/* A bit flipped in one copy is outvoted */
+static void test_decode_vote(void)
+{
+  IRTrans* tx = IRTrans_create(TX_PIN);
+  IRRecv* rx = IRRecv_create(RX_PIN);
+  Run runs[MAX_RUNS];
+  uint64_t seed = 9;
+  uint32_t one  = tx->pulses_one*tx->irComm->period;
+  uint32_t zero = tx->pulses_zero*tx->irComm->period;
+
+  for (int k=0; k<50; k++) {
+    uint64_t packet = random_packet(&seed, 17);
+    uint32_t n = packet_runs(tx, 17, packet, runs, 0, &seed);
+
+    /* The k-th pulse of the first copy (run 2 on is copy 0) */
+    Run* flip = &runs[2 + 2*(k % 18)];
+    flip->us = (flip->us == one) ? zero : one;
+
+    IRRecv_begin_packet(rx, 18);
+    CHECK_EQ(feed_runs(rx, runs, n), IRRECV_PKT_READY);
+    CHECK_EQ(rx->packet, IRTrans_frame(tx, 17, packet));
+    CHECK(rx->link.disagree_bits >= 1);
+  }
+
+  IRRecv_destroy(rx);
+  IRTrans_destroy(tx);
+}
+
+/* Preamble sync, the low runs have to come along */
+static void test_decode_preamble(void)
+{
+  IRTrans* tx = IRTrans_create(TX_PIN);
+  IRRecv* rx = IRRecv_create(RX_PIN);
+  Run runs[MAX_RUNS];
+  uint64_t seed = 13;
+
+  IRTrans_set_sync_mode(tx, SYNC_PREAMBLE);
+  IRRecv_set_sync_mode(rx, SYNC_PREAMBLE);
+
+  for (int k=0; k<20; k++) {
+    uint64_t packet = random_packet(&seed, 17);
+    uint32_t n = packet_runs(tx, 17, packet, runs, 20, &seed);
+
+    IRRecv_begin_packet(rx, 18);
+    CHECK_EQ(feed_runs(rx, runs, n), IRRECV_PKT_READY);
+    CHECK_EQ(rx->packet, IRTrans_frame(tx, 17, packet));
+  }
+
+  IRRecv_destroy(rx);
+  IRTrans_destroy(tx);
+}
+
+/**
+ * Two copies agree on a marginal 1, the last one is a clean 0.
+ * The soft vote makes it a 0, so it can't stop after two copies;
+ * the plain majority makes it a 1 and can.
+ */
+static void test_early_accept(void)
+{
+  IRTrans* tx = IRTrans_create(TX_PIN);
+  IRRecv* rx = IRRecv_create(RX_PIN);
+  Run runs[MAX_RUNS];
+  uint64_t seed = 19;
+  uint64_t frame = IRTrans_frame(tx, 17, 0x10000);
+  uint32_t n = packet_runs(tx, 17, 0x10000, runs, 0, &seed);
+  uint32_t weak = (tx->pulses_one + tx->pulses_zero)*tx->irComm->period/2 + 4;
+  uint32_t stride = 2*18 + 2;
+
+  CHECK(!rx->early_accept);
+  rx->early_accept = true;
+  CHECK(!rx->soft_decision);
+  rx->soft_decision = true;
+
+  /* Clean copies: the soft vote still reads all three */
+  IRRecv_begin_packet(rx, 18);
+  CHECK_EQ(feed_runs(rx, runs, n), IRRECV_PKT_READY);
+  CHECK_EQ(rx->packet, frame);
+  CHECK_EQ(rx->n_early_accept, 0);
+
+  /* The first pulse is the top bit, a 1 */
+  runs[2].us = weak;
+  runs[2 + stride].us = weak;
+  runs[2 + 2*stride].us = tx->pulses_zero*tx->irComm->period;
+
+  IRRecv_begin_packet(rx, 18);
+  CHECK_EQ(feed_runs(rx, runs, n), IRRECV_PKT_READY);
+  CHECK_EQ(rx->packet, frame & ~(1ULL << 17));
+  CHECK_EQ(rx->n_early_accept, 0);
+
+  rx->soft_decision = false;
+  IRRecv_begin_packet(rx, 18);
+  CHECK_EQ(feed_runs(rx, runs, n), IRRECV_PKT_READY);
+  CHECK_EQ(rx->packet, frame);
+  CHECK_EQ(rx->n_early_accept, 1);
+
+  IRRecv_destroy(rx);
+  IRTrans_destroy(tx);
+}
+
+/* A timeout in the middle loses the packet and re-arms the decoder */
+static void test_decode_timeout(void)
+{
+  IRTrans* tx = IRTrans_create(TX_PIN);
+  IRRecv* rx = IRRecv_create(RX_PIN);
+  Run runs[MAX_RUNS];
+  uint64_t seed = 17;
+  uint32_t n = packet_runs(tx, 17, 0x0F0F0, runs, 0, &seed);
+
+  IRRecv_begin_packet(rx, 18);
+  CHECK_EQ(feed_runs(rx, runs, n/2), IRRECV_NEED_MORE);
+  CHECK(IRRecv_feed_pulse(rx, PULSE_TIMEOUT) < 0);
+  CHECK_EQ(rx->link_hist.lost, 1);
+
+  CHECK_EQ(feed_runs(rx, runs, n), IRRECV_PKT_READY);
+  CHECK_EQ(rx->packet, IRTrans_frame(tx, 17, 0x0F0F0));
+
+  IRRecv_destroy(rx);
+  IRTrans_destroy(tx);
+}
+
+int main(void)
+{
+  TEST_RUN(test_capture_poll);
+  TEST_RUN(test_capture_jitter);
+  TEST_RUN(test_idle_timeout);
+  TEST_RUN(test_capture_overflow);
+  TEST_RUN(test_capture_truncated);
+  TEST_RUN(test_decode_widths);
+  TEST_RUN(test_decode_vote);
+  TEST_RUN(test_decode_preamble);
+  TEST_RUN(test_decode_timeout);
+  TEST_RUN(test_early_accept);
+
+  return test_exit("test_irrecv");
+}
@@ -0,0 +1,303 @@
+/************************************************************
+
+  IRSchedule host tests
+
+  A packet compiled by the transmitter has to be the symbols
+  send_header (or send_preamble), send_one, send_zero and
+  send_gap would have sent, segment for segment. Played through
+  the host pins, every digitalWrite is logged on the simulated
+  clock, and the waveform is read back into segments: carrier
+  cycles between the rises, dark cycles in the gaps between
+  bursts. It has to be the same schedule again, the rises on
+  the period grid from the first one, with no drift.
+  With a symbol method replaced, send_packet has to go through
+  the methods instead.
+
+ ************************************************************/
+#include "test.h"
+
+#include "IRTransmit.h"
+
+#define TX_PIN           3
+#define MAX_SEGS         (2*(PREAMBLE_RUNS + 3*(64 + 2)) + 8)       /* 3 copies of 64 bits */
+#define MAX_EDGES        20000
+
+typedef struct {
+  uint8_t  level;
+  uint32_t cycles;
+} Seg;
+
+/* The symbols, one after another, runs of a level merged as IRSchedule_push does */
+typedef struct {
+  Seg      seg[MAX_SEGS];
+  uint32_t n;
+} Symbols;
+
+static void push_symbol(Symbols* s, uint8_t level, uint32_t cycles)
+{
+  if (!cycles) return;
+
+  if (s->n && s->seg[s->n - 1].level == level) {
+    s->seg[s->n - 1].cycles += cycles;
+  }
+  else if (s->n < MAX_SEGS) {
+    s->seg[s->n].level  = level;
+    s->seg[s->n].cycles = cycles;
+    s->n++;
+  }
+}
+
+/* What send_header/send_preamble, send_one/send_zero and send_gap put out */
+static void expected_symbols(IRTrans* tx, uint8_t bits, uint64_t packet, Symbols* s)
+{
+  static const uint8_t pattern[PREAMBLE_RUNS] = PREAMBLE_PATTERN;
+  uint64_t frame = IRTrans_frame(tx, bits, packet);
+
+  s->n = 0;
+
+  if (tx->sync_mode == SYNC_PREAMBLE) {
+    for (int i=0; i<PREAMBLE_RUNS; i++) {
+      push_symbol(s, !(i & 1), pattern[i]*PULSES_FOR_PREAMBLE_UNIT);
+    }
+  }
+  else {
+    push_symbol(s, 1, PULSES_FOR_HEADER_ONE);
+    push_symbol(s, 0, PULSES_FOR_HEADER_EMPTY);
+  }
+
+  for (int r=0; r<tx->repeat; r++) {
+    for (int i=bits; i>=0; i--) {
+      push_symbol(s, 1, ((frame >> i) & 1) ? PULSES_FOR_ONE : PULSES_FOR_ZERO);
+      push_symbol(s, 0, PULSES_FOR_EMPTY);
+    }
+    if (r < tx->repeat - 1) {
+      push_symbol(s, 1, PULSES_FOR_GAP);
+      push_symbol(s, 0, PULSES_FOR_EMPTY);
+    }
+  }
+}
+
+static uint32_t symbol_cycles(const Symbols* s)
+{
+  uint32_t cycles = 0;
+
+  for (uint32_t i=0; i<s->n; i++) cycles += s->seg[i].cycles;
+  return cycles;
+}
+
+static void check_schedule(IRSchedule* sched, const Symbols* s)
+{
+  CHECK_EQ(sched->n_segs, s->n);
+  for (uint32_t i=0; i<sched->n_segs && i<s->n; i++) {
+    CHECK_EQ(IRSCHED_LEVEL(sched->seg[i]), s->seg[i].level);
+    CHECK_EQ(IRSCHED_CYCLES(sched->seg[i]), s->seg[i].cycles);
+  }
+}
+
+/*************************************************************
+
+  The waveform
+
+**************************************************************/
+static uint64_t edge_t[MAX_EDGES];
+static uint8_t  edge_level[MAX_EDGES];
+static uint32_t n_edges;
+
+static void log_write(uint8_t pin, uint8_t level)
+{
+  if (pin != TX_PIN || n_edges >= MAX_EDGES) return;
+  edge_t[n_edges]     = host_clock_now();
+  edge_level[n_edges] = level;
+  n_edges++;
+}
+
+/**
+ * The played waveform back into segments: a burst is the rises
+ * a period apart, the dark cycles are what's left of the gap to
+ * the next rise. Every write has to be an edge, every high
+ * high_period + 1 long, and every rise on the grid.
+ */
+static void read_waveform(IRTrans* tx, uint32_t end_cycles, Symbols* s)
+{
+  uint32_t period = tx->irComm->period;
+  uint32_t high = tx->high_period + 1;
+  uint64_t first = edge_t[0], gap, grid;
+  uint32_t cycles = 0;
+
+  s->n = 0;
+
+  for (uint32_t i=0; i<n_edges; i++) {
+    CHECK_EQ(edge_level[i], !(i & 1));
+    if (i & 1) CHECK_EQ(edge_t[i] - edge_t[i-1], (uint64_t)high);
+  }
+
+  for (uint32_t i=0; i<n_edges; i+=2) {
+    /* Up to a us late on the grid, from the clock reads */
+    grid = first + (uint64_t)cycles*period;
+    CHECK(edge_t[i] >= grid && edge_t[i] <= grid + 2);
+
+    push_symbol(s, 1, 1);
+    cycles++;
+
+    gap = (i + 2 < n_edges) ? edge_t[i+2] - edge_t[i] : (uint64_t)(end_cycles - cycles + 1)*period;
+    if (gap > period + period/2) {
+      push_symbol(s, 0, (uint32_t)((gap + period/2)/period) - 1);
+      cycles += (uint32_t)((gap + period/2)/period) - 1;
+    }
+  }
+}
+
+/*************************************************************
+
+  Tests
+
+**************************************************************/
+/* Compiled, against the symbols, for both syncs, one copy or the repeats */
+static void test_compile(void)
+{
+  static const uint8_t syncs[] = { SYNC_HEADER, SYNC_PREAMBLE };
+  static const uint8_t bits[] = { 1, 8, 17, 40 };
+  IRTrans* tx = IRTrans_create(TX_PIN);
+  IRSchedule* sched = IRSchedule_create(4);
+  Symbols s;
+  uint64_t seed = 11, packet;
+
+  for (unsigned m=0; m<sizeof(syncs); m++) {
+    IRTrans_set_sync_mode(tx, syncs[m]);
+
+    for (uint8_t repeat=1; repeat<=3; repeat+=2) {
+      tx->repeat = repeat;
+
+      for (unsigned b=0; b<sizeof(bits); b++) {
+        packet = test_rand(&seed);
+        expected_symbols(tx, bits[b], packet, &s);
+
+        CHECK_EQ(IRTrans_compile(tx, sched, bits[b], packet), 0);
+        check_schedule(sched, &s);
+        CHECK_EQ(IRSchedule_cycles(sched), symbol_cycles(&s));
+        CHECK(IRTrans_schedule_matches(tx, sched, bits[b], packet));
+        CHECK(!IRTrans_schedule_matches(tx, sched, bits[b], packet ^ 1));
+      }
+    }
+  }
+
+  IRSchedule_destroy(sched);
+  IRTrans_destroy(tx);
+}
+
+/* Played through the pins, the waveform is the schedule */
+static void test_play(void)
+{
+  static const uint8_t syncs[] = { SYNC_HEADER, SYNC_PREAMBLE };
+  static const uint32_t carriers[] = { 30000, 38000, 56000 };
+  IRSchedule* sched = IRSchedule_create(64);
+  Symbols want, got;
+  uint64_t seed = 23, packet;
+
+  for (unsigned c=0; c<sizeof(carriers)/sizeof(carriers[0]); c++) {
+    IRTrans* tx = IRTrans_create_with_freq(TX_PIN, carriers[c]);
+
+    for (unsigned m=0; m<sizeof(syncs); m++) {
+      IRTrans_set_sync_mode(tx, syncs[m]);
+      packet = test_rand(&seed) & 0x1FFFF;
+      expected_symbols(tx, 17, packet, &want);
+      IRTrans_compile(tx, sched, 17, packet);
+
+      host_reset();
+      host_clock_set(1000000);
+      n_edges = 0;
+      host_on_write(&log_write);
+      IRTrans_play(tx, sched);
+      host_on_write(NULL);
+
+      read_waveform(tx, IRSchedule_cycles(sched), &got);
+
+      CHECK_EQ(got.n, want.n);
+      for (uint32_t i=0; i<got.n && i<want.n; i++) {
+        CHECK_EQ(got.seg[i].level, want.seg[i].level);
+        CHECK_EQ(got.seg[i].cycles, want.seg[i].cycles);
+      }
+    }
+
+    IRTrans_destroy(tx);
+  }
+
+  IRSchedule_destroy(sched);
+}
+
+/* SendPacket compiles once, a packet sent again is played as it is */
+static void test_reuse(void)
+{
+  IRTrans* tx = IRTrans_create(TX_PIN);
+  IRSchedule* sched = tx->schedule;
+
+  host_reset();
+  tx->SendPacket(tx, 17, 0x1A5A5);
+  tx->SendPacket(tx, 17, 0x1A5A5);
+  CHECK_EQ(sched->n_compiled, 1);
+  CHECK_EQ(sched->n_reused, 1);
+
+  tx->SendPacket(tx, 17, 0x1A5A4);
+  CHECK_EQ(sched->n_compiled, 2);
+
+  IRTrans_set_sync_mode(tx, SYNC_PREAMBLE);
+  tx->SendPacket(tx, 17, 0x1A5A4);
+  CHECK_EQ(sched->n_compiled, 3);
+  CHECK_EQ(sched->n_reused, 1);
+
+  IRTrans_destroy(tx);
+}
+
+static uint32_t n_ones;
+
+static void count_one(IRTrans* tx)
+{
+  n_ones++;
+  send_one(tx);
+}
+
+/* A replaced symbol method is still what goes on air: no schedule then */
+static void test_override(void)
+{
+  IRTrans* tx = IRTrans_create(TX_PIN);
+  IRSchedule* sched = tx->schedule;
+  uint64_t frame = IRTrans_frame(tx, 17, 0x1A5A5);
+  uint32_t ones = 0;
+
+  for (int i=0; i<=17; i++) ones += (frame >> i) & 1;
+
+  host_reset();
+  n_ones = 0;
+  tx->SendOne = &count_one;
+  tx->SendPacket(tx, 17, 0x1A5A5);
+  CHECK_EQ(n_ones, ones*tx->repeat);
+  CHECK_EQ(sched->n_compiled, 0);
+  CHECK_EQ(tx->n_symbol_sends, 1);
+
+  /* The defaults back: the schedule again */
+  tx->SendOne = &send_one;
+  tx->SendPacket(tx, 17, 0x1A5A5);
+  CHECK_EQ(n_ones, ones*tx->repeat);
+  CHECK_EQ(sched->n_compiled, 1);
+  CHECK_EQ(tx->n_symbol_sends, 1);
+
+  /* The preamble is the default header for SYNC_PREAMBLE, the header isn't */
+  IRTrans_set_sync_mode(tx, SYNC_PREAMBLE);
+  tx->SendPacket(tx, 17, 0x1A5A5);
+  CHECK_EQ(sched->n_compiled, 2);
+  tx->SendHeader = &send_header;
+  tx->SendPacket(tx, 17, 0x1A5A5);
+  CHECK_EQ(tx->n_symbol_sends, 2);
+
+  IRTrans_destroy(tx);
+}
+
+int main(void)
+{
+  TEST_RUN(test_compile);
+  TEST_RUN(test_play);
+  TEST_RUN(test_reuse);
+  TEST_RUN(test_override);
+
+  return test_exit("test_schedule");
+}
@@ -0,0 +1,189 @@
+/************************************************************
+
+  SpillLog host tests
+
+  A RAM backend that counts its page writes, to check that the
+  FIFO Push never writes a page itself and that everything it
+  drops comes back out of the drain, in order. Then the same
+  through the Linux file backend.
+
+ ************************************************************/
+#include "test.h"
+
+#include <string.h>
+#include <unistd.h>
+
+#include "FIFO.h"
+#include "SpillLog.h"
+
+/*************************************************************
+
+  RAM backend
+
+**************************************************************/
+static uint32_t n_writes = 0;
+
+static int ram_write_page(SpillLog* log, uint32_t page_idx, const SpillPage* page)
+{
+  memcpy((SpillPage*)log->ctx + page_idx, page, SPILL_PAGE_SIZE);
+  n_writes++;
+  return SPILL_SUCCESS;
+}
+
+static int ram_read_page(SpillLog* log, uint32_t page_idx, SpillPage* page)
+{
+  memcpy(page, (SpillPage*)log->ctx + page_idx, SPILL_PAGE_SIZE);
+  return SPILL_SUCCESS;
+}
+
+static SpillLog* ram_log(uint32_t n_pages)
+{
+  SpillLog* log = SpillLog_create_skel(n_pages);
+
+  log->ctx       = calloc(n_pages, sizeof(SpillPage));
+  log->WritePage = &ram_write_page;
+  log->ReadPage  = &ram_read_page;
+
+  n_writes = 0;
+  return log;
+}
+
+/* Drains everything and checks it counts up from 'first' */
+static uint32_t drain_check(SpillLog* log, uint32_t first)
+{
+  fifo_data_t buf[17];
+  uint32_t expect = first, n, k;
+
+  while ((n = SpillLog_drain(log, buf, 17)) > 0) {
+    for (k=0; k<n; k++) CHECK_EQ(buf[k], (expect++) & 0xFFF);
+  }
+
+  return expect - first;
+}
+
+/*************************************************************
+
+  Tests
+
+**************************************************************/
+/* Push only queues pages, SpillLog_service writes them */
+static void test_deferred(void)
+{
+  SpillLog* log = ram_log(8);
+  FIFO* fifo = FIFO_create(30);
+  uint32_t n_spilled = 30 + SPILL_PENDING_PAGES*SPILL_ENTRIES_PER_PAGE;
+
+  FIFO_attach_spill(fifo, log);
+
+  for (uint32_t i=0; i<n_spilled; i++) fifo->Push(fifo, i & 0xFFF);
+
+  CHECK_EQ(n_writes, 0);
+  CHECK_EQ(log->n_pending, SPILL_PENDING_PAGES);
+  CHECK_EQ(SpillLog_count(log), n_spilled - 30);
+
+  CHECK_EQ(SpillLog_service(log), SPILL_SUCCESS);
+  CHECK_EQ(n_writes, SPILL_PENDING_PAGES);
+  CHECK_EQ(log->n_pending, 0);
+
+  /* Some more, left in RAM: the drain takes the written ones first */
+  for (uint32_t i=n_spilled; i<n_spilled + 100; i++) fifo->Push(fifo, i & 0xFFF);
+  CHECK_EQ(drain_check(log, 0), n_spilled + 100 - 30);
+  CHECK_EQ(log->n_crc_errors, 0);
+  CHECK_EQ(log->n_lost, 0);
+
+  /* Emptied: starts over from the first page */
+  CHECK_EQ(log->write_page, 0);
+  CHECK_EQ(SpillLog_count(log), 0);
+
+  FIFO_destroy(fifo);
+  SpillLog_destroy(log);
+}
+
+/* Without a service call, the queue and the page being filled are all there is */
+static void test_lost(void)
+{
+  SpillLog* log = ram_log(8);
+  uint32_t room = (SPILL_PENDING_PAGES + 1)*SPILL_ENTRIES_PER_PAGE;
+
+  for (uint32_t i=0; i<room; i++) CHECK_EQ(SpillLog_append(log, i), SPILL_SUCCESS);
+  CHECK_EQ(SpillLog_append(log, room), SPILL_FULL);
+  CHECK_EQ(log->n_lost, 1);
+
+  /* A service call makes room again */
+  SpillLog_service(log);
+  CHECK_EQ(SpillLog_append(log, room), SPILL_SUCCESS);
+  CHECK_EQ(drain_check(log, 0), room + 1);
+
+  /* A full backend keeps the pages queued, still drainable */
+  SpillLog_destroy(log);
+  log = ram_log(1);
+  for (uint32_t i=0; i<2*SPILL_ENTRIES_PER_PAGE; i++) SpillLog_append(log, i);
+  CHECK_EQ(SpillLog_service(log), SPILL_FULL);
+  CHECK_EQ(n_writes, 1);
+  CHECK_EQ(drain_check(log, 0), 2*SPILL_ENTRIES_PER_PAGE);
+
+  SpillLog_destroy(log);
+}
+
+/* A batch larger than the depth spills its head after the stored entries */
+static void test_batch_overflow(void)
+{
+  SpillLog* log = ram_log(8);
+  FIFO* fifo = FIFO_create(16);
+  fifo_data_t batch[40];
+  FIFOStats stats;
+
+  FIFO_attach_spill(fifo, log);
+
+  for (uint32_t i=0; i<10; i++) fifo->Push(fifo, i);
+  for (uint32_t i=0; i<40; i++) batch[i] = 10 + i;
+
+  CHECK_EQ(FIFO_push_n(fifo, batch, 40), 16);
+
+  FIFO_get_stats(fifo, &stats);
+  CHECK_EQ(stats.n_drops, 34);
+  CHECK_EQ(SpillLog_count(log), 34);
+  CHECK_EQ(drain_check(log, 0), 34);
+
+  for (uint32_t i=34; i<50; i++) CHECK_EQ(fifo->Pop(fifo), i);
+
+  FIFO_destroy(fifo);
+  SpillLog_destroy(log);
+}
+
+static void test_file(void)
+{
+  char path[] = "/tmp/test_spill_XXXXXX";
+  int fd = mkstemp(path);
+  SpillLog* log;
+
+  CHECK(fd >= 0);
+  close(fd);
+
+  log = SpillLog_create_file(path, 16);
+  CHECK(log != NULL);
+
+  for (uint32_t i=0; i<500; i++) {
+    SpillLog_append(log, i & 0xFFF);
+    if ((i % 100) == 99) CHECK_EQ(SpillLog_service(log), SPILL_SUCCESS);
+  }
+  CHECK_EQ(SpillLog_flush(log), SPILL_SUCCESS);
+  CHECK_EQ(log->n_pending, 0);
+  CHECK_EQ(log->wpage.hdr.count, 0);
+
+  CHECK_EQ(drain_check(log, 0), 500);
+  CHECK_EQ(log->n_crc_errors, 0);
+
+  SpillLog_destroy(log);
+  unlink(path);
+}
+
+int main(void)
+{
+  TEST_RUN(test_deferred);
+  TEST_RUN(test_lost);
+  TEST_RUN(test_batch_overflow);
+  TEST_RUN(test_file);
+
+  return test_exit("test_spill");
+}
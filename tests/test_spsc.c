@@ -0,0 +1,179 @@
+/************************************************************
+
+  SPSCFIFO host tests
+
+  Single-threaded semantics first, then a pthread producer
+  and consumer hammering a small FIFO: every entry has to come
+  out once, in order, whichever mix of single and batch calls
+  the two sides use.
+
+ ************************************************************/
+#include "test.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stddef.h>
+
+#include "SPSCFIFO.h"
+
+static void test_layout(void)
+{
+  SPSCFIFO* fifo = SPSCFIFO_create(16);
+
+  CHECK_EQ((uintptr_t)fifo % SPSC_CACHE_LINE, 0);
+  CHECK(offsetof(SPSCFIFO, tail) - offsetof(SPSCFIFO, head) >= SPSC_CACHE_LINE);
+  CHECK(offsetof(SPSCFIFO, capacity) - offsetof(SPSCFIFO, tail) >= SPSC_CACHE_LINE);
+  CHECK_EQ(fifo->capacity, 16);
+
+  SPSCFIFO_destroy(fifo);
+}
+
+static void test_single(void)
+{
+  SPSCFIFO* fifo = SPSCFIFO_create(5);
+  fifo_data_t data;
+
+  CHECK_EQ(fifo->capacity, 8);
+  CHECK_EQ(pop_spsc_fifo(fifo, &data), SPSC_EMPTY);
+
+  for (uint32_t i=0; i<8; i++) CHECK_EQ(push_spsc_fifo(fifo, i), SPSC_SUCCESS);
+
+  /* Full: the new one is rejected, nothing is overwritten */
+  CHECK_EQ(push_spsc_fifo(fifo, 99), SPSC_FULL);
+  CHECK_EQ(fifo->n_rejected, 1);
+  CHECK_EQ(SPSCFIFO_count(fifo), 8);
+
+  for (uint32_t i=0; i<8; i++) {
+    CHECK_EQ(pop_spsc_fifo(fifo, &data), SPSC_SUCCESS);
+    CHECK_EQ(data, i);
+  }
+  CHECK_EQ(pop_spsc_fifo(fifo, &data), SPSC_EMPTY);
+
+  SPSCFIFO_destroy(fifo);
+}
+
+/* The spans stop at the end of the buffer */
+static void test_spans(void)
+{
+  SPSCFIFO* fifo = SPSCFIFO_create(8);
+  fifo_data_t* wspan;
+  const fifo_data_t* rspan;
+  FIFO* dest = FIFO_create(16);
+  uint32_t n;
+
+  for (uint32_t i=0; i<6; i++) push_spsc_fifo(fifo, i);
+  n = SPSCFIFO_peek(fifo, &rspan, 4);
+  CHECK_EQ(n, 4);
+  SPSCFIFO_release(fifo, 4);
+
+  /* head at 6: two slots to the end, then it wraps */
+  n = SPSCFIFO_reserve(fifo, &wspan, 5);
+  CHECK_EQ(n, 2);
+  wspan[0] = 6; wspan[1] = 7;
+  SPSCFIFO_commit(fifo, 2);
+
+  n = SPSCFIFO_reserve(fifo, &wspan, 10);
+  CHECK_EQ(n, 4);
+  for (uint32_t k=0; k<n; k++) wspan[k] = 8 + k;
+  SPSCFIFO_commit(fifo, n);
+
+  /* Nothing is visible to the producer as free until released */
+  CHECK_EQ(SPSCFIFO_reserve(fifo, &wspan, 1), 0);
+
+  /* The drain takes both spans, in order */
+  CHECK_EQ(SPSCFIFO_drain(fifo, dest), 8);
+  for (uint32_t i=4; i<12; i++) CHECK_EQ(dest->Pop(dest), i);
+  CHECK_EQ(SPSCFIFO_count(fifo), 0);
+
+  FIFO_destroy(dest);
+  SPSCFIFO_destroy(fifo);
+}
+
+/*************************************************************
+
+  Stress
+
+**************************************************************/
+#define STRESS_ENTRIES   4000000u
+
+typedef struct {
+  SPSCFIFO* fifo;
+  uint32_t  n;
+} StressArgs;
+
+/* Alternates single pushes and batches of 1..16 */
+static void* stress_producer(void* arg)
+{
+  StressArgs* a = (StressArgs*)arg;
+  fifo_data_t* span;
+  uint32_t next = 0, n, k;
+
+  while (next < a->n) {
+    if (next & 0x100) {
+      if (push_spsc_fifo(a->fifo, next) == SPSC_SUCCESS) next++;
+      else sched_yield();
+      continue;
+    }
+
+    n = SPSCFIFO_reserve(a->fifo, &span, 1 + (next % 16));
+    for (k=0; k<n && next<a->n; k++) span[k] = next++;
+    if (k) SPSCFIFO_commit(a->fifo, k);
+    else sched_yield();
+  }
+
+  return NULL;
+}
+
+static void test_stress(void)
+{
+  SPSCFIFO* fifo = SPSCFIFO_create(64);
+  StressArgs args = { fifo, STRESS_ENTRIES };
+  const fifo_data_t* span;
+  fifo_data_t data;
+  uint32_t expect = 0, bad = 0, n, k;
+  pthread_t producer;
+
+  CHECK_EQ(pthread_create(&producer, NULL, &stress_producer, &args), 0);
+
+  /* Alternates single pops and spans, so both sides mix their calls */
+  while (expect < STRESS_ENTRIES) {
+    if (expect & 0x80) {
+      if (pop_spsc_fifo(fifo, &data) != SPSC_SUCCESS) {
+        sched_yield();
+        continue;
+      }
+      if (data != expect) bad++;
+      expect++;
+      continue;
+    }
+
+    n = SPSCFIFO_peek(fifo, &span, 1 + (expect % 13));
+    if (!n) {
+      sched_yield();
+      continue;
+    }
+    for (k=0; k<n; k++) {
+      if (span[k] != expect + k) bad++;
+    }
+    SPSCFIFO_release(fifo, n);
+    expect += n;
+  }
+
+  pthread_join(producer, NULL);
+
+  CHECK_EQ(bad, 0);
+  CHECK_EQ(expect, STRESS_ENTRIES);
+  CHECK_EQ(SPSCFIFO_count(fifo), 0);
+
+  SPSCFIFO_destroy(fifo);
+}
+
+int main(void)
+{
+  TEST_RUN(test_layout);
+  TEST_RUN(test_single);
+  TEST_RUN(test_spans);
+  TEST_RUN(test_stress);
+
+  return test_exit("test_spsc");
+}
@@ -0,0 +1,174 @@
+/************************************************************
+
+  SWIMProtocol host tests
+
+  The submerged unit's side of READ_ALL with queued replies:
+  SendData queues the reply, the queue is ticked from the
+  simulated clock, and what went on air is read back off the
+  queue's schedule. With timestamps, the EOB has to carry the
+  age of the newest sample as of when the EOB went out, behind
+  the data packets. A reply longer than the queue is queued a
+  piece at a time by the ReadCmd calls that follow, none of
+  them waiting on the queue.
+
+ ************************************************************/
+#include "test.h"
+
+#include "SWIMProtocol.h"
+
+#define IR_PIN           3
+#define N_SAMPLES        6
+#define N_LONG           25
+#define LONG_DEPTH       4
+#define TS_BITS          (SWIM_CHAN_DATA_BITS + SWIM_TS_DELTA_BITS)
+
+static uint32_t sample(uint8_t ch, uint16_t adc)
+{
+  return ((uint32_t)ch << FIFO_ENTRY_ADDR_SHIFT) | adc;
+}
+
+static uint64_t eob(uint32_t n_sent, uint32_t age_ms)
+{
+  return ((uint64_t)age_ms << SWIM_CHAN_DATA_BITS) |
+    ((uint64_t)SWIM_EOB_ADDR << SWIM_ADC_DATA_BITS) | n_sent;
+}
+
+/**
+ * Ticks the queue until it's empty. --> The clock at the tick that
+ * finished the first 'n' packets (and put the next one on air)
+ */
+static uint64_t run_queue(IRTxQueue* txq, uint32_t n)
+{
+  uint64_t at = 0;
+  uint32_t wait;
+
+  while ((wait = IRTxQueue_tick(txq, (uint32_t)host_clock_now())) != IRTXQ_IDLE) {
+    if (!at && txq->n_sent >= n) at = host_clock_now();
+    host_clock_advance(wait);
+  }
+
+  return at;
+}
+
+/*************************************************************
+
+  Tests
+
+**************************************************************/
+/* The EOB age is taken as the EOB is dequeued, not as it's queued */
+static void test_eob_age(void)
+{
+  SWIMProtocol* s_prot = SWIMProtocol_create_with_params(IR_PIN, 38000, 32);
+  uint64_t last_ms, eob_at;
+
+  host_reset();
+  host_clock_set(10000000);
+  swim_enable_timestamps(s_prot, &swim_clock_ms);
+  swim_enable_tx_queue(s_prot, 8);
+
+  for (uint8_t ch=0; ch<N_SAMPLES; ch++) {
+    s_prot->spFIFO->Push(s_prot->spFIFO, sample(ch, 100 + ch));
+    host_clock_advance(1000);
+  }
+  last_ms = host_clock_now()/1000 - 1;
+
+  s_prot->cmd_cache = SWIM_CMD_READ_ALL;
+  CHECK_EQ(s_prot->SendData(s_prot), SWIM_SUCCESS);
+  CHECK_EQ(IRTxQueue_depth(s_prot->txQueue), N_SAMPLES + 1);
+
+  eob_at = run_queue(s_prot->txQueue, N_SAMPLES);
+  CHECK_EQ(s_prot->txQueue->n_sent, N_SAMPLES + 1);
+
+  /* Hundreds of ms of data ahead of it */
+  CHECK(eob_at/1000 - last_ms > 100);
+  CHECK(IRTrans_schedule_matches(s_prot->Trans, s_prot->txQueue->sched, TS_BITS,
+    eob(N_SAMPLES, (uint32_t)(eob_at/1000 - last_ms))));
+
+  SWIMProtocol_destroy(s_prot);
+}
+
+/* The i-th packet of the long reply, the EOB after the samples */
+static uint64_t long_packet(uint32_t i)
+{
+  if (i == N_LONG) return eob(N_LONG, 0);
+  return ((uint64_t)(i % SWIM_N_CHANNELS) << SWIM_ADC_DATA_BITS) | (200 + i);
+}
+
+/**
+ * Ticks until the next packet is out. --> Whether it was 'packet',
+ * checked while it's on air: the tick ending it starts the next one
+ */
+static bool run_packet(IRTxQueue* txq, uint64_t packet)
+{
+  uint32_t n = txq->n_sent, wait;
+  bool match;
+
+  if (!txq->active) host_clock_advance(IRTxQueue_tick(txq, (uint32_t)host_clock_now()));
+  match = IRTrans_schedule_matches(txq->irTrans, txq->sched, SWIM_CHAN_DATA_BITS, packet);
+
+  while (txq->n_sent == n) {
+    wait = IRTxQueue_tick(txq, (uint32_t)host_clock_now());
+    if (wait != IRTXQ_IDLE) host_clock_advance(wait);
+  }
+
+  return match;
+}
+
+/* Queued as there's room, from the loop: SendData and ReadCmd never tick */
+static void test_readall_resume(void)
+{
+  SWIMProtocol* s_prot = SWIMProtocol_create_with_params(IR_PIN, 38000, 32);
+  IRTxQueue* txq;
+  uint64_t start;
+  uint32_t n_calls = 0, n_right = 0;
+
+  host_reset();
+  host_clock_set(20000000);
+  swim_enable_tx_queue(s_prot, LONG_DEPTH);
+  txq = s_prot->txQueue;
+
+  for (uint8_t i=0; i<N_LONG; i++) {
+    s_prot->spFIFO->Push(s_prot->spFIFO, sample(i % SWIM_N_CHANNELS, 200 + i));
+  }
+
+  start = host_clock_now();
+  s_prot->cmd_cache = SWIM_CMD_READ_ALL;
+  CHECK_EQ(s_prot->SendData(s_prot), SWIM_TX_PENDING);
+  CHECK_EQ(IRTxQueue_depth(txq), LONG_DEPTH);
+  CHECK_EQ(txq->n_sent, 0);
+  CHECK_EQ(host_clock_now(), start);
+
+  /* Busy with the reply: no command sent or listened for meanwhile */
+  CHECK_EQ(s_prot->SendCmd(s_prot, SWIM_CMD_WAKEUP, 0), SWIM_TX_PENDING);
+  CHECK_EQ(swim_enable_tx_queue(s_prot, 0), SWIM_TX_PENDING);
+  CHECK(s_prot->txQueue == txq);
+
+  while (s_prot->tx_pending || IRTxQueue_depth(txq)) {
+    n_right += run_packet(txq, long_packet(txq->n_sent));
+    start = host_clock_now();
+    if (s_prot->tx_pending || IRTxQueue_depth(txq)) {
+      CHECK_EQ(s_prot->ReadCmd(s_prot), SWIM_TX_PENDING);
+      CHECK_EQ(host_clock_now(), start);
+      n_calls++;
+    }
+  }
+
+  CHECK(n_calls > N_LONG - LONG_DEPTH);
+  CHECK_EQ(txq->n_sent, N_LONG + 1);
+  CHECK_EQ(s_prot->spFIFO->n_nodes, 0);
+
+  /* All of them, in order, and the EOB counting them */
+  CHECK_EQ(n_right, N_LONG + 1);
+
+  CHECK_EQ(swim_enable_tx_queue(s_prot, 0), SWIM_SUCCESS);
+
+  SWIMProtocol_destroy(s_prot);
+}
+
+int main(void)
+{
+  TEST_RUN(test_eob_age);
+  TEST_RUN(test_readall_resume);
+
+  return test_exit("test_swim");
+}
@@ -0,0 +1,270 @@
+/************************************************************
+
+  IRTxQueue host tests
+
+  The queue is ticked from the simulated clock, advanced by what
+  each tick returns (plus some timer latency), and every pin
+  write is logged. The edges have to come out as the blocking
+  send_packet puts them, a packet with a fill hook gets filled
+  once the ones ahead of it are out, and the queue has to pick
+  up right away wherever the 32 bit clock is: first used past
+  2^31, idle for longer than that, or a packet across the wrap.
+
+ ************************************************************/
+#include "test.h"
+
+#include "IRTxQueue.h"
+
+#define TX_PIN           3
+#define N_PACKETS        5
+#define MAX_EDGES        40000
+
+static const uint64_t packets[N_PACKETS] = { 0x1A5A5, 0x00001, 0x1FFFF, 0x12345, 0x1A5A5 };
+
+typedef struct {
+  uint64_t t[MAX_EDGES];
+  uint8_t  level[MAX_EDGES];
+  uint32_t n;
+} EdgeLog;
+
+static EdgeLog ref, got;
+static EdgeLog* logging;
+
+static void log_write(uint8_t pin, uint8_t level)
+{
+  if (pin != TX_PIN || logging->n >= MAX_EDGES) return;
+  logging->t[logging->n]     = host_clock_now();
+  logging->level[logging->n] = level;
+  logging->n++;
+}
+
+static void start_log(EdgeLog* log)
+{
+  log->n  = 0;
+  logging = log;
+  host_on_write(&log_write);
+}
+
+static uint32_t n_done;
+
+static void count_done(void* ctx, uint64_t packet, int status)
+{
+  (void)ctx;
+  (void)packet;
+  if (status == IRTXQ_SUCCESS) n_done++;
+}
+
+/**
+ * Ticks until the queue is empty, each tick up to 'max_late' us
+ * after it asked for. --> The ticks
+ */
+static uint32_t run_queue(IRTxQueue* txq, uint32_t max_late, uint64_t* seed)
+{
+  uint32_t wait, n = 0;
+
+  while ((wait = IRTxQueue_tick(txq, (uint32_t)host_clock_now())) != IRTXQ_IDLE) {
+    CHECK(wait < 0x10000);
+    if (wait >= 0x10000) break;
+
+    host_clock_advance(wait + (max_late ? test_rand(seed) % (max_late + 1) : 0));
+    n++;
+  }
+
+  return n;
+}
+
+/* The blocking send, the edges to match */
+static void reference_edges(IRTrans* tx)
+{
+  host_reset();
+  host_clock_set(1000000);
+  start_log(&ref);
+  for (int k=0; k<N_PACKETS; k++) tx->SendPacket(tx, 17, packets[k]);
+  host_on_write(NULL);
+}
+
+/* Worst offset of the edges from the reference, both from their first one */
+static uint64_t max_offset(const EdgeLog* a, const EdgeLog* b)
+{
+  uint64_t d, worst = 0;
+
+  for (uint32_t i=0; i<a->n && i<b->n; i++) {
+    CHECK_EQ(a->level[i], b->level[i]);
+    d = (a->t[i] - a->t[0]) - (b->t[i] - b->t[0]);
+    if ((int64_t)d < 0) d = -d;
+    if (d > worst) worst = d;
+  }
+
+  return worst;
+}
+
+/*************************************************************
+
+  Tests
+
+**************************************************************/
+static void test_full(void)
+{
+  IRTrans* tx = IRTrans_create(TX_PIN);
+  IRTxQueue* txq = IRTxQueue_create(tx, 3);
+  uint64_t seed = 1;
+
+  host_reset();
+  CHECK_EQ(txq->mask, 3);
+  CHECK_EQ(IRTxQueue_room(txq), 4);
+  for (int k=0; k<4; k++) CHECK_EQ(IRTxQueue_push(txq, 17, packets[k], NULL, NULL), IRTXQ_SUCCESS);
+  CHECK_EQ(IRTxQueue_push(txq, 17, packets[4], NULL, NULL), IRTXQ_FULL);
+  CHECK_EQ(IRTxQueue_depth(txq), 4);
+  CHECK_EQ(IRTxQueue_room(txq), 0);
+
+  run_queue(txq, 0, &seed);
+  CHECK_EQ(IRTxQueue_depth(txq), 0);
+  CHECK_EQ(txq->n_sent, 4);
+
+  IRTxQueue_destroy(txq);
+  IRTrans_destroy(tx);
+}
+
+/* Ticked on time, or up to 8 us late: the blocking edges, no drift */
+static void test_edges(void)
+{
+  static const uint32_t lates[] = { 0, 8 };
+  IRTrans* tx = IRTrans_create_with_freq(TX_PIN, 38000);
+  IRTxQueue* txq = IRTxQueue_create(tx, 8);
+  uint64_t seed = 3;
+
+  reference_edges(tx);
+
+  for (unsigned l=0; l<sizeof(lates)/sizeof(lates[0]); l++) {
+    host_reset();
+    host_clock_set(5000000);
+    n_done = 0;
+    for (int k=0; k<N_PACKETS; k++) IRTxQueue_push(txq, 17, packets[k], &count_done, NULL);
+
+    start_log(&got);
+    run_queue(txq, lates[l], &seed);
+    host_on_write(NULL);
+
+    CHECK_EQ(n_done, N_PACKETS);
+    CHECK_EQ(got.n, ref.n);
+
+    /* The blocking send reads the clock a us late, once a packet */
+    CHECK(max_offset(&got, &ref) <= lates[l] + N_PACKETS);
+  }
+
+  CHECK_EQ(txq->n_skipped, 0);
+
+  IRTxQueue_destroy(txq);
+  IRTrans_destroy(tx);
+}
+
+static uint64_t fill_t, done_packet;
+static uint32_t n_fill;
+
+static uint64_t fill_time(void* ctx, uint64_t packet)
+{
+  (void)ctx;
+  fill_t = host_clock_now();
+  n_fill++;
+  return packet | 0x100;
+}
+
+static void keep_done(void* ctx, uint64_t packet, int status)
+{
+  (void)ctx;
+  if (status == IRTXQ_SUCCESS) done_packet = packet;
+}
+
+/* Filled in as it goes on air, after what's queued ahead of it */
+static void test_fill(void)
+{
+  IRTrans* tx = IRTrans_create_with_freq(TX_PIN, 38000);
+  IRTxQueue* txq = IRTxQueue_create(tx, 4);
+  uint64_t seed = 5, first_end;
+
+  host_reset();
+  host_clock_set(2000000);
+  n_fill = 0;
+  IRTxQueue_push(txq, 17, packets[0], NULL, NULL);
+  IRTxQueue_push_fill(txq, 17, 0x00001, &fill_time, &keep_done, NULL);
+  CHECK_EQ(n_fill, 0);
+
+  /* The first packet out, up to its last edge */
+  start_log(&got);
+  while (txq->n_sent == 0) {
+    host_clock_advance(IRTxQueue_tick(txq, (uint32_t)host_clock_now()));
+  }
+  first_end = got.t[got.n - 1];
+  host_on_write(NULL);
+
+  run_queue(txq, 0, &seed);
+  CHECK_EQ(n_fill, 1);
+  CHECK(fill_t >= first_end);
+  CHECK_EQ(done_packet, 0x00101);
+  CHECK(IRTrans_schedule_matches(tx, txq->sched, 17, 0x00101));
+
+  IRTxQueue_destroy(txq);
+  IRTrans_destroy(tx);
+}
+
+/* The 32 bit clock anywhere: the packet starts on the tick it's picked up by */
+static void test_wrap(void)
+{
+  IRTrans* tx = IRTrans_create_with_freq(TX_PIN, 38000);
+  IRTxQueue* txq = IRTxQueue_create(tx, 8);
+  uint64_t seed = 7, start;
+
+  reference_edges(tx);
+
+  /* First used past 2^31, next_us never set */
+  host_reset();
+  host_clock_set(0x90000000);
+  IRTxQueue_push(txq, 17, packets[0], NULL, NULL);
+  start_log(&got);
+  CHECK(IRTxQueue_tick(txq, (uint32_t)host_clock_now()) <= tx->irComm->period);
+  CHECK_EQ(got.n, 1);
+  CHECK_EQ(got.t[0], 0x90000000);
+  run_queue(txq, 0, &seed);
+
+  /* Idle for more than 2^31 us */
+  host_clock_advance(0xA0000000);
+  start = host_clock_now();
+  IRTxQueue_push(txq, 17, packets[1], NULL, NULL);
+  start_log(&got);
+  IRTxQueue_tick(txq, (uint32_t)host_clock_now());
+  CHECK_EQ(got.n, 1);
+  CHECK_EQ(got.t[0], start);
+  run_queue(txq, 0, &seed);
+
+  /* All five across the wrap, edges as the reference */
+  host_clock_set(0x100000000ULL - 100000);
+  for (int k=0; k<N_PACKETS; k++) IRTxQueue_push(txq, 17, packets[k], NULL, NULL);
+  start_log(&got);
+  run_queue(txq, 0, &seed);
+  CHECK(host_clock_now() > 0x100000000ULL);
+  CHECK_EQ(got.n, ref.n);
+  CHECK(max_offset(&got, &ref) <= N_PACKETS);
+
+  /* Flush after a long idle: about a packet, not half an hour */
+  host_on_write(NULL);
+  host_clock_advance(0xC0000000);
+  start = host_clock_now();
+  IRTxQueue_push(txq, 17, packets[2], NULL, NULL);
+  IRTxQueue_flush(txq);
+  CHECK(host_clock_now() - start < 2*IRSchedule_cycles(txq->sched)*tx->irComm->period);
+
+  CHECK_EQ(txq->n_sent, 3 + N_PACKETS);
+
+  IRTxQueue_destroy(txq);
+  IRTrans_destroy(tx);
+}
+
+int main(void)
+{
+  TEST_RUN(test_full);
+  TEST_RUN(test_edges);
+  TEST_RUN(test_fill);
+  TEST_RUN(test_wrap);
+
+  return test_exit("test_txqueue");
+}